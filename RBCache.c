@@ -0,0 +1,427 @@
+/**
+ * @file RBCache.c
+ * @author  Inbal Lavi <inbal.lavi1@mail.huji.ac.il>
+ * @version 1.0
+ * @date 3 June 2020
+ *
+ * @brief LRU / TTL cache built on RBTree
+ *
+ * @section LICENSE
+ * is free and should be used only for good. we do not support the dark side.
+ *
+ * @section DESCRIPTION
+ * every entry is in three structures: the key map finds it, the recency list (linked through the
+ * entries themselves) orders it by its last use, and the expiry tree orders it by its expiry time.
+ * the entry keeps its handles in the map and in the expiry tree, so removing it never searches.
+ */
+// ------------------------------ includes ------------------------------
+#include <stdlib.h>
+#include "RBCache.h"
+
+// -------------------------- const definitions -------------------------
+/**
+ * @brief return value for functions
+ */
+typedef enum FunctionReturn
+{
+    FAIL,
+    SUCCESS
+} FunctionReturn;
+
+/**
+ * @brief an entry of the cache
+ * newer, older: its neighbours in the recency list.
+ * keyHandle: its node in the key map. expiryHandle: its node in the expiry tree (NULL if it never
+ * expires). sequence: breaks the ties between entries that expire at the same time.
+ */
+typedef struct CacheEntry
+{
+    void *key, *value;
+    size_t bytes;
+    double expiry;
+    long unsigned sequence;
+    struct CacheEntry *newer, *older;
+    RBHandle keyHandle, expiryHandle;
+} CacheEntry;
+
+/**
+ * @brief why an entry is removed, for the counters
+ */
+typedef enum Removal
+{
+    REMOVED,
+    EVICTED,
+    EXPIRED
+} Removal;
+
+// -------------------------- func declarations -------------------------
+/**
+ * @brief finds the entry of a key
+ * @return the entry, or NULL if the key is not in the cache
+ */
+CacheEntry *findEntry(const RBCache *cache, const void *key);
+
+/**
+ * @brief the CompareFunc of the expiry tree: by expiry time, then by sequence
+ */
+int compareExpiries(const void *a, const void *b);
+
+/**
+ * @brief adds an entry to the expiry tree, if it expires
+ * @param cache - the cache
+ * @param entry - the entry, not in the expiry tree
+ * @return 0 on failure, other on success
+ */
+int scheduleExpiry(RBCache *cache, CacheEntry *entry);
+
+/**
+ * @brief moves an entry to a new expiry time. its place in the expiry tree depends on the time, so
+ * a copy with the new time is scheduled first, and only then takes the entry's place
+ * @param cache - the cache
+ * @param entry - the entry, replaced by its copy on success
+ * @param expiry - the new expiry time
+ * @return 0 on failure (the cache and the entry are left as they were), other on success
+ */
+int reschedule(RBCache *cache, CacheEntry **entry, double expiry);
+
+/**
+ * @brief puts an entry at the front of the recency list
+ */
+void pushNewest(RBCache *cache, CacheEntry *entry);
+
+/**
+ * @brief takes an entry out of the recency list
+ */
+void unlinkEntry(RBCache *cache, CacheEntry *entry);
+
+/**
+ * @brief removes an entry from all the structures of the cache and frees it with its key and value
+ * @param cache - the cache
+ * @param entry - the entry
+ * @param why - the counter to count it in
+ */
+void removeEntry(RBCache *cache, CacheEntry *entry, Removal why);
+
+/**
+ * @brief evicts the least recently used entries until the cache is within its bounds
+ */
+void evict(RBCache *cache);
+
+// ------------------------------ functions -----------------------------
+RBCache *newRBCache(CompareFunc keyCompFunc, FreeFunc keyFreeFunc, FreeFunc valueFreeFunc,
+                    size_t maxEntries, size_t maxBytes)
+{
+    RBCache *cache = (RBCache *) calloc(1, sizeof(RBCache));
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+    // the cache frees the keys and values itself, after it took the entry out of both trees
+    cache->keys = newRBMap(keyCompFunc, NULL, NULL);
+    cache->expiries = newRBTree(compareExpiries, NULL);
+    if (cache->keys == NULL || cache->expiries == NULL)
+    {
+        freeRBTree(&cache->keys);
+        freeRBTree(&cache->expiries);
+        free(cache);
+        return NULL;
+    }
+    cache->keyFreeFunc = keyFreeFunc, cache->valueFreeFunc = valueFreeFunc;
+    cache->maxEntries = maxEntries, cache->maxBytes = maxBytes;
+    return cache;
+}
+
+int RBCachePut(RBCache *cache, void *key, void *value, size_t bytes, double expiry)
+{
+    if (cache == NULL || key == NULL || (cache->maxBytes != 0 && bytes > cache->maxBytes) ||
+        (!(expiry >= 0) && expiry != RB_CACHE_NO_EXPIRY))
+    {
+        return FAIL;
+    }
+    // a single descent finds the key's node, or makes one for a new key
+    int inserted;
+    RBHandle keyHandle = RBTreeFindOrInsert(cache->keys, key, &inserted);
+    if (keyHandle == NULL)
+    {
+        return FAIL;
+    }
+    CacheEntry *entry;
+    if (!inserted)
+    {
+        entry = (CacheEntry *) *RBMapValue(keyHandle);
+        if (entry->expiry != expiry && !reschedule(cache, &entry, expiry))
+        {
+            return FAIL;
+        }
+        // nothing fails from here on, so the old value and the new copy of the key can go
+        if (key != entry->key && cache->keyFreeFunc != NULL)
+        {
+            cache->keyFreeFunc(key);
+        }
+        if (value != entry->value && cache->valueFreeFunc != NULL)
+        {
+            cache->valueFreeFunc(entry->value);
+        }
+        entry->value = value;
+        cache->bytes = cache->bytes - entry->bytes + bytes;
+        entry->bytes = bytes;
+        unlinkEntry(cache, entry);
+        pushNewest(cache, entry);
+        evict(cache);
+        return SUCCESS;
+    }
+
+    entry = (CacheEntry *) calloc(1, sizeof(CacheEntry));
+    if (entry == NULL)
+    {
+        RBTreeEraseHandle(cache->keys, keyHandle);
+        return FAIL;
+    }
+    entry->key = key, entry->value = value;
+    entry->bytes = bytes, entry->expiry = expiry;
+    entry->sequence = cache->sequence++;
+    entry->keyHandle = keyHandle;
+    *RBMapValue(keyHandle) = entry;
+    if (!scheduleExpiry(cache, entry))
+    {
+        RBTreeEraseHandle(cache->keys, keyHandle);
+        free(entry);
+        return FAIL;
+    }
+    pushNewest(cache, entry);
+    cache->entries++;
+    cache->bytes += bytes;
+    evict(cache);
+    return SUCCESS;
+}
+
+void *RBCacheGet(RBCache *cache, const void *key)
+{
+    if (cache == NULL || key == NULL)
+    {
+        return NULL;
+    }
+    CacheEntry *entry = findEntry(cache, key);
+    if (entry == NULL)
+    {
+        cache->stats.misses++;
+        return NULL;
+    }
+    cache->stats.hits++;
+    if (entry != cache->newest)
+    {
+        unlinkEntry(cache, entry);
+        pushNewest(cache, entry);
+    }
+    return entry->value;
+}
+
+int RBCacheRemove(RBCache *cache, const void *key)
+{
+    if (cache == NULL || key == NULL)
+    {
+        return FAIL;
+    }
+    CacheEntry *entry = findEntry(cache, key);
+    if (entry == NULL)
+    {
+        return FAIL;
+    }
+    removeEntry(cache, entry, REMOVED);
+    return SUCCESS;
+}
+
+size_t RBCacheExpireBefore(RBCache *cache, double now)
+{
+    if (cache == NULL)
+    {
+        return 0;
+    }
+    size_t expired = 0;
+    CacheEntry *entry = (CacheEntry *) RBTreePeekMin(cache->expiries);
+    while (entry != NULL && entry->expiry < now)
+    {
+        removeEntry(cache, entry, EXPIRED);
+        expired++;
+        entry = (CacheEntry *) RBTreePeekMin(cache->expiries);
+    }
+    return expired;
+}
+
+RBCacheStats RBCacheGetStats(const RBCache *cache)
+{
+    RBCacheStats stats = {0, 0, 0, 0};
+    if (cache != NULL)
+    {
+        stats = cache->stats;
+    }
+    return stats;
+}
+
+void freeRBCache(RBCache **cache)
+{
+    if (cache == NULL || *cache == NULL)
+    {
+        return;
+    }
+    while ((*cache)->oldest != NULL)
+    {
+        removeEntry(*cache, (*cache)->oldest, REMOVED);
+    }
+    freeRBTree(&(*cache)->keys);
+    freeRBTree(&(*cache)->expiries);
+    free(*cache);
+    *cache = NULL;
+}
+
+CacheEntry *findEntry(const RBCache *cache, const void *key)
+{
+    void *entry;
+    if (!RBMapGet(cache->keys, key, &entry))
+    {
+        return NULL;
+    }
+    return (CacheEntry *) entry;
+}
+
+int compareExpiries(const void *a, const void *b)
+{
+    const CacheEntry *first = (const CacheEntry *) a, *second = (const CacheEntry *) b;
+    if (first->expiry != second->expiry)
+    {
+        return first->expiry < second->expiry ? -1 : 1;
+    }
+    return (first->sequence > second->sequence) - (first->sequence < second->sequence);
+}
+
+int scheduleExpiry(RBCache *cache, CacheEntry *entry)
+{
+    entry->expiryHandle = NULL;
+    if (entry->expiry == RB_CACHE_NO_EXPIRY)
+    {
+        return SUCCESS;
+    }
+    // no two entries are equal in the expiry tree, so the entry is always inserted
+    entry->expiryHandle = RBTreeFindOrInsert(cache->expiries, entry, NULL);
+    return entry->expiryHandle != NULL;
+}
+
+int reschedule(RBCache *cache, CacheEntry **entry, double expiry)
+{
+    CacheEntry *old = *entry;
+    CacheEntry *fresh = (CacheEntry *) malloc(sizeof(CacheEntry));
+    if (fresh == NULL)
+    {
+        return FAIL;
+    }
+    *fresh = *old;
+    fresh->expiry = expiry;
+    if (!scheduleExpiry(cache, fresh))
+    {
+        free(fresh);
+        return FAIL;
+    }
+    if (old->expiryHandle != NULL)
+    {
+        RBTreeEraseHandle(cache->expiries, old->expiryHandle);
+    }
+    // the copy takes the entry's place in the recency list and in the map
+    if (fresh->newer != NULL)
+    {
+        fresh->newer->older = fresh;
+    }
+    else
+    {
+        cache->newest = fresh;
+    }
+    if (fresh->older != NULL)
+    {
+        fresh->older->newer = fresh;
+    }
+    else
+    {
+        cache->oldest = fresh;
+    }
+    *RBMapValue(fresh->keyHandle) = fresh;
+    free(old);
+    *entry = fresh;
+    return SUCCESS;
+}
+
+void pushNewest(RBCache *cache, CacheEntry *entry)
+{
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest != NULL)
+    {
+        cache->newest->newer = entry;
+    }
+    cache->newest = entry;
+    if (cache->oldest == NULL)
+    {
+        cache->oldest = entry;
+    }
+}
+
+void unlinkEntry(RBCache *cache, CacheEntry *entry)
+{
+    if (entry->newer != NULL)
+    {
+        entry->newer->older = entry->older;
+    }
+    else
+    {
+        cache->newest = entry->older;
+    }
+    if (entry->older != NULL)
+    {
+        entry->older->newer = entry->newer;
+    }
+    else
+    {
+        cache->oldest = entry->newer;
+    }
+    entry->newer = NULL, entry->older = NULL;
+}
+
+void removeEntry(RBCache *cache, CacheEntry *entry, Removal why)
+{
+    switch (why)
+    {
+        case EVICTED:
+            cache->stats.evictions++;
+            break;
+        case EXPIRED:
+            cache->stats.expirations++;
+            break;
+        default:
+            break;
+    }
+    unlinkEntry(cache, entry);
+    RBTreeEraseHandle(cache->keys, entry->keyHandle);
+    if (entry->expiryHandle != NULL)
+    {
+        RBTreeEraseHandle(cache->expiries, entry->expiryHandle);
+    }
+    if (cache->keyFreeFunc != NULL)
+    {
+        cache->keyFreeFunc(entry->key);
+    }
+    if (cache->valueFreeFunc != NULL)
+    {
+        cache->valueFreeFunc(entry->value);
+    }
+    cache->entries--;
+    cache->bytes -= entry->bytes;
+    free(entry);
+}
+
+void evict(RBCache *cache)
+{
+    while (cache->oldest != NULL &&
+           ((cache->maxEntries != 0 && cache->entries > cache->maxEntries) ||
+            (cache->maxBytes != 0 && cache->bytes > cache->maxBytes)))
+    {
+        removeEntry(cache, cache->oldest, EVICTED);
+    }
+}
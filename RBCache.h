@@ -0,0 +1,110 @@
+#ifndef RBTREE_RBCACHE_H
+#define RBTREE_RBCACHE_H
+
+#include "RBTree.h"
+
+/**
+ * an expiry time that never comes.
+ */
+#define RB_CACHE_NO_EXPIRY (-1.0)
+
+/**
+ * the counters of a cache.
+ * hits, misses: the gets that found their key and the ones that didn't.
+ * evictions: the entries removed to keep the cache within its bounds.
+ * expirations: the entries removed by RBCacheExpireBefore.
+ */
+typedef struct RBCacheStats
+{
+	long unsigned hits, misses;
+	long unsigned evictions, expirations;
+} RBCacheStats;
+
+struct CacheEntry;
+
+/**
+ * an in-process cache: a map from the keys to their entries, a list of the entries from the most
+ * to the least recently used, and a tree of the entries that expire ordered by their expiry time.
+ * a get only moves its entry to the front of the list, it never allocates.
+ * keys: the map of the keys to their entries (an RBTree map, so a hash index may be set on it).
+ * expiries: the entries that expire, the first to expire first.
+ * newest, oldest: the ends of the recency list.
+ * maxEntries, maxBytes: the bounds of the cache (0 for no bound), bytes: its size.
+ */
+typedef struct RBCache
+{
+	RBTree *keys;
+	RBTree *expiries;
+	struct CacheEntry *newest, *oldest;
+	FreeFunc keyFreeFunc, valueFreeFunc;
+	size_t maxEntries, maxBytes;
+	size_t entries, bytes;
+	long unsigned sequence;
+	RBCacheStats stats;
+} RBCache;
+
+/**
+ * constructs a new empty cache.
+ * @param keyCompFunc: a function to compare two keys.
+ * @param keyFreeFunc: a function to free a key (may be NULL if the cache doesn't own the keys).
+ * @param valueFreeFunc: a function to free a value (may be NULL if the cache doesn't own them).
+ * @param maxEntries: the most entries the cache keeps, 0 for no bound.
+ * @param maxBytes: the most bytes (as given to RBCachePut) the cache keeps, 0 for no bound.
+ * @return: the new cache, or NULL on failure.
+ */
+RBCache *newRBCache(CompareFunc keyCompFunc, FreeFunc keyFreeFunc, FreeFunc valueFreeFunc,
+					size_t maxEntries, size_t maxBytes);
+
+/**
+ * put a value in the cache as its most recently used entry. if the key is already in the cache its
+ * value, size and expiry are replaced (the old value and the new copy of the key are freed).
+ * then the least recently used entries are evicted until the cache is within its bounds.
+ * @param cache: the cache.
+ * @param key: the key.
+ * @param value: the value (may be NULL).
+ * @param bytes: the size of the entry, counted against maxBytes. an entry larger than maxBytes
+ * could never stay in the cache, so it is rejected.
+ * @param expiry: when the entry expires (in any unit RBCacheExpireBefore is called with, at least
+ * 0), or RB_CACHE_NO_EXPIRY. any other negative time is rejected.
+ * @return: 0 on failure, other on success. on failure the cache is left as it was, and the key and
+ * the value still belong to the caller.
+ */
+int RBCachePut(RBCache *cache, void *key, void *value, size_t bytes, double expiry);
+
+/**
+ * get the value of a key, and make it the most recently used entry. entries that expired are
+ * still found until RBCacheExpireBefore removes them.
+ * @param cache: the cache.
+ * @param key: the key to look for.
+ * @return: the value, or NULL if the key is not in the cache.
+ */
+void *RBCacheGet(RBCache *cache, const void *key);
+
+/**
+ * remove a key and its value from the cache (freeing them).
+ * @param cache: the cache.
+ * @param key: the key to remove.
+ * @return: 0 on failure, other on success. (if the key is not in the cache - failure).
+ */
+int RBCacheRemove(RBCache *cache, const void *key);
+
+/**
+ * remove every entry that expires before a time, in O(k log n) for k such entries.
+ * @param cache: the cache.
+ * @param now: the time.
+ * @return: the number of entries removed.
+ */
+size_t RBCacheExpireBefore(RBCache *cache, double now);
+
+/**
+ * get the counters of a cache.
+ */
+RBCacheStats RBCacheGetStats(const RBCache *cache);
+
+/**
+ * free the cache with all its keys and values.
+ * @param cache: pointer to the cache to free.
+ */
+void freeRBCache(RBCache **cache);
+
+#endif //RBTREE_RBCACHE_H
@@ -0,0 +1,393 @@
+/**
+ * @file RBTopDown.c
+ * @author  Inbal Lavi <inbal.lavi1@mail.huji.ac.il>
+ * @version 1.0
+ * @date 3 June 2020
+ *
+ * @brief Red Black Tree with top-down (single pass) insert and delete
+ *
+ * @section LICENSE
+ * is free and should be used only for good. we do not support the dark side.
+ *
+ * @section DESCRIPTION
+ * a generic RBTree whose nodes have no parent pointer.
+ * insert splits nodes with two red kids on its way down and fixes a red-red pair right away with
+ * the grandparent, so the new leaf can always be made red. delete pushes a red node down in front
+ * of it, so the leaf it removes is always red. neither walks back up, so every node on the path is
+ * visited once. a fake root above the real one saves the special cases of rotating the root.
+ */
+// ------------------------------ includes ------------------------------
+#include <stdlib.h>
+#include "RBTopDown.h"
+
+// -------------------------- const definitions -------------------------
+/**
+ * @brief return value for functions
+ */
+typedef enum FunctionReturn
+{
+    FAIL,
+    SUCCESS
+} FunctionReturn;
+
+/**
+ * @brief boolean values
+ */
+typedef enum bool
+{
+    FALSE,
+    TRUE
+} bool;
+
+/**
+ * @brief indexes of a TDNode's link
+ */
+typedef enum Direction
+{
+    TD_LEFT,
+    TD_RIGHT
+} Direction;
+
+/**
+ * @brief used for empty tree size
+ */
+#define EMPTY 0
+
+/**
+ * @brief checks if functions failed
+ */
+#define CHECK_FAIL \
+if (failOrNah == FAIL) \
+{ \
+    return FAIL; \
+} \
+
+// -------------------------- func declarations -------------------------
+// ------------- general -------------
+/**
+ * @brief checks if a node is red (NULL leaves are black)
+ * @param node - the node to check
+ * @return TRUE or FALSE
+ */
+bool isRedTD(const TDNode *node);
+
+/**
+ * @brief rotates a subtree once toward dir. the old root turns red, the new one black.
+ * @param root - the root of the subtree
+ * @param dir - TD_LEFT or TD_RIGHT
+ * @return the new root of the subtree
+ */
+TDNode *rotateOnceTD(TDNode *root, Direction dir);
+
+/**
+ * @brief rotates a subtree twice: its child opposite to dir away from dir, then the root toward dir
+ * @param root - the root of the subtree
+ * @param dir - TD_LEFT or TD_RIGHT
+ * @return the new root of the subtree
+ */
+TDNode *rotateTwiceTD(TDNode *root, Direction dir);
+
+/**
+ * @brief allocates a red node
+ * @param data - the item of the node
+ * @return pointer to the node or NULL on failure
+ */
+TDNode *newTDNode(void *data);
+
+// ------------- for each -------------
+/**
+ * @brief a function to help preform an action on every node in the tree
+ * @param node - to do the func on (starts from root and calles itself recursively)
+ * @param func - the function to preform
+ * @param args - an argument for the func
+ * @return 0 on failure, other on success
+ */
+int forEachTDHelper(const TDNode *node, forEachFunc func, void *args);
+
+// --------------- free ---------------
+/**
+ * @brief frees all the nodes (and their data) recursively
+ * @param tree - the tree the nodes belong to
+ * @param node - the node to free, starting from the root
+ */
+void freeTDHelper(TDTree *tree, TDNode *node);
+
+// ------------------------------ functions -----------------------------
+// -------------- general --------------
+bool isRedTD(const TDNode *node)
+{
+    return node != NULL && node->color == RED;
+}
+
+TDNode *rotateOnceTD(TDNode *root, Direction dir)
+{
+    TDNode *newRoot = root->link[!dir];
+    root->link[!dir] = newRoot->link[dir];
+    newRoot->link[dir] = root;
+    root->color = RED;
+    newRoot->color = BLACK;
+    return newRoot;
+}
+
+TDNode *rotateTwiceTD(TDNode *root, Direction dir)
+{
+    root->link[!dir] = rotateOnceTD(root->link[!dir], !dir);
+    return rotateOnceTD(root, dir);
+}
+
+// --------------- create ---------------
+TDTree *newTDTree(CompareFunc compFunc, FreeFunc freeFunc)
+{
+    TDTree *tree = (TDTree *) malloc(sizeof(TDTree));
+    if (tree == NULL)
+    {
+        return NULL;
+    }
+    tree->root = NULL;
+    tree->compFunc = compFunc, tree->freeFunc = freeFunc;
+    tree->size = EMPTY;
+    return tree;
+}
+
+TDNode *newTDNode(void *data)
+{
+    TDNode *node = (TDNode *) malloc(sizeof(TDNode));
+    if (node == NULL)
+    {
+        return NULL;
+    }
+    node->link[TD_LEFT] = NULL, node->link[TD_RIGHT] = NULL;
+    node->color = RED;
+    node->data = data;
+    return node;
+}
+
+// --------------- insert ---------------
+int insertToTDTree(TDTree *tree, void *data)
+{
+    if (tree == NULL || data == NULL)
+    {
+        return FAIL;
+    }
+
+    // great-grandparent, grandparent, parent and the current node
+    TDNode head = {{NULL, NULL}, BLACK, NULL};
+    TDNode *t = &head, *g = NULL, *p = NULL, *q = tree->root;
+    head.link[TD_RIGHT] = tree->root;
+    Direction dir = TD_RIGHT, last = TD_RIGHT;
+    FunctionReturn failOrNah = FAIL;
+    bool done = FALSE;
+    while (!done)
+    {
+        if (q == NULL)
+        {
+            q = newTDNode(data);
+            if (q == NULL)
+            {
+                // the splits so far kept the tree valid, only the root may be red now
+                break;
+            }
+            if (p == NULL)
+            {
+                head.link[TD_RIGHT] = q;
+            }
+            else
+            {
+                p->link[dir] = q;
+            }
+            tree->size++;
+            failOrNah = SUCCESS, done = TRUE;
+        }
+        else if (isRedTD(q->link[TD_LEFT]) && isRedTD(q->link[TD_RIGHT]))
+        {
+            q->color = RED;
+            q->link[TD_LEFT]->color = BLACK, q->link[TD_RIGHT]->color = BLACK;
+        }
+
+        // the new red node or the split may have made a red node with a red parent
+        if (isRedTD(q) && isRedTD(p))
+        {
+            Direction side = t->link[TD_RIGHT] == g ? TD_RIGHT : TD_LEFT;
+            t->link[side] = q == p->link[last] ? rotateOnceTD(g, !last) : rotateTwiceTD(g, !last);
+        }
+        if (done)
+        {
+            break;
+        }
+
+        int comparison = tree->compFunc(data, q->data);
+        if (comparison == 0)
+        {
+            break;
+        }
+        last = dir;
+        dir = comparison > 0 ? TD_RIGHT : TD_LEFT;
+        if (g != NULL)
+        {
+            t = g;
+        }
+        g = p, p = q;
+        q = q->link[dir];
+    }
+
+    tree->root = head.link[TD_RIGHT];
+    if (tree->root != NULL)
+    {
+        tree->root->color = BLACK;
+    }
+    return failOrNah;
+}
+
+// --------------- delete ---------------
+int deleteFromTDTree(TDTree *tree, void *data)
+{
+    if (tree == NULL || data == NULL || tree->root == NULL)
+    {
+        return FAIL;
+    }
+
+    // grandparent, parent, the current node and the node holding the item
+    TDNode head = {{NULL, NULL}, BLACK, NULL};
+    TDNode *g = NULL, *p = NULL, *q = &head, *found = NULL;
+    head.link[TD_RIGHT] = tree->root;
+    Direction dir = TD_RIGHT;
+    while (q->link[dir] != NULL)
+    {
+        Direction last = dir;
+        g = p, p = q;
+        q = q->link[dir];
+        int comparison = tree->compFunc(data, q->data);
+        // once the item is found keep going to its predecessor, the leaf that will be removed
+        dir = comparison > 0 ? TD_RIGHT : TD_LEFT;
+        if (comparison == 0)
+        {
+            found = q;
+        }
+
+        // make sure the next node down will be red or have a red parent
+        if (isRedTD(q) || isRedTD(q->link[dir]))
+        {
+            continue;
+        }
+        if (isRedTD(q->link[!dir]))
+        {
+            p->link[last] = rotateOnceTD(q, dir);
+            p = p->link[last];
+            continue;
+        }
+        TDNode *s = p->link[!last];
+        if (s == NULL)
+        {
+            continue;
+        }
+        if (!isRedTD(s->link[TD_LEFT]) && !isRedTD(s->link[TD_RIGHT]))
+        {
+            p->color = BLACK, s->color = RED, q->color = RED;
+        }
+        else
+        {
+            Direction side = g->link[TD_RIGHT] == p ? TD_RIGHT : TD_LEFT;
+            g->link[side] = isRedTD(s->link[last]) ? rotateTwiceTD(p, last) : rotateOnceTD(p, last);
+            q->color = RED, g->link[side]->color = RED;
+            g->link[side]->link[TD_LEFT]->color = BLACK;
+            g->link[side]->link[TD_RIGHT]->color = BLACK;
+        }
+    }
+
+    FunctionReturn failOrNah = FAIL;
+    if (found != NULL)
+    {
+        // q is found's predecessor (or found itself), a red leaf or a red node with one red child
+        if (tree->freeFunc != NULL)
+        {
+            tree->freeFunc(found->data);
+        }
+        found->data = q->data;
+        p->link[p->link[TD_RIGHT] == q] = q->link[q->link[TD_LEFT] == NULL];
+        free(q);
+        tree->size--;
+        failOrNah = SUCCESS;
+    }
+
+    tree->root = head.link[TD_RIGHT];
+    if (tree->root != NULL)
+    {
+        tree->root->color = BLACK;
+    }
+    return failOrNah;
+}
+
+// --------------- search ---------------
+int TDTreeContains(const TDTree *tree, const void *data)
+{
+    if (data == NULL || tree == NULL)
+    {
+        return FALSE;
+    }
+    const TDNode *node = tree->root;
+    while (node != NULL)
+    {
+        int comparison = tree->compFunc(data, node->data);
+        if (comparison == 0)
+        {
+            return TRUE;
+        }
+        node = node->link[comparison > 0 ? TD_RIGHT : TD_LEFT];
+    }
+    return FALSE;
+}
+
+// ------------- tree func -------------
+int forEachTDTree(const TDTree *tree, forEachFunc func, void *args)
+{
+    if (tree == NULL)
+    {
+        return FAIL;
+    }
+    FunctionReturn failOrNah = forEachTDHelper(tree->root, func, args);
+    CHECK_FAIL
+    return SUCCESS;
+}
+
+int forEachTDHelper(const TDNode *node, forEachFunc func, void *args)
+{
+    if (node == NULL)
+    {
+        return SUCCESS;
+    }
+    FunctionReturn failOrNah;
+    failOrNah = forEachTDHelper(node->link[TD_LEFT], func, args);
+    CHECK_FAIL
+    failOrNah = func(node->data, args);
+    CHECK_FAIL
+    failOrNah = forEachTDHelper(node->link[TD_RIGHT], func, args);
+    CHECK_FAIL
+    return SUCCESS;
+}
+
+// ---------------- free ----------------
+void freeTDTree(TDTree **tree)
+{
+    if (tree == NULL || *tree == NULL)
+    {
+        return;
+    }
+    freeTDHelper(*tree, (*tree)->root);
+    free(*tree);
+    *tree = NULL;
+}
+
+void freeTDHelper(TDTree *tree, TDNode *node)
+{
+    if (node == NULL)
+    {
+        return;
+    }
+    freeTDHelper(tree, node->link[TD_LEFT]);
+    freeTDHelper(tree, node->link[TD_RIGHT]);
+    if (tree->freeFunc != NULL)
+    {
+        tree->freeFunc(node->data);
+    }
+    free(node);
+}
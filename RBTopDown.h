@@ -0,0 +1,76 @@
+#ifndef RBTREE_RBTOPDOWN_H
+#define RBTREE_RBTOPDOWN_H
+
+#include "RBTree.h"
+
+/**
+ * a node of a top-down tree. it has no parent pointer, so it is 8 bytes smaller than a Node.
+ * link[0] is the left child, link[1] the right one.
+ */
+typedef struct TDNode
+{
+	struct TDNode *link[2];
+	Color color;
+	void *data;
+} TDNode;
+
+/**
+ * a red black tree that is rebalanced top-down: insert and delete fix the colors on the way down
+ * to the item, in a single pass, and never walk back up. it keeps the same items in the same
+ * order as an RBTree with the same CompareFunc, but it has no handles, multisets or maps.
+ */
+typedef struct TDTree
+{
+	TDNode *root;
+	CompareFunc compFunc;
+	FreeFunc freeFunc;
+	long unsigned size;
+} TDTree;
+
+/**
+ * constructs a new top-down tree with the given CompareFunc.
+ * comp: a function two compare two variables.
+ */
+TDTree *newTDTree(CompareFunc compFunc, FreeFunc freeFunc);
+
+/**
+ * add an item to the tree
+ * @param tree: the tree to add an item to.
+ * @param data: item to add to the tree.
+ * @return: 0 on failure, other on success. (if the item is already in the tree - failure).
+ */
+int insertToTDTree(TDTree *tree, void *data);
+
+/**
+ * remove an item from the tree
+ * @param tree: the tree to remove an item from.
+ * @param data: item to remove from the tree.
+ * @return: 0 on failure, other on success. (if data is not in the tree - failure).
+ */
+int deleteFromTDTree(TDTree *tree, void *data);
+
+/**
+ * check whether the tree contains this item.
+ * @param tree: the tree to search.
+ * @param data: item to check.
+ * @return: 0 if the item is not in the tree, other if it is.
+ */
+int TDTreeContains(const TDTree *tree, const void *data);
+
+/**
+ * Activate a function on each item of the tree. the order is an ascending order. if one of the activations of the
+ * function returns 0, the process stops.
+ * @param tree: the tree with all the items.
+ * @param func: the function to activate on all items.
+ * @param args: more optional arguments to the function (may be null if the given function support it).
+ * @return: 0 on failure, other on success.
+ */
+int forEachTDTree(const TDTree *tree, forEachFunc func, void *args);
+
+/**
+ * free all memory of the data structure.
+ * @param tree: pointer to the tree to free.
+ */
+void freeTDTree(TDTree **tree);
+
+#endif //RBTREE_RBTOPDOWN_H
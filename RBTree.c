@@ -16,6 +16,14 @@
  */
 // ------------------------------ includes ------------------------------
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#ifdef RBTREE_THREADS
+#include <pthread.h>
+#endif
 #include "Structs.h"
 #include "RBTree.h"
 
@@ -58,11 +66,223 @@ enum Kids
     TWO_KIDS
 };
 
+/**
+ * @brief a node of a map, the key is kept in node.data
+ */
+typedef struct MapNode
+{
+    Node node;
+    void *value;
+} MapNode;
+
+/**
+ * @brief an extra occurrence of an item in a chained multiset
+ */
+typedef struct Occurrence
+{
+    void *data;
+    struct Occurrence *next;
+} Occurrence;
+
+/**
+ * @brief a node of a multiset, count includes node.data
+ */
+typedef struct MultisetNode
+{
+    Node node;
+    long unsigned count;
+    Occurrence *chain;
+} MultisetNode;
+
+/**
+ * @brief a node of a string set. a short key is kept in copy.key and node.data points at it, a
+ * long one is in copy.block
+ */
+typedef struct StringNode
+{
+    Node node;
+    union
+    {
+        char key[RB_INLINE_STRING];
+        struct StringBlock *block;
+    } copy;
+} StringNode;
+
+/**
+ * @brief a block the long keys of a string set are appended to
+ * keys: the number of keys in the block that are still in the set. the block is freed when the
+ * last of them is deleted (the first block of the list is emptied instead, to take the next keys).
+ */
+typedef struct StringBlock
+{
+    struct StringBlock *next, *prev;
+    size_t used, capacity;
+    size_t keys;
+    char bytes[];
+} StringBlock;
+
+/**
+ * @brief the size of a string block, unless a single key needs a bigger one
+ */
+#define STRING_BLOCK_SIZE (16 * 1024)
+
+/**
+ * @brief a node of an interval tree, maxHigh is the highest endpoint in its subtree
+ */
+typedef struct IntervalNode
+{
+    Node node;
+    double maxHigh;
+} IntervalNode;
+
+/**
+ * @brief a slot of a hash index: a node and its item's hash (node is NULL in an empty slot)
+ */
+typedef struct HashSlot
+{
+    size_t hash;
+    Node *node;
+} HashSlot;
+
+/**
+ * @brief a hash index: a linear probing table of 2^bits slots, at most half of them used
+ */
+typedef struct HashIndex
+{
+    HashFunc hashFunc;
+    HashSlot *slots;
+    size_t capacity, used;
+    int bits;
+} HashIndex;
+
+/**
+ * @brief the number of slots of a new hash index
+ */
+#define HASH_INDEX_BITS 4
+
+/**
+ * @brief a blocked bloom filter: every item sets and checks hashes bits in a single 64 byte block
+ * (bits points into memory, aligned to a cache line). it is sized for capacity items, and stale
+ * counts the items deleted since it was built.
+ */
+typedef struct BloomFilter
+{
+    HashFunc hashFunc;
+    void *memory;
+    uint64_t *bits;
+    size_t blocks;
+    int bitsPerItem, hashes;
+    long unsigned capacity, stale;
+    long unsigned checks, rejected, falsePositives;
+} BloomFilter;
+
+/**
+ * @brief the bytes and 64 bit words of a bloom filter block, the default bits per item, and the
+ * fewest items a filter is sized for
+ */
+#define BLOOM_BLOCK_BYTES 64
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BITS_PER_ITEM 10
+#define BLOOM_MIN_ITEMS 1024
+
+/**
+ * @brief the write buffer of a tree: the nodes of the items inserted but not merged into the tree
+ * yet, in the order they came. they are allocated as the items come, so a merge never fails and a
+ * handle to a buffered item stays valid once it is merged. no buffered item equals another one or
+ * one in the tree. with a hashFunc, slots is a linear probing table of 2^bits indexes of nodes (+1,
+ * 0 is an empty slot) that finds a buffered item without a scan.
+ * scratch: room for sorting the nodes.
+ */
+typedef struct WriteBuffer
+{
+    Node **nodes, **scratch;
+    size_t count, capacity;
+    HashFunc hashFunc;
+    size_t *slots;
+    int bits;
+} WriteBuffer;
+
+/**
+ * @brief the state of a tree read optimistically (see RBTreeSetOptimisticReads)
+ * version: odd while the writer changes the tree, bumped again when it is done.
+ * deleted, released: the nodes removed from the tree and not freed yet (with their items, and
+ * without them), linked through their parent pointers, which readers never follow.
+ */
+typedef struct Seqlock
+{
+    long unsigned version;
+    Node *deleted, *released;
+} Seqlock;
+
+/**
+ * @brief a subtree to copy into a clone
+ * source: the subtree (NULL for none), parent: the copy of its parent, link: where its copy goes.
+ * next: the room in the clone's node block for its nodes (which are counted in nodes).
+ * allocations: the occurrences it allocated, added to the clone's counters after the copy.
+ */
+typedef struct CloneTask
+{
+    const RBTree *tree;
+    RBTree *clone;
+    CopyFunc copyFunc;
+    const Node *source;
+    Node *parent, **link;
+    char *next;
+    size_t nodes, allocations;
+    bool failed;
+} CloneTask;
+
+#ifdef RBTREE_THREADS
+/**
+ * @brief the clone tasks of a thread: first, first + step, ... below count
+ * copy: FALSE to count the nodes of the tasks, TRUE to copy them. started: if it has a thread.
+ */
+typedef struct CloneRange
+{
+    CloneTask *tasks;
+    size_t first, count, step;
+    bool copy, started;
+} CloneRange;
+#endif
+
+/**
+ * @brief checks if a tree is a multiset
+ */
+#define IS_MULTISET(tree) ((tree)->kind == RB_MULTISET_COUNTED || (tree)->kind == RB_MULTISET_CHAINED)
+
 /**
  * @brief used for empty tree size
  */
 #define EMPTY 0
 
+/**
+ * @brief the number of lookups a batch walks down the tree side by side. enough misses to keep
+ * the memory system busy, few enough cursors to stay in registers and L1.
+ */
+#define BATCH_GROUP 16
+
+/**
+ * @brief the longest walk an optimistic read takes before it checks the version: more steps than
+ * any balanced tree is high, so only a walk that raced with a rotation can reach it
+ */
+#define OPTIMISTIC_MAX_DEPTH 128
+
+/**
+ * @brief a parallel clone splits the top of the tree down to the smallest depth with at least
+ * CLONE_TASKS_PER_THREAD subtrees per thread, but never deeper than MAX_CLONE_SPLIT_DEPTH
+ */
+#define CLONE_TASKS_PER_THREAD 4
+#define MAX_CLONE_SPLIT_DEPTH 12
+
+/**
+ * @brief asks the CPU to start loading a node that will be read soon
+ */
+#if defined(__GNUC__)
+#define PREFETCH(address) __builtin_prefetch(address)
+#else
+#define PREFETCH(address) ((void) (address))
+#endif
+
 /**
  * @brief checks if functions failed
  */
@@ -73,6 +293,33 @@ if (failOrNah == FAIL) \
 } \
 
 
+/**
+ * @brief operation counters, compiled out unless RBTREE_STATS is defined
+ */
+#ifdef RBTREE_STATS
+#define STAT_ADD(tree, field, n) ((tree)->stats->field += (n))
+#define COMPARE(tree, a, b) (STAT_ADD(tree, comparisons, 1), (tree)->compFunc(a, b))
+#define DESCENT_BEGIN long unsigned depth = 0
+#define DESCENT_STEP depth++
+#define DESCENT_END(tree) recordDescent((tree)->stats, depth)
+#define BLOOM_COUNT(bloom, field) ((bloom)->field++)
+#else
+#define STAT_ADD(tree, field, n) ((void) (tree))
+#define COMPARE(tree, a, b) ((tree)->compFunc(a, b))
+#define DESCENT_BEGIN
+#define DESCENT_STEP
+#define DESCENT_END(tree)
+#define BLOOM_COUNT(bloom, field) ((void) (bloom))
+#endif
+
+/**
+ * @brief stores a link of the tree. with optimistic reads on, readers walk the links while they
+ * change, so a link is stored whole, and only after the node it points to is ready
+ */
+#define SET_LINK(tree, link, node) \
+((tree)->seqlock != NULL ? __atomic_store_n(&(link), (node), __ATOMIC_RELEASE) \
+                         : (void) ((link) = (node)))
+
 // -------------------------- func declarations -------------------------
 // ------------- general -------------
 /**
@@ -110,14 +357,85 @@ void turnLeft(RBTree *tree, Node *node);
  */
 void turnRight(RBTree *tree, Node *node);
 
+/**
+ * @brief rotates the tree for a node, moving the node down to the given side
+ * @param tree - pointer to the tree (to change the root if necessary)
+ * @param node - pointer to the node to rotate on
+ * @param side - LEFT to turn left, RIGHT to turn right
+ */
+void turnToward(RBTree *tree, Node *node, LeftOrRightChild side);
+
+#ifdef RBTREE_STATS
+/**
+ * @brief records the depth of a single root-to-node descent
+ * @param stats - the counters of the tree that was searched
+ * @param depth - the number of nodes visited on the way down
+ */
+void recordDescent(RBTreeStats *stats, long unsigned depth);
+#endif
+
+// -------------- create --------------
+/**
+ * @brief allocates a new red node of the tree's node size
+ * @param tree - the tree the node is for
+ * @param data - the node's item
+ * @return pointer to the new node or NULL on failure
+ */
+Node *newNode(RBTree *tree, void *data);
+
+// ------------- augment -------------
+/**
+ * @brief updates the subtree information of a node and all its ancestors (if the tree is augmented)
+ * @param tree - the tree
+ * @param node - the lowest node whose subtree changed (may be NULL)
+ */
+void augmentPath(RBTree *tree, Node *node);
+
 // -------------- insert --------------
 /**
- * @brief inserts a Node to a tree in a regular BST way
- * @param tree - pointer to the tree
- * @param newNode - pointer to Node to insert
- * @return: 0 on failure, other on success. (if the item is already in the tree - failure).
+ * @brief walks down the tree to where an item is or should be (from the finger, if there is one).
+ * the finger is not moved, so lookups stay read-only
+ * @param tree - the tree to search
+ * @param data - the item to look for
+ * @param side - set to ROOT if the returned node holds the item, otherwise to the side of the
+ * returned node the item should be attached at
+ * @return the node holding the item or its would-be parent (NULL if the tree is empty)
+ */
+Node *locate(const RBTree *tree, const void *data, LeftOrRightChild *side);
+
+/**
+ * @brief locate for the operations that change the tree: with finger search on, the finger is
+ * moved to the node found
+ */
+Node *locateToWrite(RBTree *tree, const void *data, LeftOrRightChild *side);
+
+/**
+ * @brief climbs up from the finger to the lowest node whose subtree must contain the item (or
+ * where it should be). that is usually O(log d) steps for an item d nodes away from the finger,
+ * but up to the root when a node high in the tree separates them.
+ * @param tree - the tree to search, with a finger
+ * @param data - the item to look for
+ * @return the node to start walking down from
  */
-int insertRegular(RBTree *tree, Node *newNode);
+Node *climbFromFinger(const RBTree *tree, const void *data);
+
+/**
+ * @brief links a new node into the tree and rebalances it (the whole insert of a located item)
+ * @param tree - the tree to link into
+ * @param node - the new node
+ * @param parent - its parent (NULL if the tree is empty)
+ * @param side - which child of parent the node is
+ */
+void linkNode(RBTree *tree, Node *node, Node *parent, LeftOrRightChild side);
+
+/**
+ * @brief links a new node into the tree as a leaf (without fixing the colors)
+ * @param tree - the tree to link into
+ * @param node - the new node
+ * @param parent - its parent (NULL if the tree is empty)
+ * @param side - which child of parent the node is
+ */
+void attach(RBTree *tree, Node *node, Node *parent, LeftOrRightChild side);
 
 /**
  * @brief RBTree fixing algorithm after insert
@@ -128,9 +446,10 @@ void fixingAlg(RBTree *tree, Node *node);
 
 /**
  * @brief if the new node has red dad and red uncle fixing function
+ * @param tree - tree to fix
  * @param new - node to fix
  */
-void redDadRedUncle(Node *new);
+void redDadRedUncle(RBTree *tree, Node *new);
 
 /**
  * @brief if the new node has red dad and red uncle fixing function
@@ -146,7 +465,7 @@ void redDadBlackUncle(RBTree *tree, Node *new);
  * @param data - item to be deleted
  * @return - pointer to the node to be deleted or NULL if not in tree
  */
-Node *findNode(RBTree *tree, const void *data);
+Node *findNode(const RBTree *tree, const void *data);
 
 /**
  * @brief finds a node successor
@@ -156,16 +475,41 @@ Node *findNode(RBTree *tree, const void *data);
 Node *successor(const Node *node);
 
 /**
- * @brief swaps two nodes' data
- * @param a @param b two nodes
+ * @brief finds the next node in ascending order, even if the node has no right child
+ * @param node - to find the next node for
+ * @return pointer to the next node or NULL if node is the largest
  */
-void swapData(Node *a, Node *b);
+Node *nextNode(const Node *node);
+
+/**
+ * @brief finds the previous node in ascending order
+ * @param node - to find the previous node for
+ * @return pointer to the previous node or NULL if node is the smallest
+ */
+Node *prevNode(const Node *node);
+
+/**
+ * @brief removes a node from the tree and fixes the tree, without freeing the node. other nodes
+ * are relinked, never their data swapped, so handles to them stay valid.
+ * @param tree - tree to remove from
+ * @param M - the node to remove
+ */
+void unlinkNode(RBTree *tree, Node *M);
+
+/**
+ * @brief swaps the places (and colors) of a node with two kids and its successor in the tree
+ * @param tree - the tree the nodes belong to
+ * @param M - a node with two kids
+ * @param MSuccessor - its successor
+ */
+void swapWithSuccessor(RBTree *tree, Node *M, Node *MSuccessor);
 
 /**
  * @brief swaps two nodes' color
+ * @param tree - the tree the nodes belong to
  * @param a @param b two nodes
  */
-void swapColor(Node *a, Node *b);
+void swapColor(RBTree *tree, Node *a, Node *b);
 
 /**
  * @brief checks how many kids a node hase
@@ -184,7 +528,7 @@ Node *setC(Node *M);
 /**
  * @brief put the node @C instead of node @M in the tree
  */
-void putCInM(Node *C, Node *M);
+void putCInM(RBTree *tree, Node *C, Node *M);
 
 /**
  * @brief check if a node has two black kids (TRUE also if a node's a leaf)
@@ -204,7 +548,7 @@ bool redScBlackSf(const Node *S, LeftOrRightChild side);
 /**
  * @brief if M's black and its child is black fixing algorithm
  * @param tree - the tree to fix
- * @param M - the node to delete
+ * @param M - the node to remove (it is unlinked, not freed)
  */
 void blackMAndC(RBTree *tree, Node *M);
 
@@ -231,692 +575,3330 @@ void blackSRedSf(RBTree *tree, Node *S);
 
 /**
  * @brief deletes (frees) a node and its data
+ * @param tree - the tree the node belongs to (its freeFunc frees the data)
  * @param M - the node to delete
- * @param func - freeing data func
  */
-void deleteNode(Node **M, FreeFunc func);
+void deleteNode(RBTree *tree, Node **M);
 
-// ------------- for each -------------
 /**
- * @brief a function to help preform an action on every node in the tree
+ * @brief frees a node without its data (but with what the node owns besides it: a map value, the
+ * other occurrences of a chained multiset or the long key of a string set)
+ * @param tree - the tree the node belongs to
+ * @param M - the node to free
+ */
+void releaseNode(RBTree *tree, Node **M);
+
+// --------------- wavl ---------------
+/**
+ * @brief the rank of a node in a WAVL tree
+ * @param node - the node (may be NULL)
+ * @return its rank, -1 for NULL
+ */
+int rankOf(const Node *node);
+
+/**
+ * @brief WAVL fixing algorithm after insert: promotes up while a node has a child of the same
+ * rank and a sibling one rank below, then does at most two rotations
+ * @param tree - pointer to the tree
+ * @param node - new node (rank 0) to be fixed (if needed)
+ */
+void wavlInsertFix(RBTree *tree, Node *node);
+
+/**
+ * @brief removes a node with at most one child from a WAVL tree and fixes the ranks
+ * @param tree - the tree to fix
+ * @param M - the node to remove
+ * @param C - its only child or NULL
+ */
+void wavlRemove(RBTree *tree, Node *M, Node *C);
+
+/**
+ * @brief WAVL fixing algorithm after delete: demotes up while a node is 3 ranks above a child,
+ * then does at most two rotations
+ * @param tree - the tree to fix
+ * @param P - the parent of the removed node
+ * @param side - the side of P the node was removed from
+ */
+void wavlDeleteFix(RBTree *tree, Node *P, LeftOrRightChild side);
+
+// ------------- multiset -------------
+/**
+ * @brief adds an occurrence of an item that is already in the tree
+ * @param tree - the tree
+ * @param node - the node holding the item
+ * @param data - the new occurrence
+ * @return: 0 on failure, other on success. (if the tree is not a multiset - failure).
+ */
+int addOccurrence(RBTree *tree, Node *node, void *data);
+
+/**
+ * @brief removes a single occurrence of a node's item, if it has more than one
+ * @param tree - the tree
+ * @param node - the node holding the item
+ * @return TRUE if an occurrence was removed, FALSE if the node itself should be deleted
+ */
+bool removeOccurrence(RBTree *tree, Node *node);
+
+/**
+ * @brief a function to help preform an action on every occurrence of every item in the tree
+ * @param tree - the tree the nodes belong to
  * @param node - to do the func on (starts from root and calles itself recursively)
  * @param func - the function to preform
  * @param args - an argument for the func
  * @return 0 on failure, other on success
  */
-int forEachHelper(const Node *node, forEachFunc func, void *args);
+int forEachOccurrenceHelper(const RBTree *tree, const Node *node, forEachFunc func, void *args);
 
-// --------------- free ---------------
+// --------------- map ---------------
 /**
- * @brief frees all the nodes (and their data) recursively
- * @param node - the node to free, starting from the root
- * @param func - function to free the data
+ * @brief replaces the value of a map node, freeing the old value
+ * @param map - the map the node belongs to
+ * @param node - the node to update
+ * @param value - the new value
  */
-void freeHelper(Node **node, FreeFunc func);
+void setValue(RBTree *map, MapNode *node, void *value);
 
-// ------------------------------ functions -----------------------------
-// -------------- general --------------
-int whereToGo(const int num)
-{
-    if (num < 0)
-    {
-        return LEFT;
-    }
-    if (num > 0)
-    {
-        return RIGHT;
-    }
-    return ROOT;
-}
+// ------------ string set ------------
+/**
+ * @brief compares two C strings
+ */
+int compareStrings(const void *a, const void *b);
 
-int isRightLeftChildOrRoot(const Node *node)
-{
-    Node *p = node->parent;
-    if (p == NULL)
-    {
-        return ROOT;
-    }
-    if (node == p->left)
-    {
-        return LEFT;
-    }
-    return RIGHT;
-}
+/**
+ * @brief stores a string set node's copy of its key: in the node if it is short, in the set's
+ * blocks if not
+ * @param set - the string set
+ * @param node - the new node
+ * @param key - the key to copy
+ * @return the copy, or NULL on failure
+ */
+char *storeString(RBTree *set, StringNode *node, const char *key);
 
-void turnLeft(RBTree *tree, Node *node)
-{
-    Node *x = node;
-    Node *y = x->right;
-    Node *p = x->parent;
+/**
+ * @brief drops a string set node's long key from its block, freeing the block if it was the last
+ * @param set - the string set
+ * @param node - the node being freed
+ */
+void releaseString(RBTree *set, StringNode *node);
 
-    LeftOrRightChild side = isRightLeftChildOrRoot(x);
+/**
+ * @brief frees the blocks of a string set
+ * @param set - the string set
+ */
+void freeStringBlocks(RBTree *set);
 
-    x->parent = y;
-    x->right = y->left;
-    if (y->left != NULL)
-    {
-        y->left->parent = x;
-    }
-    y->left = x;
-    y->parent = p;
+// ------------- interval -------------
+/**
+ * @brief the default CompareFunc of an interval tree: by low and then by high endpoint
+ */
+int compareIntervals(const void *a, const void *b);
 
-    switch (side)
-    {
-        case LEFT:
-            p->left = y;
-            break;
-        case RIGHT:
-            p->right = y;
-            break;
-        default:
-            tree->root = y;
-            break;
-    }
-}
+/**
+ * @brief the AugmentFunc of an interval tree: the highest of the node's own high endpoint and its
+ * children's maxHigh
+ * @param node - an IntervalNode
+ */
+void updateMaxHigh(Node *node);
 
-void turnRight(RBTree *tree, Node *node)
-{
-    Node *x = node;
-    Node *y = x->left;
-    Node *p = x->parent;
+/**
+ * @brief checks if two closed intervals overlap
+ */
+bool intervalsOverlap(const RBInterval *interval, double low, double high);
 
-    LeftOrRightChild side = isRightLeftChildOrRoot(x);
+/**
+ * @brief activates a function on the intervals of a subtree that overlap [low, high], in order
+ * @param node - the root of the subtree
+ * @param low, high - the interval to check
+ * @param func - the function to activate
+ * @param args - an argument for the func
+ * @return 0 on failure, other on success
+ */
+int forEachOverlappingHelper(const Node *node, double low, double high, forEachFunc func,
+                             void *args);
 
-    x->parent = y;
-    x->left = y->right;
-    if (y->right != NULL)
-    {
-        y->right->parent = x;
-    }
-    y->right = x;
-    y->parent = p;
+// ------------ hash index ------------
+/**
+ * @brief allocates an empty hash index
+ * @param hashFunc - hashes the items
+ * @param bits - the log2 of the number of slots
+ * @return the index, or NULL on failure
+ */
+HashIndex *newHashIndex(HashFunc hashFunc, int bits);
 
-    switch (side)
-    {
-        case LEFT:
-            p->left = y;
-            break;
-        case RIGHT:
-            p->right = y;
-            break;
-        default:
-            tree->root = y;
-            break;
-    }
-}
+/**
+ * @brief frees a hash index (not its nodes)
+ * @param index - pointer to the index
+ */
+void freeHashIndex(HashIndex **index);
 
-Node *setBrother(Node *node)
-{
-    if (node == node->parent->left)
-    {
-        return node->parent->right;
-    }
-    return node->parent->left;
-}
+/**
+ * @brief the slot a hash is looked for at first: fibonacci hashing spreads even weak hashes (like
+ * the value of an int) over the table
+ */
+size_t homeSlot(const HashIndex *index, size_t hash);
 
-// --------------- create ---------------
+/**
+ * @brief adds a node to a hash index, doubling the table first if it would be more than half full
+ * @param index - the index
+ * @param node - the node
+ * @return 0 on failure, other on success
+ */
+int hashInsert(HashIndex *index, Node *node);
+
+/**
+ * @brief puts a node in the first free slot from its home slot on (there must be one)
+ */
+void hashPlace(HashIndex *index, size_t hash, Node *node);
+
+/**
+ * @brief removes a node from a hash index, shifting the slots after it back so no probe sequence
+ * is broken (no tombstones are left)
+ * @param index - the index
+ * @param node - a node in the index
+ */
+void hashRemove(HashIndex *index, const Node *node);
+
+/**
+ * @brief finds the node holding an item through the hash index
+ * @param tree - a tree with a hash index
+ * @param data - the item
+ * @return the node, or NULL if the item is not in the tree
+ */
+Node *hashFind(const RBTree *tree, const void *data);
+
+// ------------ bloom filter ------------
+/**
+ * @brief (re)builds the bloom filter of a tree from its items, for at least capacity items
+ * @param tree - a tree with a bloom filter
+ * @param capacity - the number of items to size the filter for
+ * @return 0 on failure (the old filter is kept), other on success
+ */
+int buildBloomFilter(RBTree *tree, long unsigned capacity);
+
+/**
+ * @brief frees a bloom filter
+ * @param bloom - pointer to the filter
+ */
+void freeBloomFilter(BloomFilter **bloom);
+
+/**
+ * @brief the block of an item and the bits it sets in it
+ * @param bloom - the filter
+ * @param data - the item
+ * @param mask - filled with the item's bits in every word of the block
+ * @return the block
+ */
+uint64_t *bloomBits(const BloomFilter *bloom, const void *data, uint64_t *mask);
+
+/**
+ * @brief adds a new node's item to the bloom filter of a tree, growing the filter if the tree
+ * outgrew it
+ */
+void bloomAdd(RBTree *tree, const Node *node);
+
+/**
+ * @brief counts a removed item in the bloom filter of a tree, and rebuilds the filter when too
+ * many of its items are stale
+ */
+void bloomRemoved(RBTree *tree);
+
+/**
+ * @brief asks the bloom filter of a tree (if it has one) about an item
+ * @return TRUE if the item is surely not in the tree
+ */
+bool bloomRejects(const RBTree *tree, const void *data);
+
+/**
+ * @brief counts a lookup the bloom filter let through that found nothing
+ */
+void bloomMissed(const RBTree *tree);
+
+// ------------ write buffer ------------
+/**
+ * @brief finds the node of a buffered item, through the buffer's hash table or by a scan of it
+ * @param tree - the tree (with or without a write buffer)
+ * @param data - the item to look for
+ * @return the node of the buffered item, or NULL if it is not in the buffer
+ */
+Node *findBuffered(const RBTree *tree, const void *data);
+
+/**
+ * @brief the slot of an item in the buffer's hash table, like homeSlot
+ */
+size_t bufferSlot(const WriteBuffer *buffer, const void *data);
+
+/**
+ * @brief adds the index of a buffered node to the buffer's hash table
+ */
+void hashBuffered(WriteBuffer *buffer, size_t index);
+
+/**
+ * @brief sorts the buffered nodes, then links them in order, every search starting from the
+ * previous item's node
+ * @param tree - a tree with a write buffer
+ */
+void flushWriteBuffer(RBTree *tree);
+
+/**
+ * @brief merges the write buffer of a tree, if it holds items, before an operation that changes
+ * the tree
+ * @param tree - the tree (may be NULL)
+ */
+void settle(RBTree *tree);
+
+/**
+ * @brief sorts nodes by their items with the tree's CompareFunc (a stable bottom-up merge sort)
+ * @param tree - the tree
+ * @param nodes - the nodes
+ * @param scratch - room for as many nodes
+ * @param n - the number of nodes
+ */
+void sortNodes(const RBTree *tree, Node **nodes, Node **scratch, size_t n);
+
+/**
+ * @brief frees the write buffer of a tree with the items still in it, without merging them
+ */
+void freeWriteBuffer(RBTree *tree);
+
+// ---------- optimistic reads ----------
+/**
+ * @brief marks the start of a change to the tree for optimistic readers (nothing without them)
+ */
+void beginWrite(RBTree *tree);
+
+/**
+ * @brief marks the end of a change to the tree for optimistic readers (nothing without them)
+ */
+void endWrite(RBTree *tree);
+
+/**
+ * @brief finds the node holding an item without writing to the tree or its nodes, retrying
+ * whenever the writer changed the tree during the walk
+ * @param tree - a tree read optimistically
+ * @param data - the item
+ * @return the node, or NULL if the item is not in the tree
+ */
+Node *optimisticFind(const RBTree *tree, const void *data);
+
+/**
+ * @brief puts a removed node on a list of the nodes to free on the next RBTreeReclaim
+ * @param list - the list
+ * @param node - the node, out of the tree
+ */
+void retire(Node **list, Node *node);
+
+// --------------- clone ---------------
+/**
+ * @brief copies a tree into a new one whose nodes share a single allocation: in pre-order with a
+ * single thread, and with more the top levels level by level, then every subtree below them in
+ * pre-order
+ * @param tree - the tree to copy
+ * @param copyFunc - copies the items (may be NULL to share them)
+ * @param threads - the number of threads to copy with (1 without RBTREE_THREADS)
+ * @return the clone, or NULL on failure
+ */
+RBTree *cloneTree(const RBTree *tree, CopyFunc copyFunc, int threads);
+
+/**
+ * @brief copies a node into the next room of a task and links the copy in its place
+ * @param task - the task
+ * @param source - the node to copy
+ * @param parent - the copy of its parent
+ * @param link - where to link the copy
+ * @return the copy, or NULL on failure (the copy is linked if only its occurrences failed)
+ */
+Node *cloneNode(CloneTask *task, const Node *source, Node *parent, Node **link);
+
+/**
+ * @brief copies a subtree, its nodes in pre-order one after the other. with copied items, the
+ * nodes of an augmented tree are updated once their children are copied
+ * @return 0 on failure (what was copied is linked, so freeing the clone frees it), other on success
+ */
+int cloneSubtree(CloneTask *task, const Node *source, Node *parent, Node **link);
+
+/**
+ * @brief copies the top depth levels of a tree into the start of the clone's block, and splits
+ * what is below them into tasks, in ascending order
+ * @param tasks - room for 2^depth tasks, tasks[0] is the task of the whole tree
+ * @param depth - the number of levels to copy
+ * @param topNodes - set to the number of nodes copied
+ * @return the number of tasks, or 0 on failure
+ */
+size_t splitClone(CloneTask *tasks, int depth, size_t *topNodes);
+
+/**
+ * @brief updates the nodes of the top levels of an augmented clone, bottom-up, once the subtrees
+ * below them are copied and updated
+ * @param clone - the clone
+ * @param node - the root of the levels
+ * @param levels - the number of levels to update
+ */
+void augmentTop(const RBTree *clone, Node *node, int levels);
+
+/**
+ * @brief counts the nodes of a subtree
+ */
+size_t countNodes(const Node *node);
+
+/**
+ * @brief counts the nodes of a clone task, or copies them
+ */
+void runCloneTask(CloneTask *task, bool copy);
+
+#ifdef RBTREE_THREADS
+/**
+ * @brief the thread function of a parallel clone: runs a CloneRange
+ */
+void *runCloneRange(void *args);
+
+/**
+ * @brief runs the clone tasks split between threads (as CloneRanges)
+ * @return FALSE if it could not run them, TRUE if it did (even if some failed)
+ */
+bool runCloneThreads(CloneTask *tasks, size_t count, int threads, bool copy);
+#endif
+
+/**
+ * @brief runs the count or the copy of the clone tasks with several threads
+ * @param tasks - the tasks
+ * @param count - the number of tasks
+ * @param threads - the number of threads
+ * @param copy - FALSE to count the nodes of every task, TRUE to copy them
+ * @return 0 on failure, other on success
+ */
+int runCloneTasks(CloneTask *tasks, size_t count, int threads, bool copy);
+
+// -------------- search --------------
+/**
+ * @brief walks down the tree for a group of items side by side, one step of each at a time,
+ * prefetching the next node of every lookup before taking a step of the others
+ * @param tree - the tree to search
+ * @param keys - the items to look for
+ * @param count - the number of items, at most BATCH_GROUP
+ * @param found - filled with the node holding every item, or NULL
+ */
+void locateGroup(const RBTree *tree, const void *const *keys, size_t count, Node **found);
+
+/**
+ * @brief the tree walk of locateGroup
+ * @param tree - the tree to search
+ * @param keys - the items to look for (NULL ones are skipped)
+ * @param count - the number of items, at most BATCH_GROUP
+ * @param found - filled with the node holding every item, or NULL
+ */
+void walkGroup(const RBTree *tree, const void *const *keys, size_t count, Node **found);
+
+// --------------- diff ---------------
+/**
+ * @brief checks if two nodes holding equal items (in two trees of the same kind) differ: if
+ * equalFunc finds their items (a map's values) differ, or a multiset holds different counts
+ * @param tree - one of the trees
+ * @param before - the node in the first tree
+ * @param after - the node in the second tree
+ * @param equalFunc - the EqualFunc of RBTreeDiff (NULL: the items are the same)
+ * @return TRUE if the item changed, FALSE if not
+ */
+bool nodesDiffer(const RBTree *tree, const Node *before, const Node *after, EqualFunc equalFunc);
+
+// ------------- for each -------------
+/**
+ * @brief a function to help preform an action on every node in the tree
+ * @param node - to do the func on (starts from root and calles itself recursively)
+ * @param func - the function to preform
+ * @param args - an argument for the func
+ * @return 0 on failure, other on success
+ */
+int forEachHelper(const Node *node, forEachFunc func, void *args);
+
+// --------------- free ---------------
+/**
+ * @brief frees all the nodes (and their data) recursively
+ * @param tree - the tree the nodes belong to
+ * @param node - the node to free, starting from the root
+ */
+void freeHelper(RBTree *tree, Node **node);
+
+// ------------------------------ functions -----------------------------
+// -------------- general --------------
+int whereToGo(const int num)
+{
+    if (num < 0)
+    {
+        return LEFT;
+    }
+    if (num > 0)
+    {
+        return RIGHT;
+    }
+    return ROOT;
+}
+
+int isRightLeftChildOrRoot(const Node *node)
+{
+    Node *p = node->parent;
+    if (p == NULL)
+    {
+        return ROOT;
+    }
+    if (node == p->left)
+    {
+        return LEFT;
+    }
+    return RIGHT;
+}
+
+void turnLeft(RBTree *tree, Node *node)
+{
+    Node *x = node;
+    Node *y = x->right;
+    Node *p = x->parent;
+
+    LeftOrRightChild side = isRightLeftChildOrRoot(x);
+    STAT_ADD(tree, leftRotations, 1);
+
+    x->parent = y;
+    SET_LINK(tree, x->right, y->left);
+    if (y->left != NULL)
+    {
+        y->left->parent = x;
+    }
+    SET_LINK(tree, y->left, x);
+    y->parent = p;
+
+    switch (side)
+    {
+        case LEFT:
+            SET_LINK(tree, p->left, y);
+            break;
+        case RIGHT:
+            SET_LINK(tree, p->right, y);
+            break;
+        default:
+            SET_LINK(tree, tree->root, y);
+            break;
+    }
+    if (tree->augment != NULL)
+    {
+        tree->augment(x);
+        tree->augment(y);
+    }
+}
+
+void turnRight(RBTree *tree, Node *node)
+{
+    Node *x = node;
+    Node *y = x->left;
+    Node *p = x->parent;
+
+    LeftOrRightChild side = isRightLeftChildOrRoot(x);
+    STAT_ADD(tree, rightRotations, 1);
+
+    x->parent = y;
+    SET_LINK(tree, x->left, y->right);
+    if (y->right != NULL)
+    {
+        y->right->parent = x;
+    }
+    SET_LINK(tree, y->right, x);
+    y->parent = p;
+
+    switch (side)
+    {
+        case LEFT:
+            SET_LINK(tree, p->left, y);
+            break;
+        case RIGHT:
+            SET_LINK(tree, p->right, y);
+            break;
+        default:
+            SET_LINK(tree, tree->root, y);
+            break;
+    }
+    if (tree->augment != NULL)
+    {
+        tree->augment(x);
+        tree->augment(y);
+    }
+}
+
+void turnToward(RBTree *tree, Node *node, LeftOrRightChild side)
+{
+    if (side == LEFT)
+    {
+        turnLeft(tree, node);
+    }
+    else
+    {
+        turnRight(tree, node);
+    }
+}
+
+Node *setBrother(Node *node)
+{
+    if (node == node->parent->left)
+    {
+        return node->parent->right;
+    }
+    return node->parent->left;
+}
+
+#ifdef RBTREE_STATS
+void recordDescent(RBTreeStats *stats, long unsigned depth)
+{
+    stats->descents++;
+    stats->totalDepth += depth;
+    if (depth > stats->maxDepth)
+    {
+        stats->maxDepth = depth;
+    }
+}
+#endif
+
+// --------------- create ---------------
 RBTree *newRBTree(CompareFunc compFunc, FreeFunc freeFunc)
 {
-    RBTree *tree = (RBTree *) malloc(sizeof(RBTree));
-    if (tree == NULL)
+    RBTree *tree = (RBTree *) malloc(sizeof(RBTree));
+    if (tree == NULL)
+    {
+        return NULL;
+    }
+
+    tree->root = NULL;
+    tree->compFunc = compFunc, tree->freeFunc = freeFunc;
+    tree->size = EMPTY;
+    tree->kind = RB_SET, tree->nodeSize = sizeof(Node);
+    tree->valueFreeFunc = NULL;
+    tree->min = NULL, tree->max = NULL;
+    tree->finger = NULL, tree->fingerSearch = FALSE;
+    tree->balance = RB_BALANCE_RED_BLACK;
+    tree->augment = NULL;
+    tree->strings = NULL;
+    tree->hashIndex = NULL;
+    tree->bloom = NULL;
+    tree->writeBuffer = NULL;
+    tree->seqlock = NULL;
+    tree->nodeBlock = NULL, tree->blockBytes = 0;
+    tree->stats = NULL;
+#ifdef RBTREE_STATS
+    tree->stats = (RBTreeStats *) malloc(sizeof(RBTreeStats));
+    if (tree->stats == NULL)
+    {
+        free(tree);
+        return NULL;
+    }
+    RBTreeResetStats(tree);
+#endif
+
+    return tree;
+}
+
+RBTree *newRBMultiset(CompareFunc compFunc, FreeFunc freeFunc, RBTreeKind kind)
+{
+    if (kind != RB_MULTISET_COUNTED && kind != RB_MULTISET_CHAINED)
+    {
+        return NULL;
+    }
+    RBTree *tree = newRBTree(compFunc, freeFunc);
+    if (tree == NULL)
+    {
+        return NULL;
+    }
+    tree->kind = kind, tree->nodeSize = sizeof(MultisetNode);
+    return tree;
+}
+
+RBTree *newRBMap(CompareFunc keyCompFunc, FreeFunc keyFreeFunc, FreeFunc valueFreeFunc)
+{
+    RBTree *map = newRBTree(keyCompFunc, keyFreeFunc);
+    if (map == NULL)
+    {
+        return NULL;
+    }
+    map->kind = RB_MAP, map->nodeSize = sizeof(MapNode);
+    map->valueFreeFunc = valueFreeFunc;
+    return map;
+}
+
+RBTree *newRBAugmentedTree(CompareFunc compFunc, FreeFunc freeFunc, size_t nodeSize,
+                           AugmentFunc augment)
+{
+    if (nodeSize < sizeof(Node) || augment == NULL)
+    {
+        return NULL;
+    }
+    RBTree *tree = newRBTree(compFunc, freeFunc);
+    if (tree == NULL)
+    {
+        return NULL;
+    }
+    tree->nodeSize = nodeSize, tree->augment = augment;
+    return tree;
+}
+
+Node *newNode(RBTree *tree, void *data)
+{
+    Node *node = (Node *) calloc(1, tree->nodeSize);
+    if (node == NULL)
+    {
+        return NULL;
+    }
+    STAT_ADD(tree, allocations, 1);
+    node->left = NULL, node->right = NULL, node->parent = NULL;
+    node->color = RED;
+    node->data = data;
+    if (IS_MULTISET(tree))
+    {
+        ((MultisetNode *) node)->count = 1;
+    }
+    if (tree->kind == RB_STRING_SET)
+    {
+        node->data = storeString(tree, (StringNode *) node, (const char *) data);
+        if (node->data == NULL)
+        {
+            free(node);
+            STAT_ADD(tree, frees, 1);
+            return NULL;
+        }
+    }
+    return node;
+}
+
+// --------------- augment ---------------
+void augmentPath(RBTree *tree, Node *node)
+{
+    if (tree->augment == NULL)
+    {
+        return;
+    }
+    for (; node != NULL; node = node->parent)
+    {
+        tree->augment(node);
+    }
+}
+
+// --------------- insert ---------------
+int insertToRBTree(RBTree *tree, void *data)
+{
+    if (data == NULL || tree == NULL)
+    {
+        return FAIL;
+    }
+    settle(tree);
+    LeftOrRightChild side;
+    Node *parent = locateToWrite(tree, data, &side);
+    if (parent != NULL && side == ROOT)
+    {
+        // already in the tree - a multiset counts it, the others fail
+        return addOccurrence(tree, parent, data);
+    }
+
+    Node *node = newNode(tree, data);
+    if (node == NULL)
+    {
+        return FAIL;
+    }
+    linkNode(tree, node, parent, side);
+    return SUCCESS;
+}
+
+Node *locate(const RBTree *tree, const void *data, LeftOrRightChild *side)
+{
+    Node *treeNode = tree->root;
+    *side = ROOT;
+    if (treeNode == NULL)
+    {
+        return NULL;
+    }
+    if (tree->finger != NULL)
+    {
+        treeNode = climbFromFinger(tree, data);
+    }
+
+    DESCENT_BEGIN;
+    while (TRUE)
+    {
+        DESCENT_STEP;
+        *side = whereToGo(COMPARE(tree, data, treeNode->data));
+        Node *next = NULL;
+        switch (*side)
+        {
+            case RIGHT:
+                next = treeNode->right;
+                break;
+            case LEFT:
+                next = treeNode->left;
+                break;
+            default:
+                break;
+        }
+        if (next == NULL)
+        {
+            break;
+        }
+        treeNode = next;
+    }
+    DESCENT_END(tree);
+    return treeNode;
+}
+
+Node *locateToWrite(RBTree *tree, const void *data, LeftOrRightChild *side)
+{
+    Node *node = locate(tree, data, side);
+    if (tree->fingerSearch)
+    {
+        tree->finger = node;
+    }
+    return node;
+}
+
+Node *climbFromFinger(const RBTree *tree, const void *data)
+{
+    Node *node = tree->finger;
+    int direction = whereToGo(COMPARE(tree, data, node->data));
+    if (direction == ROOT || (direction == RIGHT && node == tree->max) ||
+        (direction == LEFT && node == tree->min))
+    {
+        return node;
+    }
+
+    // node's subtree holds items on the finger's side of data. go up until its other bound is
+    // past data too. the bound only changes when we come up from the side facing data.
+    while (node->parent != NULL)
+    {
+        Node *parent = node->parent;
+        if (isRightLeftChildOrRoot(node) == direction)
+        {
+            node = parent;
+            continue;
+        }
+        int parentDirection = whereToGo(COMPARE(tree, data, parent->data));
+        if (parentDirection != direction)
+        {
+            return parentDirection == ROOT ? parent : node;
+        }
+        node = parent;
+    }
+    return node;
+}
+
+void linkNode(RBTree *tree, Node *node, Node *parent, LeftOrRightChild side)
+{
+    beginWrite(tree);
+    attach(tree, node, parent, side);
+    fixingAlg(tree, node);
+    augmentPath(tree, node);
+    endWrite(tree);
+}
+
+void attach(RBTree *tree, Node *node, Node *parent, LeftOrRightChild side)
+{
+    node->parent = parent;
+    switch (side)
+    {
+        case RIGHT:
+            SET_LINK(tree, parent->right, node);
+            if (parent == tree->max)
+            {
+                tree->max = node;
+            }
+            break;
+        case LEFT:
+            SET_LINK(tree, parent->left, node);
+            if (parent == tree->min)
+            {
+                tree->min = node;
+            }
+            break;
+        default:
+            SET_LINK(tree, tree->root, node);
+            tree->min = node, tree->max = node;
+            break;
+    }
+    if (tree->fingerSearch)
+    {
+        tree->finger = node;
+    }
+    if (tree->hashIndex != NULL && !hashInsert(tree->hashIndex, node))
+    {
+        freeHashIndex(&tree->hashIndex);
+    }
+    tree->size++;
+    bloomAdd(tree, node);
+}
+
+void fixingAlg(RBTree *tree, Node *node)
+{
+    if (tree->balance == RB_BALANCE_WAVL)
+    {
+        wavlInsertFix(tree, node);
+        return;
+    }
+    Node *toFix = node;
+    Node *dad;
+    Node *uncle;
+    while (TRUE)
+    {
+        // case 1 - if node is root
+        if (toFix == tree->root)
+        {
+            STAT_ADD(tree, recolors, toFix->color != BLACK);
+            toFix->color = BLACK;
+            return;
+        }
+
+        // case 2 - parent is black
+        if (toFix->parent->color == BLACK)
+        {
+            return;
+        }
+
+        dad = toFix->parent;
+        uncle = setBrother(dad);
+
+        // case 4 - black uncle
+        if (uncle == NULL || uncle->color == BLACK)
+        {
+            redDadBlackUncle(tree, toFix);
+            return;
+        }
+
+        // case 3 - red uncle
+        if (uncle->color == RED)
+        {
+            redDadRedUncle(tree, toFix);
+            toFix = toFix->parent->parent;
+        }
+    }
+}
+
+void redDadRedUncle(RBTree *tree, Node *new)
+{
+    Node *dad = new->parent;
+    Node *grandad = dad->parent;
+    Node *uncle = setBrother(dad);
+    dad->color = BLACK, uncle->color = BLACK;
+    grandad->color = RED;
+    STAT_ADD(tree, recolors, 3);
+}
+
+void redDadBlackUncle(RBTree *tree, Node *new)
+{
+    Node *dad = new->parent;
+    Node *grandad = dad->parent;
+    bool turned = FALSE;
+
+    // check if triangle
+    if (grandad->left != NULL)
+    {
+        if (new == grandad->left->right)
+        {
+            turnLeft(tree, dad);
+            new = dad;
+            dad = new->parent;
+            turned = TRUE;
+        }
+    }
+    if (grandad->right != NULL && !turned)
+    {
+        if (new == grandad->right->left)
+        {
+            turnRight(tree, dad);
+            new = dad;
+            dad = new->parent;
+        }
+    }
+    turned = FALSE;
+
+    // fixing line
+    if (grandad->left != NULL)
+    {
+        if (new == grandad->left->left)
+        {
+            turnRight(tree, grandad);
+            turned = TRUE;
+        }
+    }
+    if (grandad->right != NULL && !turned)
+    {
+        if (new == grandad->right->right)
+        {
+            turnLeft(tree, grandad);
+        }
+    }
+    dad->color = BLACK;
+    grandad->color = RED;
+    STAT_ADD(tree, recolors, 2);
+}
+
+// --------------- delete ---------------
+int deleteFromRBTree(RBTree *tree, void *data)
+{
+    settle(tree);
+    if (data == NULL || tree == NULL)
+    {
+        return FAIL;
+    }
+
+    Node *M = findNode(tree, data);
+    // not in tree
+    if (M == NULL)
+    {
+        return FAIL;
+    }
+    // one of several occurrences in a multiset
+    if (removeOccurrence(tree, M))
+    {
+        return SUCCESS;
+    }
+
+    unlinkNode(tree, M);
+    deleteNode(tree, &M);
+    return SUCCESS;
+}
+
+void unlinkNode(RBTree *tree, Node *M)
+{
+    beginWrite(tree);
+    // nodes are never moved to other places in the order, so only removing an end moves it
+    if (M == tree->min)
+    {
+        tree->min = nextNode(M);
+    }
+    if (M == tree->max)
+    {
+        tree->max = prevNode(M);
+    }
+    if (tree->hashIndex != NULL)
+    {
+        hashRemove(tree->hashIndex, M);
+    }
+    if (M == tree->finger || tree->fingerSearch)
+    {
+        // M's parent stays in the tree and is near it, so the next search starts nearby
+        tree->finger = M->parent;
+    }
+
+    // is M: leaf / has 1 child / has 2 kids
+    int kids = howManyKIds(M);
+    if (kids == TWO_KIDS)
+    {
+        swapWithSuccessor(tree, M, successor(M));
+    }
+
+    Node *C = setC(M);
+    Node *removedFrom = M->parent;
+    if (tree->balance == RB_BALANCE_WAVL)
+    {
+        wavlRemove(tree, M, C);
+    }
+
+    // case 1
+    else if (M->color == RED)
+    {
+        putCInM(tree, C, M);
+    }
+
+    // case 2
+    else if (C != NULL && C->color == RED)
+    {
+        // check if m was root
+        if (M == tree->root)
+        {
+            SET_LINK(tree, tree->root, C);
+        }
+        putCInM(tree, C, M);
+        C->color = BLACK;
+        STAT_ADD(tree, recolors, 1);
+    }
+
+    // case 3
+    else
+    {
+        blackMAndC(tree, M);
+    }
+
+    M->parent = NULL;
+    SET_LINK(tree, M->left, NULL), SET_LINK(tree, M->right, NULL);
+    tree->size--;
+    // rotations update the nodes they move. a node they leave out of date is still above removedFrom
+    augmentPath(tree, removedFrom);
+    bloomRemoved(tree);
+    endWrite(tree);
+}
+
+void swapWithSuccessor(RBTree *tree, Node *M, Node *MSuccessor)
+{
+    Node *P = M->parent, *left = M->left, *right = M->right;
+    Node *successorParent = MSuccessor->parent, *successorRight = MSuccessor->right;
+
+    // the successor takes M's place
+    switch (isRightLeftChildOrRoot(M))
+    {
+        case LEFT:
+            SET_LINK(tree, P->left, MSuccessor);
+            break;
+        case RIGHT:
+            SET_LINK(tree, P->right, MSuccessor);
+            break;
+        default:
+            SET_LINK(tree, tree->root, MSuccessor);
+            break;
+    }
+    MSuccessor->parent = P;
+    SET_LINK(tree, MSuccessor->left, left);
+    left->parent = MSuccessor;
+    if (successorParent == M)
+    {
+        SET_LINK(tree, MSuccessor->right, M);
+        M->parent = MSuccessor;
+    }
+    else
+    {
+        SET_LINK(tree, MSuccessor->right, right);
+        right->parent = MSuccessor;
+        SET_LINK(tree, successorParent->left, M);
+        M->parent = successorParent;
+    }
+
+    // and M takes the successor's place (which has no left child)
+    SET_LINK(tree, M->left, NULL);
+    SET_LINK(tree, M->right, successorRight);
+    if (successorRight != NULL)
+    {
+        successorRight->parent = M;
+    }
+    Color temp = M->color;
+    M->color = MSuccessor->color;
+    MSuccessor->color = temp;
+    int rank = M->rank;
+    M->rank = MSuccessor->rank;
+    MSuccessor->rank = rank;
+}
+
+void blackMAndC(RBTree *tree, Node *M)
+{
+    Node *C = setC(M);
+    Node *P = M->parent;
+
+    // a - is root
+    if (M == tree->root)
+    {
+        SET_LINK(tree, tree->root, NULL);
+        return;
+    }
+
+    Node *S = setBrother(M);
+    putCInM(tree, C, M);
+    LeftOrRightChild side;
+
+    while (TRUE)
+    {
+        side = setCSide(S);
+
+        if (S->color == BLACK)
+        {
+            // b - S and its two sons are black
+            if (hasTwoBlackKids(S))
+            {
+                S->color = RED;
+                STAT_ADD(tree, recolors, 1);
+                // i - P is red
+                if (P->color == RED)
+                {
+                    P->color = BLACK;
+                    STAT_ADD(tree, recolors, 1);
+                    return;
+                }
+                // ii - P is black
+                C = P;
+                if (C == tree->root)
+                {
+                    return;
+                }
+                P = C->parent;
+                S = setBrother(C);
+                continue;
+            }
+
+            // d - S and Sf are black, Sc is red
+            else if (redScBlackSf(S, side))
+            {
+                blackSAndSfRedSc(tree, S);
+                S = S->parent;
+                continue;
+            }
+
+            // e - S is black, Sf is red
+            if (!redScBlackSf(S, side))
+            {
+                blackSRedSf(tree, S);
+                return;
+            }
+        }
+
+        // c - S is red
+        else
+        {
+            swapColor(tree, S, P);
+            switch (side)
+            {
+                case RIGHT:
+                    S = S->right;
+                    turnRight(tree, P);
+                    break;
+                case LEFT:
+                    S = S->left;
+                    turnLeft(tree, P);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+bool redScBlackSf(const Node *S, LeftOrRightChild side)
+{
+    switch (side)
+    {
+        case RIGHT:
+            if (S->right == NULL)
+            {
+                return FALSE;
+            }
+            if (S->right->color == RED)
+            {
+                if (S->left == NULL || S->left->color == BLACK)
+                {
+                    return TRUE;
+                }
+            }
+            return FALSE;
+        case LEFT:
+            if (S->left == NULL)
+            {
+                return FALSE;
+            }
+            if (S->left->color == RED)
+            {
+                if (S->right == NULL || S->right->color == BLACK)
+                {
+                    return TRUE;
+                }
+            }
+            return FALSE;
+        default:
+            return FALSE;
+    }
+}
+
+bool hasTwoBlackKids(Node *node)
+{
+    int kids = howManyKIds(node);
+    switch (kids)
+    {
+        case ZERO_KIDS:
+            return TRUE;
+        case ONE_KID:
+            return FALSE;
+        default:
+            if (node->left->color == BLACK && node->right->color == BLACK)
+            {
+                return TRUE;
+            }
+            else
+            {
+                return FALSE;
+            }
+    }
+}
+
+int howManyKIds(const Node *node)
+{
+    // check if leaf
+    if (node->left == NULL && node->right == NULL)
+    {
+        return ZERO_KIDS;
+    }
+    if (node->left != NULL && node->right != NULL)
+    {
+        return TWO_KIDS;
+    }
+    return ONE_KID;
+}
+
+Node *findNode(const RBTree *tree, const void *data)
+{
+    Node *node = NULL;
+    if (!bloomRejects(tree, data))
+    {
+        if (tree->hashIndex != NULL)
+        {
+            node = hashFind(tree, data);
+        }
+        else
+        {
+            LeftOrRightChild side;
+            node = locate(tree, data, &side);
+            if (side != ROOT)
+            {
+                node = NULL;
+            }
+        }
+        if (node == NULL)
+        {
+            bloomMissed(tree);
+        }
+    }
+    // the buffered items are in neither the bloom filter nor the hash index yet
+    return node != NULL ? node : findBuffered(tree, data);
+}
+
+Node *successor(const Node *node)
+{
+    Node *successor = node->right;
+    while (successor->left != NULL)
+    {
+        successor = successor->left;
+    }
+    return successor;
+}
+
+Node *nextNode(const Node *node)
+{
+    if (node->right != NULL)
+    {
+        return successor(node);
+    }
+    while (node->parent != NULL && node == node->parent->right)
+    {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+Node *prevNode(const Node *node)
+{
+    if (node->left != NULL)
+    {
+        Node *predecessor = node->left;
+        while (predecessor->right != NULL)
+        {
+            predecessor = predecessor->right;
+        }
+        return predecessor;
+    }
+    while (node->parent != NULL && node == node->parent->left)
+    {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+void swapColor(RBTree *tree, Node *a, Node *b)
+{
+    Color temp = a->color;
+    STAT_ADD(tree, recolors, 2 * (temp != b->color));
+    a->color = b->color;
+    b->color = temp;
+}
+
+Node *setC(Node *M)
+{
+    if (M->right != NULL)
+    {
+        return M->right;
+    }
+    return M->left;
+}
+
+LeftOrRightChild setCSide(Node *S)
+{
+    LeftOrRightChild side = isRightLeftChildOrRoot(S);
+    if (side == RIGHT)
+    {
+        return LEFT;
+    }
+    return RIGHT;
+}
+
+void blackSAndSfRedSc(RBTree *tree, Node *S)
+{
+    LeftOrRightChild side = setCSide(S);
+    S->color = RED;
+    STAT_ADD(tree, recolors, 2);
+    Node *Sc = NULL;
+    switch (side)
+    {
+        case RIGHT:
+            Sc = S->right;
+            Sc->color = BLACK;
+            turnLeft(tree, S);
+            break;
+        case LEFT:
+            Sc = S->left;
+            Sc->color = BLACK;
+            turnRight(tree, S);
+            break;
+        default:
+            break;
+    }
+}
+
+void blackSRedSf(RBTree *tree, Node *S)
+{
+    LeftOrRightChild side = setCSide(S);
+    Node *P = S->parent;
+    Node *Sf = NULL;
+    swapColor(tree, S, P);
+    switch (side)
+    {
+        case RIGHT:
+            Sf = S->left;
+            turnRight(tree, P);
+            break;
+        case LEFT:
+            Sf = S->right;
+            turnLeft(tree, P);
+            break;
+        default:
+            break;
+    }
+    STAT_ADD(tree, recolors, Sf->color != BLACK);
+    Sf->color = BLACK;
+}
+
+void putCInM(RBTree *tree, Node *C, Node *M)
+{
+    LeftOrRightChild side = isRightLeftChildOrRoot(M);
+    // set C as M's parent child
+    switch (side)
+    {
+        case RIGHT:
+            SET_LINK(tree, M->parent->right, C);
+            break;
+        case LEFT:
+            SET_LINK(tree, M->parent->left, C);
+            break;
+        default:
+            break;
+    }
+
+    // set C's parent to be M's parent
+    if (C != NULL)
+    {
+        C->parent = M->parent;
+    }
+}
+
+void deleteNode(RBTree *tree, Node **M)
+{
+    if (tree->seqlock != NULL)
+    {
+        retire(&tree->seqlock->deleted, *M);
+        *M = NULL;
+        return;
+    }
+    if (tree->freeFunc != NULL)
+    {
+        tree->freeFunc((*M)->data);
+    }
+    releaseNode(tree, M);
+}
+
+void releaseNode(RBTree *tree, Node **M)
+{
+    if (tree->seqlock != NULL)
+    {
+        retire(&tree->seqlock->released, *M);
+        *M = NULL;
+        return;
+    }
+    if (tree->kind == RB_MAP && tree->valueFreeFunc != NULL)
+    {
+        tree->valueFreeFunc(((MapNode *) *M)->value);
+    }
+    if (tree->kind == RB_MULTISET_CHAINED)
+    {
+        Occurrence *occurrence = ((MultisetNode *) *M)->chain;
+        while (occurrence != NULL)
+        {
+            Occurrence *next = occurrence->next;
+            if (tree->freeFunc != NULL)
+            {
+                tree->freeFunc(occurrence->data);
+            }
+            free(occurrence);
+            STAT_ADD(tree, frees, 1);
+            occurrence = next;
+        }
+    }
+    if (tree->kind == RB_STRING_SET)
+    {
+        releaseString(tree, (StringNode *) *M);
+    }
+    // the nodes of a clone are freed with their block
+    if ((uintptr_t) *M - (uintptr_t) tree->nodeBlock >= tree->blockBytes)
+    {
+        free(*M);
+        STAT_ADD(tree, frees, 1);
+    }
+    *M = NULL;
+}
+
+// ---------------- wavl ----------------
+int RBTreeSetBalance(RBTree *tree, RBBalance balance)
+{
+    if (tree == NULL || tree->root != NULL ||
+        (balance != RB_BALANCE_RED_BLACK && balance != RB_BALANCE_WAVL))
+    {
+        return FAIL;
+    }
+    tree->balance = balance;
+    return SUCCESS;
+}
+
+int rankOf(const Node *node)
+{
+    if (node == NULL)
+    {
+        return -1;
+    }
+    return node->rank;
+}
+
+void wavlInsertFix(RBTree *tree, Node *node)
+{
+    Node *x = node;
+    Node *P = x->parent;
+    while (P != NULL && P->rank == x->rank)
+    {
+        // P is a 0,1 node - promote it and go up
+        if (P->rank - rankOf(setBrother(x)) == 1)
+        {
+            P->rank++;
+            STAT_ADD(tree, recolors, 1);
+            x = P, P = x->parent;
+            continue;
+        }
+
+        // P is a 0,2 node - x has a 1 and a 2 child after its promotion
+        LeftOrRightChild side = isRightLeftChildOrRoot(x);
+        Node *inner = side == LEFT ? x->right : x->left;
+        if (x->rank - rankOf(inner) == 2)
+        {
+            turnToward(tree, P, -side);
+            P->rank--;
+            STAT_ADD(tree, recolors, 1);
+        }
+        else
+        {
+            turnToward(tree, x, side);
+            turnToward(tree, P, -side);
+            inner->rank++, x->rank--, P->rank--;
+            STAT_ADD(tree, recolors, 3);
+        }
+        return;
+    }
+}
+
+void wavlRemove(RBTree *tree, Node *M, Node *C)
+{
+    Node *P = M->parent;
+    LeftOrRightChild side = isRightLeftChildOrRoot(M);
+    if (side == ROOT)
+    {
+        SET_LINK(tree, tree->root, C);
+    }
+    putCInM(tree, C, M);
+    if (P != NULL)
+    {
+        wavlDeleteFix(tree, P, side);
+    }
+}
+
+void wavlDeleteFix(RBTree *tree, Node *P, LeftOrRightChild side)
+{
+    // a leaf must be a 1,1 node (rank 0), so a leaf that lost its child is demoted
+    if (P->left == NULL && P->right == NULL && P->rank == 1)
+    {
+        P->rank--;
+        STAT_ADD(tree, recolors, 1);
+        side = isRightLeftChildOrRoot(P), P = P->parent;
+    }
+
+    while (P != NULL && P->rank - rankOf(side == LEFT ? P->left : P->right) == 3)
+    {
+        Node *S = side == LEFT ? P->right : P->left;
+        if (P->rank - S->rank == 2)
+        {
+            // P is a 3,2 node
+            P->rank--;
+            STAT_ADD(tree, recolors, 1);
+        }
+        else if (S->rank - rankOf(S->left) == 2 && S->rank - rankOf(S->right) == 2)
+        {
+            // P is a 3,1 node and S a 2,2 node
+            P->rank--, S->rank--;
+            STAT_ADD(tree, recolors, 2);
+        }
+        else
+        {
+            break;
+        }
+        side = isRightLeftChildOrRoot(P), P = P->parent;
+    }
+    if (P == NULL || P->rank - rankOf(side == LEFT ? P->left : P->right) != 3)
+    {
+        return;
+    }
+
+    // P is a 3,1 node and S has a 1 child - rotate S (or its near child) up to P's place
+    Node *S = side == LEFT ? P->right : P->left;
+    Node *far = side == LEFT ? S->right : S->left;
+    Node *near = side == LEFT ? S->left : S->right;
+    if (S->rank - rankOf(far) == 1)
+    {
+        turnToward(tree, P, side);
+        S->rank++, P->rank--;
+        STAT_ADD(tree, recolors, 2);
+        if (P->left == NULL && P->right == NULL)
+        {
+            P->rank--;
+            STAT_ADD(tree, recolors, 1);
+        }
+    }
+    else
+    {
+        turnToward(tree, S, -side);
+        turnToward(tree, P, side);
+        near->rank += 2, S->rank--, P->rank -= 2;
+        STAT_ADD(tree, recolors, 3);
+    }
+}
+
+// --------------- handles ---------------
+RBHandle RBTreeFind(const RBTree *tree, const void *data)
+{
+    if (data == NULL || tree == NULL)
+    {
+        return NULL;
+    }
+    if (tree->seqlock != NULL)
+    {
+        return optimisticFind(tree, data);
+    }
+    return findNode(tree, data);
+}
+
+RBHandle RBTreeFindOrInsert(RBTree *tree, void *data, int *inserted)
+{
+    if (inserted != NULL)
+    {
+        *inserted = FALSE;
+    }
+    if (data == NULL || tree == NULL || IS_MULTISET(tree) || !RBTreeFlush(tree))
+    {
+        return NULL;
+    }
+    LeftOrRightChild side;
+    Node *parent = locateToWrite(tree, data, &side);
+    if (parent != NULL && side == ROOT)
+    {
+        return parent;
+    }
+    Node *node = newNode(tree, data);
+    if (node == NULL)
+    {
+        return NULL;
+    }
+    linkNode(tree, node, parent, side);
+    if (inserted != NULL)
+    {
+        *inserted = TRUE;
+    }
+    return node;
+}
+
+void *RBHandleData(RBHandle handle)
+{
+    if (handle == NULL)
+    {
+        return NULL;
+    }
+    return handle->data;
+}
+
+int RBTreeEraseHandle(RBTree *tree, RBHandle handle)
+{
+    if (tree == NULL || handle == NULL)
+    {
+        return FAIL;
+    }
+    // the handle may be of a buffered item
+    settle(tree);
+    unlinkNode(tree, handle);
+    deleteNode(tree, &handle);
+    return SUCCESS;
+}
+
+void *RBTreeExtract(RBTree *tree, const void *data)
+{
+    settle(tree);
+    if (data == NULL || tree == NULL)
+    {
+        return NULL;
+    }
+    return RBTreeExtractHandle(tree, findNode(tree, data));
+}
+
+void *RBTreeExtractHandle(RBTree *tree, RBHandle handle)
+{
+    // the node of these kinds holds more than its item, which would be freed behind the caller
+    if (tree == NULL || handle == NULL || tree->kind == RB_STRING_SET || tree->kind == RB_MAP ||
+        tree->kind == RB_MULTISET_CHAINED)
+    {
+        return NULL;
+    }
+    settle(tree);
+    void *data = handle->data;
+    unlinkNode(tree, handle);
+    releaseNode(tree, &handle);
+    return data;
+}
+
+// ----------- priority queue -----------
+void *RBTreePeekMin(const RBTree *tree)
+{
+    if (tree == NULL || tree->min == NULL)
+    {
+        return NULL;
+    }
+    return tree->min->data;
+}
+
+void *RBTreePeekMax(const RBTree *tree)
+{
+    if (tree == NULL || tree->max == NULL)
+    {
+        return NULL;
+    }
+    return tree->max->data;
+}
+
+void *RBTreePopMin(RBTree *tree)
+{
+    settle(tree);
+    if (tree == NULL)
+    {
+        return NULL;
+    }
+    return RBTreeExtractHandle(tree, tree->min);
+}
+
+void *RBTreePopMax(RBTree *tree)
+{
+    settle(tree);
+    if (tree == NULL)
+    {
+        return NULL;
+    }
+    return RBTreeExtractHandle(tree, tree->max);
+}
+
+// --------------- search ---------------
+int RBTreeContains(const RBTree *tree, const void *data)
+{
+    if (data == NULL || tree == NULL)
+    {
+        return FALSE;
+    }
+    if (tree->seqlock != NULL)
+    {
+        return optimisticFind(tree, data) != NULL;
+    }
+    return findNode(tree, data) != NULL;
+}
+
+int RBTreeContainsBatch(const RBTree *tree, const void *const *keys, size_t n, int *results)
+{
+    if (tree == NULL || (n != 0 && (keys == NULL || results == NULL)))
+    {
+        return FAIL;
+    }
+    Node *found[BATCH_GROUP];
+    for (size_t first = 0; first < n; first += BATCH_GROUP)
+    {
+        size_t count = n - first < BATCH_GROUP ? n - first : BATCH_GROUP;
+        locateGroup(tree, keys + first, count, found);
+        for (size_t i = 0; i < count; i++)
+        {
+            results[first + i] = found[i] != NULL;
+        }
+    }
+    return SUCCESS;
+}
+
+int RBTreeFindBatch(const RBTree *tree, const void *const *keys, size_t n, RBHandle *handles)
+{
+    if (tree == NULL || (n != 0 && (keys == NULL || handles == NULL)))
+    {
+        return FAIL;
+    }
+    for (size_t first = 0; first < n; first += BATCH_GROUP)
+    {
+        size_t count = n - first < BATCH_GROUP ? n - first : BATCH_GROUP;
+        locateGroup(tree, keys + first, count, handles + first);
+    }
+    return SUCCESS;
+}
+
+void locateGroup(const RBTree *tree, const void *const *keys, size_t count, Node **found)
+{
+    // the items the bloom filter rejects are not looked for
+    const void *pending[BATCH_GROUP] = {NULL};
+    for (size_t i = 0; i < count; i++)
+    {
+        found[i] = NULL;
+        pending[i] = keys[i] != NULL && !bloomRejects(tree, keys[i]) ? keys[i] : NULL;
+    }
+    if (tree->hashIndex != NULL)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            found[i] = pending[i] == NULL ? NULL : hashFind(tree, pending[i]);
+        }
+    }
+    else
+    {
+        walkGroup(tree, pending, count, found);
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (pending[i] != NULL && found[i] == NULL)
+        {
+            bloomMissed(tree);
+        }
+        if (found[i] == NULL && keys[i] != NULL)
+        {
+            found[i] = findBuffered(tree, keys[i]);
+        }
+    }
+}
+
+void walkGroup(const RBTree *tree, const void *const *keys, size_t count, Node **found)
+{
+    Node *cursor[BATCH_GROUP];
+    size_t active = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        found[i] = NULL;
+        cursor[i] = keys[i] == NULL ? NULL : tree->root;
+        active += cursor[i] != NULL;
+    }
+
+    // every round takes one step of each unfinished lookup. the node it steps to is prefetched,
+    // and only read in the next round, after the steps of all the other lookups.
+    while (active > 0)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            Node *node = cursor[i];
+            if (node == NULL)
+            {
+                continue;
+            }
+            int comparison = COMPARE(tree, keys[i], node->data);
+            if (comparison == 0)
+            {
+                found[i] = node;
+                node = NULL;
+            }
+            else
+            {
+                node = comparison > 0 ? node->right : node->left;
+                PREFETCH(node);
+            }
+            cursor[i] = node;
+            active -= node == NULL;
+        }
+    }
+}
+
+void RBTreeSetFinger(RBTree *tree, int enabled)
+{
+    if (tree == NULL)
+    {
+        return;
+    }
+    tree->fingerSearch = enabled ? TRUE : FALSE;
+    tree->finger = NULL;
+}
+
+// ------------- hash index -------------
+int RBTreeSetHashIndex(RBTree *tree, HashFunc hashFunc)
+{
+    settle(tree);
+    if (tree == NULL)
+    {
+        return FAIL;
+    }
+    freeHashIndex(&tree->hashIndex);
+    if (hashFunc == NULL)
+    {
+        return SUCCESS;
+    }
+    int bits = HASH_INDEX_BITS;
+    while (((size_t) 1 << bits) < 2 * tree->size)
+    {
+        bits++;
+    }
+    HashIndex *index = newHashIndex(hashFunc, bits);
+    if (index == NULL)
+    {
+        return FAIL;
+    }
+    for (Node *node = tree->min; node != NULL; node = nextNode(node))
+    {
+        hashPlace(index, hashFunc(node->data), node);
+    }
+    index->used = tree->size;
+    tree->hashIndex = index;
+    return SUCCESS;
+}
+
+HashIndex *newHashIndex(HashFunc hashFunc, int bits)
+{
+    HashIndex *index = (HashIndex *) malloc(sizeof(HashIndex));
+    if (index == NULL)
+    {
+        return NULL;
+    }
+    index->capacity = (size_t) 1 << bits;
+    index->slots = (HashSlot *) calloc(index->capacity, sizeof(HashSlot));
+    if (index->slots == NULL)
+    {
+        free(index);
+        return NULL;
+    }
+    index->hashFunc = hashFunc, index->bits = bits, index->used = 0;
+    return index;
+}
+
+void freeHashIndex(HashIndex **index)
+{
+    if (*index == NULL)
+    {
+        return;
+    }
+    free((*index)->slots);
+    free(*index);
+    *index = NULL;
+}
+
+size_t homeSlot(const HashIndex *index, size_t hash)
+{
+    return (size_t) (((uint64_t) hash * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - index->bits));
+}
+
+int hashInsert(HashIndex *index, Node *node)
+{
+    if (2 * (index->used + 1) > index->capacity)
+    {
+        HashSlot *old = index->slots;
+        size_t oldCapacity = index->capacity;
+        index->slots = (HashSlot *) calloc(2 * oldCapacity, sizeof(HashSlot));
+        if (index->slots == NULL)
+        {
+            index->slots = old;
+            return FAIL;
+        }
+        index->capacity = 2 * oldCapacity, index->bits++;
+        for (size_t i = 0; i < oldCapacity; i++)
+        {
+            if (old[i].node != NULL)
+            {
+                hashPlace(index, old[i].hash, old[i].node);
+            }
+        }
+        free(old);
+    }
+    hashPlace(index, index->hashFunc(node->data), node);
+    index->used++;
+    return SUCCESS;
+}
+
+void hashPlace(HashIndex *index, size_t hash, Node *node)
+{
+    size_t mask = index->capacity - 1;
+    size_t i = homeSlot(index, hash);
+    while (index->slots[i].node != NULL)
+    {
+        i = (i + 1) & mask;
+    }
+    index->slots[i].hash = hash, index->slots[i].node = node;
+}
+
+void hashRemove(HashIndex *index, const Node *node)
+{
+    size_t mask = index->capacity - 1;
+    size_t i = homeSlot(index, index->hashFunc(node->data));
+    while (index->slots[i].node != node)
+    {
+        i = (i + 1) & mask;
+    }
+    // move back every later slot of the run whose home is not between the hole and it
+    for (size_t j = (i + 1) & mask; index->slots[j].node != NULL; j = (j + 1) & mask)
+    {
+        size_t home = homeSlot(index, index->slots[j].hash);
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            index->slots[i] = index->slots[j];
+            i = j;
+        }
+    }
+    index->slots[i].node = NULL;
+    index->used--;
+}
+
+Node *hashFind(const RBTree *tree, const void *data)
+{
+    const HashIndex *index = tree->hashIndex;
+    size_t mask = index->capacity - 1;
+    size_t hash = index->hashFunc(data);
+    for (size_t i = homeSlot(index, hash); index->slots[i].node != NULL; i = (i + 1) & mask)
+    {
+        if (index->slots[i].hash == hash && COMPARE(tree, data, index->slots[i].node->data) == 0)
+        {
+            return index->slots[i].node;
+        }
+    }
+    return NULL;
+}
+
+// ------------ bloom filter ------------
+int RBTreeSetBloomFilter(RBTree *tree, HashFunc hashFunc, int bitsPerItem)
+{
+    settle(tree);
+    if (tree == NULL)
+    {
+        return FAIL;
+    }
+    freeBloomFilter(&tree->bloom);
+    if (hashFunc == NULL)
+    {
+        return SUCCESS;
+    }
+    BloomFilter *bloom = (BloomFilter *) calloc(1, sizeof(BloomFilter));
+    if (bloom == NULL)
+    {
+        return FAIL;
+    }
+    bloom->hashFunc = hashFunc;
+    bloom->bitsPerItem = bitsPerItem > 0 ? bitsPerItem : BLOOM_BITS_PER_ITEM;
+    // ln 2 hashes per bit of an item is optimal
+    bloom->hashes = (bloom->bitsPerItem * 69 + 50) / 100;
+    bloom->hashes = bloom->hashes < 1 ? 1 : bloom->hashes > 16 ? 16 : bloom->hashes;
+    tree->bloom = bloom;
+    if (!buildBloomFilter(tree, tree->size))
+    {
+        freeBloomFilter(&tree->bloom);
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+RBBloomStats RBTreeBloomStats(const RBTree *tree)
+{
+    RBBloomStats stats;
+    memset(&stats, 0, sizeof(RBBloomStats));
+    if (tree == NULL || tree->bloom == NULL)
+    {
+        return stats;
+    }
+    const BloomFilter *bloom = tree->bloom;
+    stats.checks = bloom->checks;
+    stats.rejected = bloom->rejected;
+    stats.falsePositives = bloom->falsePositives;
+    if (bloom->rejected + bloom->falsePositives > 0)
+    {
+        stats.falsePositiveRate = (double) bloom->falsePositives /
+                                  (double) (bloom->rejected + bloom->falsePositives);
+    }
+    stats.bytes = bloom->blocks * BLOOM_BLOCK_BYTES;
+    return stats;
+}
+
+int buildBloomFilter(RBTree *tree, long unsigned capacity)
+{
+    BloomFilter *bloom = tree->bloom;
+    if (capacity < BLOOM_MIN_ITEMS)
+    {
+        capacity = BLOOM_MIN_ITEMS;
+    }
+    size_t wanted = (capacity * bloom->bitsPerItem + 8 * BLOOM_BLOCK_BYTES - 1) /
+                    (8 * BLOOM_BLOCK_BYTES);
+    size_t blocks = 1;
+    while (blocks < wanted)
+    {
+        blocks *= 2;
+    }
+    if (blocks != bloom->blocks)
+    {
+        void *memory = malloc(blocks * BLOOM_BLOCK_BYTES + BLOOM_BLOCK_BYTES);
+        if (memory == NULL)
+        {
+            return FAIL;
+        }
+        free(bloom->memory);
+        bloom->memory = memory;
+        uintptr_t first = (uintptr_t) memory;
+        bloom->bits = (uint64_t *) ((first + BLOOM_BLOCK_BYTES - 1) &
+                                    ~(uintptr_t) (BLOOM_BLOCK_BYTES - 1));
+        bloom->blocks = blocks;
+    }
+    memset(bloom->bits, 0, blocks * BLOOM_BLOCK_BYTES);
+    bloom->capacity = capacity, bloom->stale = 0;
+    for (const Node *node = tree->min; node != NULL; node = nextNode(node))
+    {
+        uint64_t mask[BLOOM_BLOCK_WORDS];
+        uint64_t *block = bloomBits(bloom, node->data, mask);
+        for (int i = 0; i < BLOOM_BLOCK_WORDS; i++)
+        {
+            block[i] |= mask[i];
+        }
+    }
+    return SUCCESS;
+}
+
+void freeBloomFilter(BloomFilter **bloom)
+{
+    if (*bloom == NULL)
+    {
+        return;
+    }
+    free((*bloom)->memory);
+    free(*bloom);
+    *bloom = NULL;
+}
+
+uint64_t *bloomBits(const BloomFilter *bloom, const void *data, uint64_t *mask)
+{
+    // the high bits of the mixed hash pick the block, two 32 bit halves step through its bits
+    uint64_t hash = (uint64_t) bloom->hashFunc(data) * UINT64_C(0x9E3779B97F4A7C15);
+    hash ^= hash >> 29;
+    uint64_t *block = bloom->bits + ((hash >> 40) & (bloom->blocks - 1)) * BLOOM_BLOCK_WORDS;
+    uint32_t bit = (uint32_t) hash, step = (uint32_t) (hash >> 32) | 1;
+    memset(mask, 0, BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+    for (int i = 0; i < bloom->hashes; i++, bit += step)
+    {
+        mask[(bit >> 6) & (BLOOM_BLOCK_WORDS - 1)] |= (uint64_t) 1 << (bit & 63);
+    }
+    return block;
+}
+
+void bloomAdd(RBTree *tree, const Node *node)
+{
+    BloomFilter *bloom = tree->bloom;
+    if (bloom == NULL)
+    {
+        return;
+    }
+    if (tree->size > bloom->capacity)
+    {
+        if (!buildBloomFilter(tree, 2 * tree->size))
+        {
+            freeBloomFilter(&tree->bloom);
+        }
+        // the new node is already in the tree, so the build added it
+        return;
+    }
+    uint64_t mask[BLOOM_BLOCK_WORDS];
+    uint64_t *block = bloomBits(bloom, node->data, mask);
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++)
+    {
+        block[i] |= mask[i];
+    }
+}
+
+void bloomRemoved(RBTree *tree)
+{
+    BloomFilter *bloom = tree->bloom;
+    if (bloom == NULL)
+    {
+        return;
+    }
+    bloom->stale++;
+    if (4 * bloom->stale > tree->size && bloom->stale >= BLOOM_MIN_ITEMS / 4)
+    {
+        // a tree that shrank to a quarter of the filter gets a smaller one. otherwise (or if
+        // it can't be allocated) the same blocks are reused, which doesn't allocate
+        if (4 * tree->size >= bloom->capacity || !buildBloomFilter(tree, 2 * tree->size))
+        {
+            buildBloomFilter(tree, bloom->capacity);
+        }
+    }
+}
+
+bool bloomRejects(const RBTree *tree, const void *data)
+{
+    BloomFilter *bloom = tree->bloom;
+    if (bloom == NULL)
+    {
+        return FALSE;
+    }
+    BLOOM_COUNT(bloom, checks);
+    uint64_t mask[BLOOM_BLOCK_WORDS];
+    const uint64_t *block = bloomBits(bloom, data, mask);
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++)
+    {
+        if ((block[i] & mask[i]) != mask[i])
+        {
+            BLOOM_COUNT(bloom, rejected);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+void bloomMissed(const RBTree *tree)
+{
+    if (tree->bloom != NULL)
+    {
+        BLOOM_COUNT(tree->bloom, falsePositives);
+    }
+}
+
+// ------------ write buffer ------------
+int RBTreeSetWriteBuffer(RBTree *tree, size_t capacity, HashFunc hashFunc)
+{
+    if (tree == NULL || (capacity > 0 && (tree->kind != RB_SET || tree->seqlock != NULL)))
+    {
+        return FAIL;
+    }
+    settle(tree);
+    freeWriteBuffer(tree);
+    if (capacity == 0)
+    {
+        return SUCCESS;
+    }
+    WriteBuffer *buffer = (WriteBuffer *) calloc(1, sizeof(WriteBuffer));
+    if (buffer == NULL)
+    {
+        return FAIL;
+    }
+    tree->writeBuffer = buffer;
+    buffer->capacity = capacity;
+    buffer->nodes = (Node **) malloc(sizeof(Node *) * capacity);
+    buffer->scratch = (Node **) malloc(sizeof(Node *) * capacity);
+    buffer->hashFunc = hashFunc;
+    if (hashFunc != NULL)
+    {
+        buffer->bits = 1;
+        while (((size_t) 1 << buffer->bits) < 2 * capacity)
+        {
+            buffer->bits++;
+        }
+        buffer->slots = (size_t *) calloc((size_t) 1 << buffer->bits, sizeof(size_t));
+    }
+    if (buffer->nodes == NULL || buffer->scratch == NULL ||
+        (hashFunc != NULL && buffer->slots == NULL))
+    {
+        freeWriteBuffer(tree);
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+int RBTreeFlush(RBTree *tree)
+{
+    if (tree == NULL)
+    {
+        return FAIL;
+    }
+    settle(tree);
+    return SUCCESS;
+}
+
+int RBTreeBufferedInsert(RBTree *tree, void *data)
+{
+    if (data == NULL || tree == NULL)
+    {
+        return FAIL;
+    }
+    WriteBuffer *buffer = tree->writeBuffer;
+    if (buffer == NULL)
+    {
+        return insertToRBTree(tree, data);
+    }
+    // the same lookup as RBTreeContains, so no item is ever buffered twice or next to its equal
+    if (findNode(tree, data) != NULL)
+    {
+        return FAIL;
+    }
+    Node *node = newNode(tree, data);
+    if (node == NULL)
+    {
+        return FAIL;
+    }
+    if (buffer->count == buffer->capacity)
+    {
+        flushWriteBuffer(tree);
+    }
+    buffer->nodes[buffer->count] = node;
+    if (buffer->hashFunc != NULL)
+    {
+        hashBuffered(buffer, buffer->count);
+    }
+    buffer->count++;
+    return SUCCESS;
+}
+
+Node *findBuffered(const RBTree *tree, const void *data)
+{
+    const WriteBuffer *buffer = tree->writeBuffer;
+    if (buffer == NULL || buffer->count == 0)
     {
         return NULL;
     }
+    if (buffer->hashFunc == NULL)
+    {
+        for (size_t i = 0; i < buffer->count; i++)
+        {
+            if (COMPARE(tree, data, buffer->nodes[i]->data) == 0)
+            {
+                return buffer->nodes[i];
+            }
+        }
+        return NULL;
+    }
+    size_t mask = ((size_t) 1 << buffer->bits) - 1;
+    for (size_t i = bufferSlot(buffer, data); buffer->slots[i] != 0; i = (i + 1) & mask)
+    {
+        Node *node = buffer->nodes[buffer->slots[i] - 1];
+        if (COMPARE(tree, data, node->data) == 0)
+        {
+            return node;
+        }
+    }
+    return NULL;
+}
 
-    tree->root = NULL;
-    tree->compFunc = compFunc, tree->freeFunc = freeFunc;
-    tree->size = EMPTY;
+size_t bufferSlot(const WriteBuffer *buffer, const void *data)
+{
+    uint64_t hash = (uint64_t) buffer->hashFunc(data);
+    return (size_t) ((hash * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - buffer->bits));
+}
 
-    return tree;
+void hashBuffered(WriteBuffer *buffer, size_t index)
+{
+    size_t mask = ((size_t) 1 << buffer->bits) - 1;
+    size_t i = bufferSlot(buffer, buffer->nodes[index]->data);
+    while (buffer->slots[i] != 0)
+    {
+        i = (i + 1) & mask;
+    }
+    buffer->slots[i] = index + 1;
 }
 
-// --------------- insert ---------------
-int insertToRBTree(RBTree *tree, void *data)
+void flushWriteBuffer(RBTree *tree)
 {
-    if (data == NULL || tree == NULL)
+    WriteBuffer *buffer = tree->writeBuffer;
+    sortNodes(tree, buffer->nodes, buffer->scratch, buffer->count);
+
+    // sorted items are close to each other, so searching from the previous one is short
+    Node *finger = tree->finger;
+    for (size_t i = 0; i < buffer->count; i++)
     {
-        return FAIL;
+        Node *node = buffer->nodes[i];
+        LeftOrRightChild side;
+        Node *parent = locate(tree, node->data, &side);
+        linkNode(tree, node, parent, side);
+        tree->finger = node;
     }
-    Node *newNode = (Node *) malloc(sizeof(Node));
-    if (newNode == NULL)
+    if (!tree->fingerSearch)
     {
-        return FAIL;
+        tree->finger = finger;
     }
-    newNode->left = NULL, newNode->right = NULL, newNode->parent = NULL;
-    newNode->color = RED;
-    newNode->data = data;
+    buffer->count = 0;
+    if (buffer->hashFunc != NULL)
+    {
+        memset(buffer->slots, 0, sizeof(size_t) << buffer->bits);
+    }
+}
 
-    FunctionReturn failOrNah = insertRegular(tree, newNode);
-    if (failOrNah == FAIL)
+void settle(RBTree *tree)
+{
+    if (tree != NULL && tree->writeBuffer != NULL && tree->writeBuffer->count > 0)
     {
-        free(newNode);
-        return FAIL;
+        flushWriteBuffer(tree);
+    }
+}
+
+void sortNodes(const RBTree *tree, Node **nodes, Node **scratch, size_t n)
+{
+    Node **from = nodes, **to = scratch;
+    for (size_t width = 1; width < n; width *= 2)
+    {
+        for (size_t low = 0; low < n; low += 2 * width)
+        {
+            size_t middle = low + width < n ? low + width : n;
+            size_t high = low + 2 * width < n ? low + 2 * width : n;
+            size_t i = low, j = middle, k = low;
+            while (i < middle && j < high)
+            {
+                to[k++] = COMPARE(tree, from[j]->data, from[i]->data) < 0 ? from[j++] : from[i++];
+            }
+            while (i < middle)
+            {
+                to[k++] = from[i++];
+            }
+            while (j < high)
+            {
+                to[k++] = from[j++];
+            }
+        }
+        Node **swap = from;
+        from = to, to = swap;
+    }
+    if (from != nodes)
+    {
+        memcpy(nodes, from, sizeof(Node *) * n);
+    }
+}
+
+void freeWriteBuffer(RBTree *tree)
+{
+    WriteBuffer *buffer = tree->writeBuffer;
+    if (buffer == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < buffer->count; i++)
+    {
+        deleteNode(tree, &buffer->nodes[i]);
     }
+    free(buffer->nodes);
+    free(buffer->scratch);
+    free(buffer->slots);
+    free(buffer);
+    tree->writeBuffer = NULL;
+}
 
-    fixingAlg(tree, newNode);
+// ---------- optimistic reads ----------
+int RBTreeSetOptimisticReads(RBTree *tree, int enabled)
+{
+    if (tree == NULL || (enabled && tree->writeBuffer != NULL))
+    {
+        return FAIL;
+    }
+    if (enabled && tree->seqlock == NULL)
+    {
+        tree->seqlock = (Seqlock *) calloc(1, sizeof(Seqlock));
+        return tree->seqlock != NULL;
+    }
+    if (!enabled && tree->seqlock != NULL)
+    {
+        RBTreeReclaim(tree);
+        free(tree->seqlock);
+        tree->seqlock = NULL;
+    }
     return SUCCESS;
 }
 
-int insertRegular(RBTree *tree, Node *newNode)
+size_t RBTreeReclaim(RBTree *tree)
 {
-    Node *treeNode = tree->root;
-    if (treeNode == NULL)
+    if (tree == NULL || tree->seqlock == NULL)
     {
-        tree->root = newNode;
-        tree->size++;
-        return SUCCESS;
+        return 0;
     }
+    // with the seqlock out of the way deleteNode and releaseNode free the nodes at once
+    Seqlock *seqlock = tree->seqlock;
+    tree->seqlock = NULL;
+    size_t freed = 0;
+    while (seqlock->deleted != NULL)
+    {
+        Node *node = seqlock->deleted;
+        seqlock->deleted = node->parent;
+        deleteNode(tree, &node);
+        freed++;
+    }
+    while (seqlock->released != NULL)
+    {
+        Node *node = seqlock->released;
+        seqlock->released = node->parent;
+        releaseNode(tree, &node);
+        freed++;
+    }
+    tree->seqlock = seqlock;
+    return freed;
+}
 
-    while (TRUE)
+void beginWrite(RBTree *tree)
+{
+    if (tree->seqlock != NULL)
+    {
+        // odd: readers that start now wait, readers that started already will see a new version
+        __atomic_store_n(&tree->seqlock->version, tree->seqlock->version + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+}
+
+void endWrite(RBTree *tree)
+{
+    if (tree->seqlock != NULL)
+    {
+        __atomic_store_n(&tree->seqlock->version, tree->seqlock->version + 1, __ATOMIC_RELEASE);
+    }
+}
+
+Node *optimisticFind(const RBTree *tree, const void *data)
+{
+    const long unsigned *version = &tree->seqlock->version;
+    for (;;)
     {
-        int next = whereToGo(tree->compFunc(newNode->data, treeNode->data));
-        bool turned = FALSE;
-        switch (next)
+        long unsigned before = __atomic_load_n(version, __ATOMIC_ACQUIRE);
+        if (before % 2 == 1)
         {
-            case RIGHT:
-                if (treeNode->right != NULL)
-                {
-                    treeNode = treeNode->right;
-                }
-                else
-                {
-                    newNode->parent = treeNode;
-                    treeNode->right = newNode;
-                    turned = TRUE;
-                }
+            continue;
+        }
+        // the links may change under the walk: each one is read once (with the node it points to,
+        // see SET_LINK), and nothing is written
+        Node *node = __atomic_load_n(&tree->root, __ATOMIC_ACQUIRE);
+        for (int depth = 0; node != NULL && depth < OPTIMISTIC_MAX_DEPTH; depth++)
+        {
+            int result = tree->compFunc(data, __atomic_load_n(&node->data, __ATOMIC_RELAXED));
+            if (result == 0)
+            {
                 break;
-            case LEFT:
-                if (treeNode->left != NULL)
-                {
-                    treeNode = treeNode->left;
-                }
-                else
+            }
+            node = result < 0 ? __atomic_load_n(&node->left, __ATOMIC_ACQUIRE)
+                              : __atomic_load_n(&node->right, __ATOMIC_ACQUIRE);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(version, __ATOMIC_RELAXED) == before)
+        {
+            return node;
+        }
+    }
+}
+
+void retire(Node **list, Node *node)
+{
+    node->parent = *list;
+    *list = node;
+}
+
+// --------------- clone ---------------
+RBTree *RBTreeClone(const RBTree *tree, CopyFunc copyFunc)
+{
+    return cloneTree(tree, copyFunc, 1);
+}
+
+RBTree *RBTreeCloneParallel(const RBTree *tree, CopyFunc copyFunc, int threads)
+{
+    return cloneTree(tree, copyFunc, threads);
+}
+
+RBTree *cloneTree(const RBTree *tree, CopyFunc copyFunc, int threads)
+{
+    if (tree == NULL)
+    {
+        return NULL;
+    }
+    // without copies the clone shares the items, so only the tree frees them
+    FreeFunc freeFunc = copyFunc != NULL || tree->kind == RB_STRING_SET ? tree->freeFunc : NULL;
+    RBTree *clone = newRBTree(tree->compFunc, freeFunc);
+    if (clone == NULL)
+    {
+        return NULL;
+    }
+    clone->kind = tree->kind, clone->nodeSize = tree->nodeSize;
+    clone->fingerSearch = tree->fingerSearch;
+    clone->balance = tree->balance, clone->augment = tree->augment;
+    if (tree->root == NULL)
+    {
+        return clone;
+    }
+    clone->blockBytes = tree->size * tree->nodeSize;
+    clone->nodeBlock = malloc(clone->blockBytes);
+    if (clone->nodeBlock == NULL)
+    {
+        freeRBTree(&clone);
+        return NULL;
+    }
+    STAT_ADD(clone, allocations, 1);
+
+#ifndef RBTREE_THREADS
+    threads = 1;
+#endif
+    // a string set copies its long keys into blocks of its own, which threads can't share
+    if (tree->kind == RB_STRING_SET)
+    {
+        threads = 1;
+    }
+    int depth = 0;
+    while (threads > 1 && depth < MAX_CLONE_SPLIT_DEPTH &&
+           ((size_t) 1 << depth) < (size_t) threads * CLONE_TASKS_PER_THREAD)
+    {
+        depth++;
+    }
+    CloneTask *tasks = (CloneTask *) malloc(sizeof(CloneTask) << depth);
+    if (tasks == NULL)
+    {
+        freeRBTree(&clone);
+        return NULL;
+    }
+    CloneTask whole = {tree, clone, copyFunc, tree->root, NULL, &clone->root,
+                       (char *) clone->nodeBlock, tree->size, 0, FALSE};
+    tasks[0] = whole;
+
+    // the top levels come first in the block, then every subtree below them in order
+    size_t topNodes = 0, count = 1;
+    bool copied = TRUE;
+    if (depth > 0)
+    {
+        count = splitClone(tasks, depth, &topNodes);
+        copied = count > 0 && runCloneTasks(tasks, count, threads, FALSE);
+        char *next = (char *) clone->nodeBlock + topNodes * tree->nodeSize;
+        for (size_t i = 0; copied && i < count; i++)
+        {
+            tasks[i].next = next;
+            next += tasks[i].nodes * tree->nodeSize;
+        }
+    }
+    copied = copied && runCloneTasks(tasks, count, threads, TRUE);
+    for (size_t i = 0; i < count; i++)
+    {
+        STAT_ADD(clone, allocations, tasks[i].allocations);
+    }
+    free(tasks);
+    if (!copied)
+    {
+        freeRBTree(&clone);
+        return NULL;
+    }
+    if (copyFunc != NULL && clone->augment != NULL)
+    {
+        augmentTop(clone, clone->root, depth);
+    }
+
+    clone->size = tree->size;
+    clone->min = clone->root, clone->max = clone->root;
+    while (clone->min->left != NULL)
+    {
+        clone->min = clone->min->left;
+    }
+    while (clone->max->right != NULL)
+    {
+        clone->max = clone->max->right;
+    }
+    return clone;
+}
+
+Node *cloneNode(CloneTask *task, const Node *source, Node *parent, Node **link)
+{
+    Node *copy = (Node *) task->next;
+    task->next += task->tree->nodeSize;
+    memcpy(copy, source, task->tree->nodeSize);
+    copy->parent = parent, copy->left = NULL, copy->right = NULL;
+    if (task->tree->kind == RB_STRING_SET)
+    {
+        copy->data = storeString(task->clone, (StringNode *) copy, (const char *) source->data);
+    }
+    else if (task->copyFunc != NULL)
+    {
+        copy->data = task->copyFunc(source->data);
+    }
+    if (copy->data == NULL)
+    {
+        return NULL;
+    }
+    *link = copy;
+    if (task->tree->kind != RB_MULTISET_CHAINED)
+    {
+        return copy;
+    }
+
+    Occurrence **tail = &((MultisetNode *) copy)->chain;
+    *tail = NULL;
+    const Occurrence *occurrence = ((const MultisetNode *) source)->chain;
+    for (; occurrence != NULL; occurrence = occurrence->next)
+    {
+        Occurrence *next = (Occurrence *) malloc(sizeof(Occurrence));
+        if (next == NULL)
+        {
+            return NULL;
+        }
+        next->data = task->copyFunc != NULL ? task->copyFunc(occurrence->data) : occurrence->data;
+        next->next = NULL;
+        if (next->data == NULL)
+        {
+            free(next);
+            return NULL;
+        }
+        *tail = next;
+        tail = &next->next;
+        task->allocations++;
+    }
+    return copy;
+}
+
+int cloneSubtree(CloneTask *task, const Node *source, Node *parent, Node **link)
+{
+    Node *copy = cloneNode(task, source, parent, link);
+    if (copy == NULL)
+    {
+        return FAIL;
+    }
+    if (source->left != NULL && !cloneSubtree(task, source->left, copy, &copy->left))
+    {
+        return FAIL;
+    }
+    if (source->right != NULL && !cloneSubtree(task, source->right, copy, &copy->right))
+    {
+        return FAIL;
+    }
+    // the copied node still holds what was worked out from the items of the tree
+    if (task->copyFunc != NULL && task->clone->augment != NULL)
+    {
+        task->clone->augment(copy);
+    }
+    return SUCCESS;
+}
+
+size_t splitClone(CloneTask *tasks, int depth, size_t *topNodes)
+{
+    CloneTask top = tasks[0];
+    size_t count = 1;
+    for (int level = 0; level < depth && count != 0; level++)
+    {
+        // expand in place from the end, so the tasks stay in ascending order
+        for (size_t i = count; i-- > 0;)
+        {
+            CloneTask task = tasks[i], left = task, right = task;
+            if (task.source != NULL)
+            {
+                Node *copy = cloneNode(&top, task.source, task.parent, task.link);
+                if (copy == NULL)
                 {
-                    newNode->parent = treeNode;
-                    treeNode->left = newNode;
-                    turned = TRUE;
+                    count = 0;
+                    break;
                 }
-                break;
-            default:
-                return FAIL;
+                left.source = task.source->left, right.source = task.source->right;
+                left.parent = copy, right.parent = copy;
+                left.link = &copy->left, right.link = &copy->right;
+            }
+            tasks[2 * i] = left;
+            tasks[2 * i + 1] = right;
+        }
+        count *= 2;
+    }
+    *topNodes = (size_t) (top.next - (char *) top.clone->nodeBlock) / top.tree->nodeSize;
+    STAT_ADD(top.clone, allocations, top.allocations);
+    return count;
+}
+
+void augmentTop(const RBTree *clone, Node *node, int levels)
+{
+    if (node == NULL || levels == 0)
+    {
+        return;
+    }
+    augmentTop(clone, node->left, levels - 1);
+    augmentTop(clone, node->right, levels - 1);
+    clone->augment(node);
+}
+
+size_t countNodes(const Node *node)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+    return 1 + countNodes(node->left) + countNodes(node->right);
+}
+
+void runCloneTask(CloneTask *task, bool copy)
+{
+    if (!copy)
+    {
+        task->nodes = countNodes(task->source);
+    }
+    else if (task->source != NULL)
+    {
+        task->failed = !cloneSubtree(task, task->source, task->parent, task->link);
+    }
+}
+
+#ifdef RBTREE_THREADS
+void *runCloneRange(void *args)
+{
+    CloneRange *range = (CloneRange *) args;
+    for (size_t i = range->first; i < range->count; i += range->step)
+    {
+        runCloneTask(&range->tasks[i], range->copy);
+    }
+    return NULL;
+}
+#endif
+
+#ifdef RBTREE_THREADS
+bool runCloneThreads(CloneTask *tasks, size_t count, int threads, bool copy)
+{
+    CloneRange *ranges = (CloneRange *) malloc(sizeof(CloneRange) * threads);
+    pthread_t *ids = (pthread_t *) malloc(sizeof(pthread_t) * threads);
+    if (ranges == NULL || ids == NULL)
+    {
+        free(ranges);
+        free(ids);
+        return FALSE;
+    }
+    for (int t = 0; t < threads; t++)
+    {
+        CloneRange range = {tasks, (size_t) t, count, (size_t) threads, copy, FALSE};
+        ranges[t] = range;
+        ranges[t].started = pthread_create(&ids[t], NULL, runCloneRange, &ranges[t]) == 0;
+        if (!ranges[t].started)
+        {
+            // no thread for it, so this one does its part
+            runCloneRange(&ranges[t]);
+        }
+    }
+    for (int t = 0; t < threads; t++)
+    {
+        if (ranges[t].started)
+        {
+            pthread_join(ids[t], NULL);
         }
-        if (turned)
+    }
+    free(ranges);
+    free(ids);
+    return TRUE;
+}
+#endif
+
+int runCloneTasks(CloneTask *tasks, size_t count, int threads, bool copy)
+{
+    bool ran = FALSE;
+#ifdef RBTREE_THREADS
+    ran = threads > 1 && runCloneThreads(tasks, count, threads, copy);
+#else
+    (void) threads;
+#endif
+    for (size_t i = 0; !ran && i < count; i++)
+    {
+        runCloneTask(&tasks[i], copy);
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (tasks[i].failed)
         {
-            break;
+            return FAIL;
         }
     }
-    tree->size++;
     return SUCCESS;
 }
 
-void fixingAlg(RBTree *tree, Node *node)
+// --------------- diff ---------------
+int RBTreeDiff(const RBTree *a, const RBTree *b, forEachFunc onAdded, forEachFunc onRemoved,
+               EqualFunc equalFunc, ChangeFunc onChanged, void *args)
 {
-    Node *toFix = node;
-    Node *dad;
-    Node *uncle;
-    while (TRUE)
+    if (a == NULL || b == NULL || a->kind != b->kind)
     {
-        // case 1 - if node is root
-        if (toFix == tree->root)
+        return FAIL;
+    }
+    // the trees never share nodes, so a tree is the only one that shares all of them
+    if (a == b)
+    {
+        return SUCCESS;
+    }
+
+    // merge the two in-order walks, like merging two sorted lists
+    const Node *before = a->min, *after = b->min;
+    while (before != NULL || after != NULL)
+    {
+        int result = before == NULL ? 1 : -1;
+        if (before != NULL && after != NULL)
         {
-            toFix->color = BLACK;
-            return;
+            result = COMPARE(a, before->data, after->data);
         }
-
-        // case 2 - parent is black
-        if (toFix->parent->color == BLACK)
+        if (result < 0)
         {
-            return;
+            if (onRemoved != NULL && !onRemoved(before->data, args))
+            {
+                return FAIL;
+            }
+            before = nextNode(before);
         }
-
-        dad = toFix->parent;
-        uncle = setBrother(dad);
-
-        // case 4 - black uncle
-        if (uncle == NULL || uncle->color == BLACK)
+        else if (result > 0)
         {
-            redDadBlackUncle(tree, toFix);
-            return;
+            if (onAdded != NULL && !onAdded(after->data, args))
+            {
+                return FAIL;
+            }
+            after = nextNode(after);
         }
-
-        // case 3 - red uncle
-        if (uncle->color == RED)
+        else
         {
-            redDadRedUncle(toFix);
-            toFix = toFix->parent->parent;
+            if (onChanged != NULL && nodesDiffer(a, before, after, equalFunc) &&
+                !onChanged((Node *) before, (Node *) after, args))
+            {
+                return FAIL;
+            }
+            before = nextNode(before), after = nextNode(after);
         }
     }
+    return SUCCESS;
 }
 
-void redDadRedUncle(Node *new)
+bool nodesDiffer(const RBTree *tree, const Node *before, const Node *after, EqualFunc equalFunc)
 {
-    Node *dad = new->parent;
-    Node *grandad = dad->parent;
-    Node *uncle = setBrother(dad);
-    dad->color = BLACK, uncle->color = BLACK;
-    grandad->color = RED;
+    if (IS_MULTISET(tree) &&
+        ((const MultisetNode *) before)->count != ((const MultisetNode *) after)->count)
+    {
+        return TRUE;
+    }
+    const void *first = before->data, *second = after->data;
+    if (tree->kind == RB_MAP)
+    {
+        first = ((const MapNode *) before)->value, second = ((const MapNode *) after)->value;
+    }
+    if (equalFunc == NULL)
+    {
+        return FALSE;
+    }
+    // the objects of a tree and of a clone that shares them tell it without calling anything
+    if (equalFunc == RBTreeSameObject)
+    {
+        return first != second;
+    }
+    return !equalFunc(first, second);
 }
 
-void redDadBlackUncle(RBTree *tree, Node *new)
+int RBTreeSameObject(const void *a, const void *b)
 {
-    Node *dad = new->parent;
-    Node *grandad = dad->parent;
-    bool turned = FALSE;
+    return a == b;
+}
 
-    // check if triangle
-    if (grandad->left != NULL)
-    {
-        if (new == grandad->left->right)
-        {
-            turnLeft(tree, dad);
-            new = dad;
-            dad = new->parent;
-            turned = TRUE;
-        }
-    }
-    if (grandad->right != NULL && !turned)
+// -------------- multiset --------------
+int addOccurrence(RBTree *tree, Node *node, void *data)
+{
+    MultisetNode *multi = (MultisetNode *) node;
+    switch (tree->kind)
     {
-        if (new == grandad->right->left)
+        case RB_MULTISET_COUNTED:
+            if (data != node->data && tree->freeFunc != NULL)
+            {
+                tree->freeFunc(data);
+            }
+            break;
+        case RB_MULTISET_CHAINED:
         {
-            turnRight(tree, dad);
-            new = dad;
-            dad = new->parent;
+            Occurrence *occurrence = (Occurrence *) malloc(sizeof(Occurrence));
+            if (occurrence == NULL)
+            {
+                return FAIL;
+            }
+            STAT_ADD(tree, allocations, 1);
+            occurrence->data = data;
+            occurrence->next = multi->chain;
+            multi->chain = occurrence;
+            break;
         }
+        default:
+            return FAIL;
     }
-    turned = FALSE;
+    multi->count++;
+    return SUCCESS;
+}
 
-    // fixing line
-    if (grandad->left != NULL)
+bool removeOccurrence(RBTree *tree, Node *node)
+{
+    MultisetNode *multi = (MultisetNode *) node;
+    if (!IS_MULTISET(tree) || multi->count <= 1)
     {
-        if (new == grandad->left->left)
-        {
-            turnRight(tree, grandad);
-            turned = TRUE;
-        }
+        return FALSE;
     }
-    if (grandad->right != NULL && !turned)
+    if (tree->kind == RB_MULTISET_CHAINED)
     {
-        if (new == grandad->right->right)
+        Occurrence *occurrence = multi->chain;
+        multi->chain = occurrence->next;
+        if (tree->freeFunc != NULL)
         {
-            turnLeft(tree, grandad);
+            tree->freeFunc(occurrence->data);
         }
+        free(occurrence);
+        STAT_ADD(tree, frees, 1);
     }
-    dad->color = BLACK;
-    grandad->color = RED;
+    multi->count--;
+    return TRUE;
 }
 
-// --------------- delete ---------------
-int deleteFromRBTree(RBTree *tree, void *data)
+long unsigned RBTreeCount(const RBTree *tree, const void *data)
 {
     if (data == NULL || tree == NULL)
     {
-        return FAIL;
+        return 0;
     }
-
-    Node *M = findNode(tree, data);
-    // not in tree
-    if (M == NULL)
+    Node *node = findNode(tree, data);
+    if (node == NULL)
     {
-        return FAIL;
+        return 0;
     }
-
-    // is M: leaf / has 1 child / has 2 kids
-    int kids = howManyKIds(M);
-    if (kids == TWO_KIDS)
+    if (IS_MULTISET(tree))
     {
-        Node *MSuccessor = successor(M);
-        swapData(M, MSuccessor);
-        M = MSuccessor;
+        return ((MultisetNode *) node)->count;
     }
+    return 1;
+}
 
-    Node *C = setC(M);
-    // case 1
-    if (M->color == RED)
+int forEachOccurrenceRBTree(const RBTree *tree, forEachFunc func, void *args)
+{
+    if (tree == NULL)
     {
-        putCInM(C, M);
-        deleteNode(&M, tree->freeFunc);
-        tree->size--;
-        return SUCCESS;
+        return FAIL;
     }
-
-    // case 2
-    if (C != NULL && C->color == RED)
+    if (!IS_MULTISET(tree))
     {
-        // check if m was root
-        if (M == tree->root)
-        {
-            tree->root = C;
-        }
-        putCInM(C, M);
-        deleteNode(&M, tree->freeFunc);
-        C->color = BLACK;
-        tree->size--;
-        return SUCCESS;
+        return forEachRBTree(tree, func, args);
     }
-
-    // case 3
-    blackMAndC(tree, M);
-
-    tree->size--;
+    FunctionReturn failOrNah = forEachOccurrenceHelper(tree, tree->root, func, args);
+    CHECK_FAIL
     return SUCCESS;
 }
 
-void blackMAndC(RBTree *tree, Node *M)
+int forEachOccurrenceHelper(const RBTree *tree, const Node *node, forEachFunc func, void *args)
 {
-    Node *C = setC(M);
-    Node *P = M->parent;
-
-    // a - is root
-    if (M == tree->root)
+    if (node == NULL)
     {
-        tree->root = NULL;
-        deleteNode(&M, tree->freeFunc);
-        return;
+        return SUCCESS;
     }
-
-    Node *S = setBrother(M);
-    putCInM(C, M);
-    deleteNode(&M, tree->freeFunc);
-    LeftOrRightChild side;
-
-    while (TRUE)
+    const MultisetNode *multi = (const MultisetNode *) node;
+    FunctionReturn failOrNah;
+    failOrNah = forEachOccurrenceHelper(tree, node->left, func, args);
+    CHECK_FAIL
+    failOrNah = func(node->data, args);
+    CHECK_FAIL
+    if (tree->kind == RB_MULTISET_CHAINED)
     {
-        side = setCSide(S);
-
-        if (S->color == BLACK)
+        for (const Occurrence *occurrence = multi->chain; occurrence != NULL; occurrence = occurrence->next)
         {
-            // b - S and its two sons are black
-            if (hasTwoBlackKids(S))
-            {
-                S->color = RED;
-                // i - P is red
-                if (P->color == RED)
-                {
-                    P->color = BLACK;
-                    return;
-                }
-                // ii - P is black
-                C = P;
-                if (C == tree->root)
-                {
-                    return;
-                }
-                P = C->parent;
-                S = setBrother(C);
-                continue;
-            }
-
-            // d - S and Sf are black, Sc is red
-            else if (redScBlackSf(S, side))
-            {
-                blackSAndSfRedSc(tree, S);
-                S = S->parent;
-                continue;
-            }
-
-            // e - S is black, Sf is red
-            if (!redScBlackSf(S, side))
-            {
-                blackSRedSf(tree, S);
-                return;
-            }
+            failOrNah = func(occurrence->data, args);
+            CHECK_FAIL
         }
-
-        // c - S is red
-        else
+    }
+    else
+    {
+        for (long unsigned i = 1; i < multi->count; i++)
         {
-            swapColor(S, P);
-            switch (side)
-            {
-                case RIGHT:
-                    S = S->right;
-                    turnRight(tree, P);
-                    break;
-                case LEFT:
-                    S = S->left;
-                    turnLeft(tree, P);
-                    break;
-                default:
-                    break;
-            }
+            failOrNah = func(node->data, args);
+            CHECK_FAIL
         }
     }
+    failOrNah = forEachOccurrenceHelper(tree, node->right, func, args);
+    CHECK_FAIL
+    return SUCCESS;
 }
 
-bool redScBlackSf(const Node *S, LeftOrRightChild side)
+// ---------------- map ----------------
+int RBMapPut(RBTree *map, void *key, void *value)
 {
-    switch (side)
+    if (map == NULL || key == NULL || map->kind != RB_MAP)
     {
-        case RIGHT:
-            if (S->right == NULL)
-            {
-                return FALSE;
-            }
-            if (S->right->color == RED)
-            {
-                if (S->left == NULL || S->left->color == BLACK)
-                {
-                    return TRUE;
-                }
-            }
-            return FALSE;
-        case LEFT:
-            if (S->left == NULL)
-            {
-                return FALSE;
-            }
-            if (S->left->color == RED)
-            {
-                if (S->right == NULL || S->right->color == BLACK)
-                {
-                    return TRUE;
-                }
-            }
-            return FALSE;
-        default:
-            return FALSE;
+        return FAIL;
+    }
+    LeftOrRightChild side;
+    Node *node = locateToWrite(map, key, &side);
+    if (node != NULL && side == ROOT)
+    {
+        if (key != node->data && map->freeFunc != NULL)
+        {
+            map->freeFunc(key);
+        }
+        setValue(map, (MapNode *) node, value);
+        return SUCCESS;
     }
-}
 
-bool hasTwoBlackKids(Node *node)
-{
-    int kids = howManyKIds(node);
-    switch (kids)
+    Node *new = newNode(map, key);
+    if (new == NULL)
     {
-        case ZERO_KIDS:
-            return TRUE;
-        case ONE_KID:
-            return FALSE;
-        default:
-            if (node->left->color == BLACK && node->right->color == BLACK)
-            {
-                return TRUE;
-            }
-            else
-            {
-                return FALSE;
-            }
+        return FAIL;
     }
+    ((MapNode *) new)->value = value;
+    linkNode(map, new, node, side);
+    return SUCCESS;
 }
 
-int howManyKIds(const Node *node)
+int RBMapGet(const RBTree *map, const void *key, void **value)
 {
-    // check if leaf
-    if (node->left == NULL && node->right == NULL)
+    if (map == NULL || key == NULL || map->kind != RB_MAP)
     {
-        return ZERO_KIDS;
+        return FAIL;
     }
-    if (node->left != NULL && node->right != NULL)
+    Node *node = findNode(map, key);
+    if (node == NULL)
     {
-        return TWO_KIDS;
+        return FAIL;
     }
-    return ONE_KID;
+    if (value != NULL)
+    {
+        *value = ((MapNode *) node)->value;
+    }
+    return SUCCESS;
 }
 
-Node *findNode(RBTree *tree, const void *data)
+void **RBMapValue(RBHandle handle)
 {
-    Node *treeNode = tree->root;
-    while (treeNode != NULL)
+    if (handle == NULL)
     {
-        int next = whereToGo(tree->compFunc(data, treeNode->data));
-        switch (next)
-        {
-            case RIGHT:
-                treeNode = treeNode->right;
-                break;
-            case LEFT:
-                treeNode = treeNode->left;
-                break;
-            default:
-                return treeNode;
-        }
+        return NULL;
     }
-    return NULL;
+    return &((MapNode *) handle)->value;
 }
 
-Node *successor(const Node *node)
+int RBMapUpdate(RBTree *map, const void *key, void *value)
 {
-    Node *successor = node->right;
-    while (successor->left != NULL)
+    if (map == NULL || key == NULL || map->kind != RB_MAP)
     {
-        successor = successor->left;
+        return FAIL;
     }
-    return successor;
+    MapNode *node = (MapNode *) findNode(map, key);
+    if (node == NULL)
+    {
+        return FAIL;
+    }
+    setValue(map, node, value);
+    return SUCCESS;
 }
 
-void swapData(Node *a, Node *b)
+void setValue(RBTree *map, MapNode *node, void *value)
 {
-    void *temp = a->data;
-    a->data = b->data;
-    b->data = temp;
+    if (node->value != value && map->valueFreeFunc != NULL)
+    {
+        map->valueFreeFunc(node->value);
+    }
+    node->value = value;
 }
 
-void swapColor(Node *a, Node *b)
+// ------------- string set -------------
+RBTree *newRBStringSet(void)
 {
-    Color temp = a->color;
-    a->color = b->color;
-    b->color = temp;
+    RBTree *set = newRBTree(compareStrings, NULL);
+    if (set == NULL)
+    {
+        return NULL;
+    }
+    set->kind = RB_STRING_SET, set->nodeSize = sizeof(StringNode);
+    return set;
 }
 
-Node *setC(Node *M)
+const char *RBStringSetIntern(RBTree *set, const char *key)
 {
-    if (M->right != NULL)
+    if (set == NULL || key == NULL || set->kind != RB_STRING_SET)
     {
-        return M->right;
+        return NULL;
     }
-    return M->left;
+    LeftOrRightChild side;
+    Node *parent = locateToWrite(set, key, &side);
+    if (parent != NULL && side == ROOT)
+    {
+        return (const char *) parent->data;
+    }
+    // the set copies the key, it never writes to the caller's string
+    Node *node = newNode(set, (void *) key);
+    if (node == NULL)
+    {
+        return NULL;
+    }
+    linkNode(set, node, parent, side);
+    return (const char *) node->data;
 }
 
-LeftOrRightChild setCSide(Node *S)
+int compareStrings(const void *a, const void *b)
 {
-    LeftOrRightChild side = isRightLeftChildOrRoot(S);
-    if (side == RIGHT)
+    return strcmp((const char *) a, (const char *) b);
+}
+
+char *storeString(RBTree *set, StringNode *node, const char *key)
+{
+    size_t size = strlen(key) + 1;
+    if (size <= RB_INLINE_STRING)
     {
-        return LEFT;
+        return memcpy(node->copy.key, key, size);
     }
-    return RIGHT;
+    StringBlock *block = set->strings;
+    if (block == NULL || block->used + size > block->capacity)
+    {
+        size_t capacity = size > STRING_BLOCK_SIZE ? size : STRING_BLOCK_SIZE;
+        StringBlock *fresh = (StringBlock *) malloc(sizeof(StringBlock) + capacity);
+        if (fresh == NULL)
+        {
+            return NULL;
+        }
+        fresh->used = 0, fresh->capacity = capacity, fresh->keys = 0;
+        // only the first block takes new keys, so the one with more room left stays first
+        if (block != NULL && block->capacity - block->used > capacity - size)
+        {
+            fresh->prev = block, fresh->next = block->next;
+            block->next = fresh;
+        }
+        else
+        {
+            fresh->prev = NULL, fresh->next = block;
+            set->strings = fresh;
+        }
+        if (fresh->next != NULL)
+        {
+            fresh->next->prev = fresh;
+        }
+        block = fresh;
+    }
+    char *copy = block->bytes + block->used;
+    block->used += size;
+    block->keys++;
+    node->copy.block = block;
+    return memcpy(copy, key, size);
 }
 
-void blackSAndSfRedSc(RBTree *tree, Node *S)
+void releaseString(RBTree *set, StringNode *node)
 {
-    LeftOrRightChild side = setCSide(S);
-    S->color = RED;
-    Node *Sc = NULL;
-    switch (side)
+    if (node->node.data == node->copy.key)
     {
-        case RIGHT:
-            Sc = S->right;
-            Sc->color = BLACK;
-            turnLeft(tree, S);
-            break;
-        case LEFT:
-            Sc = S->left;
-            Sc->color = BLACK;
-            turnRight(tree, S);
-            break;
-        default:
-            break;
+        return;
     }
+    StringBlock *block = node->copy.block;
+    block->keys--;
+    if (block->keys != 0)
+    {
+        return;
+    }
+    if (block == set->strings)
+    {
+        block->used = 0;
+        return;
+    }
+    block->prev->next = block->next;
+    if (block->next != NULL)
+    {
+        block->next->prev = block->prev;
+    }
+    free(block);
 }
 
-void blackSRedSf(RBTree *tree, Node *S)
+void freeStringBlocks(RBTree *set)
 {
-    LeftOrRightChild side = setCSide(S);
-    Node *P = S->parent;
-    Node *Sf = NULL;
-    swapColor(S, P);
-    switch (side)
+    while (set->strings != NULL)
     {
-        case RIGHT:
-            Sf = S->left;
-            turnRight(tree, P);
-            break;
-        case LEFT:
-            Sf = S->right;
-            turnLeft(tree, P);
-            break;
-        default:
-            break;
+        StringBlock *next = set->strings->next;
+        free(set->strings);
+        set->strings = next;
     }
-    Sf->color = BLACK;
 }
 
-void putCInM(Node *C, Node *M)
+// -------------- interval --------------
+RBTree *newRBIntervalTree(CompareFunc compFunc, FreeFunc freeFunc)
 {
-    LeftOrRightChild side = isRightLeftChildOrRoot(M);
-    // set C as M's parent child
-    switch (side)
+    return newRBAugmentedTree(compFunc != NULL ? compFunc : compareIntervals, freeFunc,
+                              sizeof(IntervalNode), updateMaxHigh);
+}
+
+void *RBIntervalOverlaps(const RBTree *tree, double low, double high)
+{
+    if (tree == NULL || tree->augment != updateMaxHigh)
     {
-        case RIGHT:
-            M->parent->right = C;
-            break;
-        case LEFT:
-            M->parent->left = C;
-            break;
-        default:
-            break;
+        return NULL;
+    }
+    // the leftmost overlap: go left whenever the left subtree reaches low, since everything
+    // there starts before the node does
+    const Node *node = tree->root;
+    while (node != NULL)
+    {
+        const Node *left = node->left;
+        if (left != NULL && ((const IntervalNode *) left)->maxHigh >= low)
+        {
+            node = left;
+            continue;
+        }
+        const RBInterval *interval = (const RBInterval *) node->data;
+        if (intervalsOverlap(interval, low, high))
+        {
+            return node->data;
+        }
+        if (interval->low > high)
+        {
+            // the right subtree starts even later
+            return NULL;
+        }
+        node = node->right;
     }
+    return NULL;
+}
 
-    // set C's parent to be M's parent
-    if (C != NULL)
+int forEachOverlapping(const RBTree *tree, double low, double high, forEachFunc func, void *args)
+{
+    if (tree == NULL || tree->augment != updateMaxHigh)
     {
-        C->parent = M->parent;
+        return FAIL;
     }
+    return forEachOverlappingHelper(tree->root, low, high, func, args);
 }
 
-void deleteNode(Node **M, FreeFunc func)
+int forEachOverlappingHelper(const Node *node, double low, double high, forEachFunc func,
+                             void *args)
 {
-    func((*M)->data);
-    free(*M);
-    *M = NULL;
+    if (node == NULL || ((const IntervalNode *) node)->maxHigh < low)
+    {
+        return SUCCESS;
+    }
+    FunctionReturn failOrNah = forEachOverlappingHelper(node->left, low, high, func, args);
+    CHECK_FAIL
+    const RBInterval *interval = (const RBInterval *) node->data;
+    if (interval->low > high)
+    {
+        // neither the node nor its right subtree starts in time
+        return SUCCESS;
+    }
+    if (intervalsOverlap(interval, low, high))
+    {
+        failOrNah = func(node->data, args);
+        CHECK_FAIL
+    }
+    return forEachOverlappingHelper(node->right, low, high, func, args);
 }
 
-// --------------- search ---------------
-int RBTreeContains(const RBTree *tree, const void *data)
+int compareIntervals(const void *a, const void *b)
 {
-    if (data == NULL || tree == NULL)
+    const RBInterval *first = (const RBInterval *) a, *second = (const RBInterval *) b;
+    if (first->low != second->low)
     {
-        return FALSE;
+        return first->low < second->low ? -1 : 1;
     }
-    Node *treeNode = tree->root;
+    if (first->high != second->high)
+    {
+        return first->high < second->high ? -1 : 1;
+    }
+    return 0;
+}
 
-    while (treeNode != NULL)
+void updateMaxHigh(Node *node)
+{
+    IntervalNode *intervalNode = (IntervalNode *) node;
+    intervalNode->maxHigh = ((const RBInterval *) node->data)->high;
+    Node *kids[] = {node->left, node->right};
+    for (int i = 0; i < 2; i++)
     {
-        int next = whereToGo(tree->compFunc(data, treeNode->data));
-        if (next == ROOT)
-        {
-            return TRUE;
-        }
-        if (next == RIGHT)
-        {
-            treeNode = treeNode->right;
-        }
-        else if (next == LEFT)
+        IntervalNode *kid = (IntervalNode *) kids[i];
+        if (kid != NULL && kid->maxHigh > intervalNode->maxHigh)
         {
-            treeNode = treeNode->left;
+            intervalNode->maxHigh = kid->maxHigh;
         }
     }
-    return FALSE;
+}
+
+bool intervalsOverlap(const RBInterval *interval, double low, double high)
+{
+    return interval->low <= high && low <= interval->high ? TRUE : FALSE;
 }
 
 // ------------- tree func -------------
@@ -959,12 +3941,23 @@ void freeRBTree(RBTree **tree)
     {
         return;
     }
-    freeHelper(&(*tree)->root, (*tree)->freeFunc);
+    freeWriteBuffer(*tree);
+    RBTreeSetOptimisticReads(*tree, FALSE);
+    freeHelper(*tree, &(*tree)->root);
+    if ((*tree)->nodeBlock != NULL)
+    {
+        free((*tree)->nodeBlock);
+        STAT_ADD(*tree, frees, 1);
+    }
+    freeStringBlocks(*tree);
+    freeHashIndex(&(*tree)->hashIndex);
+    freeBloomFilter(&(*tree)->bloom);
+    free((*tree)->stats);
     free(*tree);
     *tree = NULL;
 }
 
-void freeHelper(Node **node, FreeFunc func)
+void freeHelper(RBTree *tree, Node **node)
 {
     if (node == NULL)
     {
@@ -974,7 +3967,150 @@ void freeHelper(Node **node, FreeFunc func)
     {
         return;
     }
-    freeHelper(&((*node)->left), func);
-    freeHelper(&((*node)->right), func);
-    deleteNode(node, func);
+    freeHelper(tree, &((*node)->left));
+    freeHelper(tree, &((*node)->right));
+    deleteNode(tree, node);
+}
+
+// ---------------- memory ----------------
+RBMemoryStats RBTreeMemoryStats(const RBTree *tree, SizeFunc sizeFn)
+{
+    RBMemoryStats stats;
+    memset(&stats, 0, sizeof(RBMemoryStats));
+    if (tree == NULL)
+    {
+        return stats;
+    }
+
+    stats.nodes = tree->size;
+    stats.treeBytes = sizeof(RBTree) + (tree->stats != NULL ? sizeof(RBTreeStats) : 0);
+    stats.nodeBytes = tree->size * tree->nodeSize;
+    while (((long unsigned) 1 << stats.optimalHeight) <= tree->size)
+    {
+        stats.optimalHeight++;
+    }
+    if (tree->root == NULL)
+    {
+        return stats;
+    }
+
+    // pre-order walk over the parent pointers, coming from the parent means a first visit
+    const Node *node = tree->root, *from = NULL, *loose = NULL;
+    long unsigned inBlock = 0;
+    int depth = 1;
+    while (node != NULL)
+    {
+        const Node *next;
+        if (from == node->parent)
+        {
+            if ((uintptr_t) node - (uintptr_t) tree->nodeBlock < tree->blockBytes)
+            {
+                inBlock++;
+            }
+            else
+            {
+                loose = node;
+            }
+            if (sizeFn != NULL && tree->kind != RB_STRING_SET)
+            {
+                stats.payloadBytes += sizeFn(node->data);
+            }
+            const void *value = tree->kind == RB_MAP ? ((const MapNode *) node)->value : NULL;
+            if (sizeFn != NULL && value != NULL)
+            {
+                stats.payloadBytes += sizeFn(value);
+            }
+            if (tree->kind == RB_MULTISET_CHAINED)
+            {
+                const Occurrence *occurrence = ((const MultisetNode *) node)->chain;
+                for (; occurrence != NULL; occurrence = occurrence->next)
+                {
+                    stats.payloadBytes += sizeof(Occurrence);
+                    stats.payloadBytes += sizeFn != NULL ? sizeFn(occurrence->data) : 0;
+                }
+            }
+            if (depth > stats.height)
+            {
+                stats.height = depth;
+            }
+            if (node->left != NULL)
+            {
+                from = node, node = node->left, depth++;
+                continue;
+            }
+            from = node->left;
+        }
+        if (from == node->left && node->right != NULL)
+        {
+            from = node, node = node->right, depth++;
+            continue;
+        }
+        next = node->parent;
+        from = node, node = next, depth--;
+    }
+
+    // a clone's block is a single allocation, the slots of its deleted nodes are slack in it
+    if (tree->nodeBlock != NULL)
+    {
+        stats.allocatorOverhead = sizeof(size_t);
+        stats.slackBytes = tree->blockBytes - inBlock * tree->nodeSize;
+    }
+    if (loose != NULL)
+    {
+        // all the nodes have the same size, so one of them tells how the allocator rounds them
+#ifdef __GLIBC__
+        size_t usable = malloc_usable_size((void *) loose);
+#else
+        size_t usable = (tree->nodeSize + 2 * sizeof(size_t) - 1) / (2 * sizeof(size_t)) *
+                        (2 * sizeof(size_t));
+#endif
+        stats.allocatorOverhead += (tree->size - inBlock) * sizeof(size_t);
+        stats.slackBytes += (tree->size - inBlock) * (usable - tree->nodeSize);
+    }
+    stats.allocatorBytes = stats.nodeBytes + stats.allocatorOverhead + stats.slackBytes;
+
+    // a string set's short keys are part of its nodes, the long ones fill its blocks
+    const StringBlock *block = tree->strings;
+    for (; block != NULL; block = block->next)
+    {
+        stats.payloadBytes += sizeof(StringBlock) + block->capacity;
+    }
+    return stats;
+}
+
+// ---------------- stats ----------------
+int RBTreeGetStats(const RBTree *tree, RBTreeStats *stats)
+{
+    if (stats == NULL)
+    {
+        return FAIL;
+    }
+    memset(stats, 0, sizeof(RBTreeStats));
+#ifdef RBTREE_STATS
+    if (tree == NULL)
+    {
+        return FAIL;
+    }
+    *stats = *tree->stats;
+    if (stats->descents != 0)
+    {
+        stats->averageDepth = (double) stats->totalDepth / (double) stats->descents;
+    }
+    return SUCCESS;
+#else
+    (void) tree;
+    return FAIL;
+#endif
+}
+
+void RBTreeResetStats(RBTree *tree)
+{
+#ifdef RBTREE_STATS
+    if (tree != NULL)
+    {
+        memset(tree->stats, 0, sizeof(RBTreeStats));
+    }
+#else
+    (void) tree;
+#endif
 }
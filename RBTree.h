@@ -1,6 +1,8 @@
 #ifndef RBTREE_RBTREE_H
 #define RBTREE_RBTREE_H
 
+#include <stddef.h>
+
 // a color of a Node.
 typedef enum Color
 {
@@ -28,18 +30,160 @@ typedef int (*forEachFunc)(const void *object, void *args);
  */
 typedef void (*FreeFunc)(void *data);
 
+/**
+ * a function to hash a data item, for the hash index of a tree.
+ * @data: a pointer to an item of the tree.
+ * @return: the hash, equal for every two items the tree's CompareFunc finds equal.
+ */
+typedef size_t (*HashFunc)(const void *data);
+
+struct Node;
+struct StringBlock;
+struct HashIndex;
+struct BloomFilter;
+struct WriteBuffer;
+struct Seqlock;
+
+/**
+ * a function to tell whether two items (or two values of a map) are the same, for RBTreeDiff.
+ * @a: the item in the first tree, @b: the item the tree's CompareFunc finds equal in the second.
+ * @return: 0 if they differ, other if they are the same.
+ */
+typedef int (*EqualFunc)(const void *a, const void *b);
+
+/**
+ * a function to apply on an item that changed between two trees (see RBTreeDiff).
+ * @before: the handle (see RBHandle) of the item in the first tree.
+ * @after: the handle of the equal item in the second tree.
+ * @args: pointer to other arguments for the function.
+ * @return: 0 on failure, other on success.
+ */
+typedef int (*ChangeFunc)(struct Node *before, struct Node *after, void *args);
+
+/**
+ * a function that keeps extra information about a subtree in its root (e.g. the largest value in
+ * it). it is called on a node whenever its children may have changed, after they were updated.
+ * @node: the node to update, the first member of a larger struct of the tree's nodeSize.
+ */
+typedef void (*AugmentFunc)(struct Node *node);
+
+/**
+ * a function to measure the memory a data item owns, e.g. its name or vector array.
+ * @data: a pointer to an item of the tree.
+ * @return: the number of bytes the item uses (including the item itself).
+ */
+typedef size_t (*SizeFunc)(const void *data);
+
+/**
+ * a function to copy an item for a clone of a tree (see RBTreeClone).
+ * @data: a pointer to an item of the tree.
+ * @return: the copy, or NULL on failure.
+ */
+typedef void *(*CopyFunc)(const void *data);
+
 /**
  * a node of the tree.
+ * color is used by red black trees, rank by WAVL trees (it fits in the padding after color).
  */
 typedef struct Node
 {
 	struct Node *parent, *left, *right;
 	Color color;
+	int rank;
 	void *data;
 } Node;
 
+/**
+ * operation counters of a tree. they are only collected when the library is compiled with
+ * -DRBTREE_STATS, otherwise the counting code is compiled out completely.
+ */
+typedef struct RBTreeStats
+{
+	long unsigned comparisons;
+	long unsigned leftRotations, rightRotations;
+	long unsigned recolors; // rank changes in a WAVL tree
+	long unsigned allocations, frees;
+	long unsigned descents;
+	long unsigned totalDepth, maxDepth;
+	double averageDepth;
+} RBTreeStats;
+
+/**
+ * the memory footprint of a tree.
+ * nodeBytes are the bytes the nodes ask for, allocatorBytes the bytes the allocator really holds
+ * for them: its per-chunk headers (allocatorOverhead) and the rounding up of the chunks (slack).
+ * height is the longest root-to-leaf path, optimalHeight the height of a perfectly balanced tree.
+ */
+typedef struct RBMemoryStats
+{
+	long unsigned nodes;
+	size_t treeBytes;
+	size_t nodeBytes;
+	size_t allocatorOverhead, slackBytes, allocatorBytes;
+	size_t payloadBytes;
+	int height, optimalHeight;
+} RBMemoryStats;
+
+/**
+ * the counters of a bloom filter.
+ * checks: the lookups the filter was asked about. rejected: the ones it answered "not in the tree"
+ * without touching the tree. falsePositives: the ones it let through although the item was not
+ * in the tree. falsePositiveRate: the share of the misses it let through.
+ * bytes: the size of the filter's bit array.
+ */
+typedef struct RBBloomStats
+{
+	long unsigned checks, rejected, falsePositives;
+	double falsePositiveRate;
+	size_t bytes;
+} RBBloomStats;
+
+/**
+ * the kind of a tree: a set of items, a map where each node also carries a value, or a multiset
+ * where equal items share a single node. a counted multiset keeps the first item and counts the
+ * equal ones (freeing them), a chained multiset keeps all of them chained off the node.
+ * a string set keeps its own copies of C string keys (see newRBStringSet).
+ */
+typedef enum RBTreeKind
+{
+	RB_SET, RB_MAP, RB_MULTISET_COUNTED, RB_MULTISET_CHAINED, RB_STRING_SET
+} RBTreeKind;
+
+/**
+ * the longest key (with its terminating null) a string set keeps inside the node itself.
+ * a Node and the key fill a 64 byte cache line.
+ */
+#define RB_INLINE_STRING 24
+
+/**
+ * how a tree keeps itself balanced.
+ * RB_BALANCE_RED_BLACK: the classic red black rules.
+ * RB_BALANCE_WAVL: weak AVL rank rules - every child is 1 or 2 ranks below its parent (a missing
+ * child has rank -1) and leaves have rank 0. without deletes it is an AVL tree, so it stays
+ * shallower than a red black one, and every insert or delete does at most two rotations.
+ */
+typedef enum RBBalance
+{
+	RB_BALANCE_RED_BLACK, RB_BALANCE_WAVL
+} RBBalance;
+
 /**
  * represents the tree
+ * size: the number of nodes, i.e. of distinct items in a multiset.
+ * min, max: the leftmost and rightmost nodes (NULL if the tree is empty).
+ * finger: the last node accessed, where searches start when fingerSearch is on (may be NULL).
+ * nodeSize: the size of the tree nodes. the variants that store more per node (e.g. the map value)
+ * allocate a larger struct that starts with a Node.
+ * augment: updates the subtree information of a node in an augmented tree (NULL for other trees).
+ * strings: the blocks holding the long keys of a string set (NULL for other trees).
+ * hashIndex: the hash index of the nodes, if one was set (see RBTreeSetHashIndex).
+ * bloom: the bloom filter of the items, if one was set (see RBTreeSetBloomFilter).
+ * writeBuffer: the items inserted but not merged into the tree yet (see RBTreeSetWriteBuffer).
+ * seqlock: the version and the removed nodes of a tree read optimistically (see
+ * RBTreeSetOptimisticReads).
+ * nodeBlock: the single allocation of the nodes of a clone, blockBytes long (see RBTreeClone).
+ * stats: the operation counters, NULL unless the library is compiled with -DRBTREE_STATS (behind a
+ * pointer, so the layout of the struct doesn't depend on the build).
  */
 typedef struct RBTree
 {
@@ -47,6 +191,22 @@ typedef struct RBTree
 	CompareFunc compFunc;
 	FreeFunc freeFunc;
 	long unsigned size;
+	RBTreeKind kind;
+	size_t nodeSize;
+	FreeFunc valueFreeFunc;
+	Node *min, *max;
+	Node *finger;
+	int fingerSearch;
+	RBBalance balance;
+	AugmentFunc augment;
+	struct StringBlock *strings;
+	struct HashIndex *hashIndex;
+	struct BloomFilter *bloom;
+	struct WriteBuffer *writeBuffer;
+	struct Seqlock *seqlock;
+	void *nodeBlock;
+	size_t blockBytes;
+	RBTreeStats *stats;
 } RBTree;
 
 /**
@@ -79,6 +239,191 @@ int deleteFromRBTree(RBTree *tree, void *data); // implement it in RBTree.c
  */
 int RBTreeContains(const RBTree *tree, const void *data); // implement it in RBTree.c
 
+/**
+ * check a batch of items at once. the lookups walk down the tree side by side and prefetch the
+ * next node of each, so their cache misses overlap instead of waiting for one another. it pays
+ * off for large batches on trees that don't fit in the cache. the finger is not used or moved.
+ * @param tree: the tree to search.
+ * @param keys: the items to check (a NULL item is never in the tree).
+ * @param n: the number of items.
+ * @param results: filled with 0 for every item that is not in the tree, other if it is.
+ * @return: 0 on failure, other on success.
+ */
+int RBTreeContainsBatch(const RBTree *tree, const void *const *keys, size_t n, int *results);
+
+/**
+ * turn finger search on or off. with it, the tree remembers the last node an insert or delete (or
+ * RBMapPut...) reached, and every search - lookups too - climbs up from there and back down,
+ * instead of starting at the root. lookups don't move the finger, so they never write to the tree.
+ * an item d items away from the finger usually costs O(log d) comparisons, but the climb goes up
+ * to the root when a node high in the tree lies between them, so the worst case stays O(log n).
+ * it pays off when the items arrive nearly sorted, and costs a few comparisons when they don't.
+ * @param tree: the tree.
+ * @param enabled: 0 to turn it off, other to turn it on.
+ */
+void RBTreeSetFinger(RBTree *tree, int enabled);
+
+/**
+ * give the tree a hash index of its nodes, or remove it. the index is an open addressing hash
+ * table that insert and delete keep in sync with the tree. with it, the point lookups (contains,
+ * find, the batches, delete, RBMapGet...) hash the item and usually need a single comparison,
+ * while the ordered operations keep using the tree. it costs 16 bytes per node (at least - the
+ * table is at most half full) and a hash on every insert and delete. if the table can't grow on
+ * an insert, the index is dropped and lookups go back to the tree.
+ * @param tree: the tree.
+ * @param hashFunc: hashes the items, NULL to remove the index.
+ * @return: 0 on failure (the tree is left without an index), other on success.
+ */
+int RBTreeSetHashIndex(RBTree *tree, HashFunc hashFunc);
+
+/**
+ * give the tree a blocked bloom filter of its items, or remove it. the point lookups (contains,
+ * find, the batches, delete...) ask the filter first, and an item it rejects costs a hash and a
+ * single cache line instead of a walk to a leaf. inserts add their items to the filter, which
+ * doubles when the tree outgrows it. deleted items stay in it until it is rebuilt, which happens
+ * by itself once the deletes since the last build pass a quarter of the size of the tree (and
+ * shrinks the filter, if the tree shrank to a quarter of what it was sized for).
+ * the filter has at least bitsPerItem bits per item (it is rounded up to a power of 2 blocks).
+ * a blocked filter has a little more false positives than a classic one of the same size, for a
+ * single cache miss per lookup.
+ * if the filter can't grow, it is dropped and lookups go to the tree directly.
+ * @param tree: the tree.
+ * @param hashFunc: hashes the items, NULL to remove the filter.
+ * @param bitsPerItem: the size of the filter, 0 for the default (10).
+ * @return: 0 on failure (the tree is left without a filter), other on success.
+ */
+int RBTreeSetBloomFilter(RBTree *tree, HashFunc hashFunc, int bitsPerItem);
+
+/**
+ * get the counters of a tree's bloom filter (they survive the filter's rebuilds). like the
+ * operation counters, they are only kept when the library is compiled with -DRBTREE_STATS, so
+ * lookups don't write to the filter otherwise.
+ * @param tree: a tree with a bloom filter.
+ * @return: the counters (all zero if the tree has no filter, or they are compiled out - bytes is
+ * always set).
+ */
+RBBloomStats RBTreeBloomStats(const RBTree *tree);
+
+/**
+ * give a set a write buffer, or remove it. RBTreeBufferedInsert makes its item's node but only
+ * appends it to the buffer. once it is full, the buffer is sorted and merged into the tree in
+ * order, every search starting from the node of the previous item, which is much cheaper than as
+ * many separate inserts. the operations that change the tree (insertToRBTree, delete, extract,
+ * pop, the handles...) merge the buffer first. the point lookups (contains, find and their
+ * batches) also look in the buffer, without merging it: through the hashFunc, or by a scan of the
+ * buffer without one. the other reads (forEach, peek, clone, diff, the size...) see only the
+ * merged items - call RBTreeFlush before them.
+ * @param tree: a set (not a map, multiset or string set).
+ * @param capacity: the number of items the buffer holds, 0 to merge the buffer and remove it.
+ * @param hashFunc: hashes the items, so lookups find a buffered item at once (may be NULL).
+ * @return: 0 on failure, other on success.
+ */
+int RBTreeSetWriteBuffer(RBTree *tree, size_t capacity, HashFunc hashFunc);
+
+/**
+ * add an item to the write buffer of a set. it is looked up like RBTreeContains, and rejected if
+ * it is already in the tree or in the buffer, but not linked into the tree until the buffer is
+ * merged. the handle RBTreeFind gives for a buffered item stays valid once it is merged.
+ * @param tree: a set (with no write buffer, this is insertToRBTree).
+ * @param data: the item.
+ * @return: 0 on failure (the item was not taken: it is already in the set, or its node could not
+ * be allocated), other once the item is buffered.
+ */
+int RBTreeBufferedInsert(RBTree *tree, void *data);
+
+/**
+ * merge the write buffer of a tree into it (e.g. before reading it). the nodes of the buffered
+ * items are allocated as they come, so the merge itself never fails.
+ * @param tree: the tree.
+ * @return: 0 on failure (a NULL tree), other on success.
+ */
+int RBTreeFlush(RBTree *tree);
+
+/**
+ * let other threads read a tree while one thread changes it. the writer makes the version of the
+ * tree odd while it links or unlinks a node, and readers in RBTreeContains and RBTreeFind walk
+ * down without any lock and walk again if the version changed meanwhile. the walk writes nothing
+ * (no finger, counters or bloom filter statistics), so readers never take cache lines from each
+ * other or from the writer. removed nodes are not freed until RBTreeReclaim, so a reader never
+ * touches freed memory; the items the writer extracts must outlive the readers too.
+ * only one thread may change the tree, and only RBTreeContains and RBTreeFind may run beside it.
+ * @param tree: the tree (without a write buffer).
+ * @param enabled: TRUE to start, FALSE to stop (when no reader is left, it reclaims the nodes).
+ * @return: 0 on failure, other on success.
+ */
+int RBTreeSetOptimisticReads(RBTree *tree, int enabled);
+
+/**
+ * free the nodes removed from a tree read optimistically (with their items, unless they were
+ * extracted). call it only when no reader is inside the tree, e.g. after every reader thread
+ * passed a barrier.
+ * @param tree: the tree.
+ * @return: the number of nodes freed.
+ */
+size_t RBTreeReclaim(RBTree *tree);
+
+/**
+ * copy a tree in O(n) without comparing any items: the clone has the same shape and colors, and
+ * its nodes are a single allocation, in pre-order. later inserts allocate their nodes one by one,
+ * and the nodes of the block are only freed with the clone (the slot of a deleted node is never
+ * reused). the hash index, bloom filter, write buffer and optimistic reads of the tree are not
+ * copied (the clone can be given its own).
+ * @param tree: the tree to copy.
+ * @param copyFunc: copies the items (the keys of a map). if NULL, the clone shares the items of
+ * the tree without owning them (its freeFunc is NULL). the values of a map are always shared,
+ * and a string set always copies its own strings. the nodes of an augmented tree are updated
+ * from the copies, bottom-up, so they don't point into the items of the tree.
+ * @return: the clone, or NULL on failure.
+ */
+RBTree *RBTreeClone(const RBTree *tree, CopyFunc copyFunc);
+
+/**
+ * same as RBTreeClone, but disjoint subtrees are copied by @threads threads in parallel (so
+ * copyFunc must be thread safe). the block is not in pre-order then: it starts with the top levels
+ * of the tree, level by level, followed by the subtrees below them, each in pre-order. the library
+ * must be compiled with -DRBTREE_THREADS (make THREADS=1) for that, otherwise (and for string
+ * sets) it copies with a single thread.
+ */
+RBTree *RBTreeCloneParallel(const RBTree *tree, CopyFunc copyFunc, int threads);
+
+/**
+ * find what changed from one tree to another (e.g. to send only the changes to a replica) in a
+ * single merge walk over both, O(n + m) with n + m comparisons at most. the items are visited in
+ * ascending order, each with the function of its kind of change. an item in both trees is changed
+ * if equalFunc finds its two copies differ (for a map, its two values), or a multiset holds it a
+ * different number of times. the trees never share nodes, so no part of the walk can be skipped,
+ * unless a and b are the same tree.
+ * @param a: the tree before, b: the tree after (of the same kind, ordered by the same CompareFunc).
+ * @param onAdded: activated on every item only in b (may be NULL).
+ * @param onRemoved: activated on every item only in a (may be NULL).
+ * @param equalFunc: tells if the items (the values of a map) in both trees are the same. NULL
+ * takes every two items the CompareFunc finds equal as the same (and every two values). pass
+ * RBTreeSameObject to take only the same objects as the same without calling anything, e.g. for
+ * a tree and its RBTreeClone without a copyFunc, which share their items until they are replaced.
+ * @param onChanged: activated on every item that changed, with its handle in a and in b, so a map
+ * gets the old and the new value with RBMapValue (may be NULL).
+ * @param args: more optional arguments to the functions.
+ * @return: 0 on failure (the walk stops when a function returns 0), other on success.
+ */
+int RBTreeDiff(const RBTree *a, const RBTree *b, forEachFunc onAdded, forEachFunc onRemoved,
+			   EqualFunc equalFunc, ChangeFunc onChanged, void *args);
+
+/**
+ * an EqualFunc for RBTreeDiff that takes two items (or values) as the same only if they are the
+ * same object.
+ * @return: 0 if a and b are different objects, other if they are the same.
+ */
+int RBTreeSameObject(const void *a, const void *b);
+
+/**
+ * choose how the tree balances itself (red black by default). works on any kind of tree, but only
+ * while it is empty.
+ * @param tree: the tree.
+ * @param balance: the balancing policy.
+ * @return: 0 on failure, other on success. (if the tree is not empty - failure).
+ */
+int RBTreeSetBalance(RBTree *tree, RBBalance balance);
+
 
 
 /**
@@ -97,5 +442,260 @@ int forEachRBTree(const RBTree *tree, forEachFunc func, void *args); // implemen
  */
 void freeRBTree(RBTree **tree); // implement it in RBTree.c
 
+/**
+ * a handle to an item of the tree. it stays valid until that item is removed from the tree, no
+ * matter which other items are inserted or deleted meanwhile.
+ */
+typedef Node *RBHandle;
+
+/**
+ * find the handle of an item.
+ * @param tree: the tree to search.
+ * @param data: item to find.
+ * @return: the handle of the item in the tree equal to data, or NULL if there is none.
+ */
+RBHandle RBTreeFind(const RBTree *tree, const void *data);
+
+/**
+ * find the handle of an item, inserting the item first if it is not in the tree - a single
+ * descent for both, where insertToRBTree and RBTreeFind would take two. a new map node's value is
+ * NULL (see RBMapValue). multisets are not supported, as an equal item is not a duplicate there.
+ * @param tree: the tree.
+ * @param data: the item. if an equal one is already in the tree, data is left to the caller.
+ * @param inserted: set to 0 if an equal item was already in the tree, other if data was inserted
+ * (may be NULL).
+ * @return: the handle of the item in the tree equal to data, or NULL on failure.
+ */
+RBHandle RBTreeFindOrInsert(RBTree *tree, void *data, int *inserted);
+
+/**
+ * find the handles of a batch of items at once, the same way RBTreeContainsBatch checks them.
+ * @param handles: filled with the handle of every item, or NULL for the ones not in the tree.
+ * @return: 0 on failure, other on success.
+ */
+int RBTreeFindBatch(const RBTree *tree, const void *const *keys, size_t n, RBHandle *handles);
+
+/**
+ * @return: the item a handle points to (NULL for a NULL handle).
+ */
+void *RBHandleData(RBHandle handle);
+
+/**
+ * remove an item by its handle, without searching for it again. the item is freed with the
+ * tree's freeFunc (in a multiset - all its occurrences).
+ * @param tree: the tree the handle belongs to.
+ * @param handle: a valid handle of this tree, invalid after the call.
+ * @return: 0 on failure, other on success.
+ */
+int RBTreeEraseHandle(RBTree *tree, RBHandle handle);
+
+/**
+ * remove an item from the tree and return it without freeing it, e.g. to move it to another tree.
+ * a map, a chained multiset and a string set hold more than the item in its node (the value, the
+ * other occurrences, the key's copy), so they are not supported - use deleteFromRBTree.
+ * @param tree: the tree to remove the item from.
+ * @param data: item to remove.
+ * @return: the removed item, or NULL if it is not in the tree (or the tree is of such a kind).
+ */
+void *RBTreeExtract(RBTree *tree, const void *data);
+
+/**
+ * same as RBTreeExtract, for an item known by its handle.
+ */
+void *RBTreeExtractHandle(RBTree *tree, RBHandle handle);
+
+/**
+ * the smallest / largest item of the tree in O(1).
+ * @param tree: the tree.
+ * @return: the item, or NULL if the tree is empty.
+ */
+void *RBTreePeekMin(const RBTree *tree);
+void *RBTreePeekMax(const RBTree *tree);
+
+/**
+ * remove the smallest / largest item of the tree and return it without freeing it. no search is
+ * done, the item is unlinked directly (in a counted multiset - with all its occurrences). the
+ * kinds RBTreeExtract does not support are not supported here either.
+ * @param tree: the tree.
+ * @return: the item, or NULL if the tree is empty (or of such a kind).
+ */
+void *RBTreePopMin(RBTree *tree);
+void *RBTreePopMax(RBTree *tree);
+
+/**
+ * constructs a new map: a tree whose nodes carry a key and a separate value.
+ * the map is an RBTree sorted by the keys, so deleteFromRBTree, RBTreeContains, forEachRBTree
+ * and freeRBTree all work on it with keys as the items.
+ * @param keyCompFunc: a function to compare two keys.
+ * @param keyFreeFunc: a function to free a key (may be NULL if the map doesn't own the keys).
+ * @param valueFreeFunc: a function to free a value (may be NULL if the map doesn't own the values).
+ */
+RBTree *newRBMap(CompareFunc keyCompFunc, FreeFunc keyFreeFunc, FreeFunc valueFreeFunc);
+
+/**
+ * map a key to a value. if the key is already in the map its value is replaced (the old value and
+ * the new copy of the key are freed), otherwise the key is inserted.
+ * @param map: the map to put the pair into.
+ * @param key: the key.
+ * @param value: the value (may be NULL).
+ * @return: 0 on failure, other on success.
+ */
+int RBMapPut(RBTree *map, void *key, void *value);
+
+/**
+ * get the value of a key.
+ * @param map: the map to search.
+ * @param key: the key to look for.
+ * @param value: set to the value of the key, if it is in the map (may be NULL, to only check
+ * whether the key is there). a key mapped to NULL is found, with a NULL value.
+ * @return: 0 if the key is not in the map (or on failure), other if it is.
+ */
+int RBMapGet(const RBTree *map, const void *key, void **value);
+
+/**
+ * the value of a map node, to read it or set it in place without a search (e.g. right after
+ * RBTreeFindOrInsert). setting it doesn't free the old value.
+ * @param handle: a handle of a map.
+ * @return: where the node keeps its value (NULL for a NULL handle).
+ */
+void **RBMapValue(RBHandle handle);
+
+/**
+ * replace the value of a key that is already in the map, in place: a single descent and no
+ * rebalancing. the old value is freed.
+ * @param map: the map to update.
+ * @param key: the key to update.
+ * @param value: the new value.
+ * @return: 0 on failure, other on success. (if the key is not in the map - failure).
+ */
+int RBMapUpdate(RBTree *map, const void *key, void *value);
+
+/**
+ * constructs a new multiset: inserting an item equal to one in the tree adds an occurrence to its
+ * node instead of failing, and deleting it removes a single occurrence.
+ * @param compFunc: a function to compare two items.
+ * @param freeFunc: a function to free an item (may be NULL if the tree doesn't own the items).
+ * @param kind: RB_MULTISET_COUNTED or RB_MULTISET_CHAINED.
+ * @return: the new multiset, or NULL on failure.
+ */
+RBTree *newRBMultiset(CompareFunc compFunc, FreeFunc freeFunc, RBTreeKind kind);
+
+/**
+ * constructs a new augmented tree: a set whose nodes are larger structs that start with a Node
+ * and keep information about their subtrees. the tree calls augment on every node whose subtree
+ * changed: after rotations, and on the way up from every inserted or removed node. new nodes are
+ * zeroed before their first augment call.
+ * @param compFunc: a function to compare two items.
+ * @param freeFunc: a function to free an item (may be NULL if the tree doesn't own the items).
+ * @param nodeSize: the size of the nodes, at least sizeof(Node).
+ * @param augment: the function that updates a node from its item and its children.
+ * @return: the new tree, or NULL on failure.
+ */
+RBTree *newRBAugmentedTree(CompareFunc compFunc, FreeFunc freeFunc, size_t nodeSize,
+						   AugmentFunc augment);
+
+/**
+ * constructs a new string set: a set of C strings that copies every inserted key. keys shorter
+ * than RB_INLINE_STRING are kept inside their node, longer ones are appended to blocks owned by
+ * the set. there are no per-key allocations or frees beyond the node itself. a block is freed
+ * when the last key in it is deleted, so a deleted long key's bytes come back once the keys stored
+ * next to it are deleted too.
+ * the caller keeps ownership of the strings it passes in. the stored keys belong to the set, so
+ * RBTreeExtract and the pops return NULL on it.
+ * @return: the new set, or NULL on failure.
+ */
+RBTree *newRBStringSet(void);
+
+/**
+ * intern a string: get the set's copy of it, inserting it first if it is not there yet.
+ * the copy stays valid until it is deleted from the set, so equal strings can be compared by
+ * address.
+ * @param set: a string set.
+ * @param key: the string to intern.
+ * @return: the set's copy, or NULL on failure.
+ */
+const char *RBStringSetIntern(RBTree *set, const char *key);
+
+/**
+ * a closed interval [low, high]. the items of an interval tree are structs that start with one.
+ */
+typedef struct RBInterval
+{
+	double low, high;
+} RBInterval;
+
+/**
+ * constructs a new interval tree: an augmented tree of items that start with an RBInterval, where
+ * every node also keeps the highest endpoint in its subtree.
+ * @param compFunc: a function to compare two items. it must order them by their low endpoints
+ * first (ties may be broken in any way). NULL orders them by low and then by high endpoint.
+ * @param freeFunc: a function to free an item (may be NULL if the tree doesn't own the items).
+ * @return: the new tree, or NULL on failure.
+ */
+RBTree *newRBIntervalTree(CompareFunc compFunc, FreeFunc freeFunc);
+
+/**
+ * find an interval that overlaps [low, high] in O(log n): the one with the lowest low endpoint.
+ * @param tree: an interval tree.
+ * @param low, high: the interval to check.
+ * @return: the overlapping item, or NULL if there is none.
+ */
+void *RBIntervalOverlaps(const RBTree *tree, double low, double high);
+
+/**
+ * activate a function on every interval that overlaps [low, high], in order. the subtrees that
+ * end before low or start after high are skipped, so for k overlapping intervals it takes
+ * O(min(n, (k + 1) log n)) in the worst case: a search path to each of them, and one to the end.
+ * @param tree: an interval tree.
+ * @param low, high: the interval to check.
+ * @param func: the function to activate on the overlapping items.
+ * @param args: more optional arguments to the function (may be null if the given function support
+ * it).
+ * @return: 0 on failure, other on success.
+ */
+int forEachOverlapping(const RBTree *tree, double low, double high, forEachFunc func, void *args);
+
+/**
+ * count the occurrences of an item in the tree.
+ * @param tree: the tree to search.
+ * @param data: the item to count.
+ * @return: the number of occurrences (0 or 1 for a set or a map).
+ */
+long unsigned RBTreeCount(const RBTree *tree, const void *data);
+
+/**
+ * same as forEachRBTree, but in a multiset the function is applied to every occurrence of an item
+ * (for a counted multiset - the kept item, as many times as it was inserted).
+ */
+int forEachOccurrenceRBTree(const RBTree *tree, forEachFunc func, void *args);
+
+/**
+ * report the memory the tree uses, in a single O(n) walk that does not allocate. the block of a
+ * clone is counted as a single allocation, and the slots its deleted nodes leave in it (never
+ * reused until the clone is freed) as its slack. the nodes inserted after the clone are counted
+ * one by one.
+ * @param tree: the tree to measure.
+ * @param sizeFn: measures the payload of an item, may be NULL to skip the payload. a map measures
+ * its keys and its (non-NULL) values with it. a string set ignores it and reports the blocks of
+ * its long keys as the payload.
+ * @return: the footprint of the tree (all zero if tree is NULL).
+ */
+RBMemoryStats RBTreeMemoryStats(const RBTree *tree, SizeFunc sizeFn);
+
+/**
+ * get the operation counters of the tree: comparator calls, rotations, recolorings, node
+ * allocations and frees, and the number, maximum and average depth of the root-to-node descents.
+ * @param tree: the tree to get the counters of.
+ * @param stats: filled with the counters (all zero when the library is compiled without
+ * RBTREE_STATS).
+ * @return: 0 on failure (or if the counters are compiled out), other on success.
+ */
+int RBTreeGetStats(const RBTree *tree, RBTreeStats *stats);
+
+/**
+ * reset all the operation counters of the tree to zero.
+ * @param tree: the tree to reset.
+ */
+void RBTreeResetStats(RBTree *tree);
 
 #endif //RBTREE_RBTREE_H
\ No newline at end of file
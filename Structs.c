@@ -12,14 +12,22 @@
  * @section DESCRIPTION
  * creates string functions to use RBTree
  * create Vector functions to use RBTree
+ * the Vector kernels (first differing element, sum of squares) have AVX2 and SSE2 versions on x86,
+ * picked by the CPU the first time they are called.
  */
 // ------------------------------ includes ------------------------------
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
 #include "Structs.h"
 #include "RBTree.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_SIMD
+#include <immintrin.h>
+#endif
+
 // -------------------------- const definitions -------------------------
 /**
  * @brief return value for functions
@@ -37,6 +45,85 @@ enum FunctionExit
 #define EQUAL (0)
 #define GREATER (1)
 
+/**
+ * @brief a node of a max norm vector tree
+ * norm: the norm key (see normKey) of the node's own vector, once hasNorm is set.
+ * maxNorm, max: the largest norm key in the node's subtree and its vector.
+ */
+typedef struct VectorNode
+{
+    Node node;
+    double norm, maxNorm;
+    const Vector *max;
+    int hasNorm;
+} VectorNode;
+
+/**
+ * @brief the state of RBTreeJoinStrings: the buffer (NULL while measuring), its length so far and
+ * whether the next word is the first
+ */
+typedef struct JoinState
+{
+    char *out;
+    size_t len;
+    const char *sep;
+    size_t sepLen;
+    int first;
+} JoinState;
+
+/**
+ * @brief the size of the buffer RBTreeWriteStrings gathers strings in
+ */
+#define WRITE_BUFFER_SIZE (64 * 1024)
+
+/**
+ * @brief the state of RBTreeWriteStrings
+ */
+typedef struct WriteState
+{
+    FILE *out;
+    const char *sep;
+    size_t sepLen;
+    size_t used;
+    int first;
+    char buffer[WRITE_BUFFER_SIZE];
+} WriteState;
+
+/**
+ * @brief the usable size of a VectorStore block, and the alignment of the coordinates in it
+ */
+#define STORE_BLOCK_SIZE (64 * 1024)
+#define STORE_ALIGNMENT 32
+
+/**
+ * @brief a block of a VectorStore, its memory follows it (aligned to STORE_ALIGNMENT)
+ */
+typedef struct StoreBlock
+{
+    struct StoreBlock *next;
+    char *start;
+    size_t used, capacity;
+} StoreBlock;
+
+/**
+ * @brief the Vector structs and the coordinates are kept in separate lists of blocks
+ */
+struct VectorStore
+{
+    StoreBlock *headers, *values;
+};
+
+/**
+ * @brief a kernel that finds the first element two arrays differ at
+ * @return its index, or len if the first len elements are equal
+ */
+typedef int (*FirstDifferenceFunc)(const double *a, const double *b, int len);
+
+/**
+ * @brief a kernel that sums the squares of an array
+ */
+typedef double (*SumOfSquaresFunc)(const double *vector, int len);
+
 // -------------------------- func declarations -------------------------
 /**
  * @brief returns the minimum value between @a and @b
@@ -51,6 +138,110 @@ int min(int a, int b);
  */
 double vectorNorm(const double *vector, int len);
 
+/**
+ * @brief the squared norm of a vector, to compare norms without their square roots (or the norm
+ * itself when it is cached)
+ * @param v - the vector. its cached norm is used if it is known, and filled in if not: the cache
+ * is not part of the vector's value, so a const vector keeps it too
+ * @return the squared norm, or the norm if VECTOR_CACHED_NORM is defined
+ */
+double normKey(const Vector *v);
+
+// ---------------- join ----------------
+/**
+ * @brief forEach function that adds the length of a word (and of the separator before it, if it is
+ * not the first) to a JoinState, or copies them to its buffer if it has one
+ * @param word - char* to add
+ * @param pJoin - JoinState*
+ * @return SUCCESS
+ */
+int joinString(const void *word, void *pJoin);
+
+/**
+ * @brief forEach function that adds a word (and the separator before it, if it is not the first)
+ * to the buffer of a WriteState, writing the buffer out when it is full
+ * @param word - char* to add
+ * @param pWrite - WriteState*
+ * @return 0 if writing failed, other on success
+ */
+int writeString(const void *word, void *pWrite);
+
+/**
+ * @brief adds bytes to the buffer of a WriteState, writing the buffer out when it is full (bytes
+ * that don't fit in an empty buffer are written directly)
+ * @param state - the WriteState
+ * @param bytes - the bytes to add
+ * @param len - their number
+ * @return 0 if writing failed, other on success
+ */
+int writeBytes(WriteState *state, const char *bytes, size_t len);
+
+// ------------- max norm tree -------------
+/**
+ * @brief the AugmentFunc of a max norm vector tree: the largest of the node's own norm and its
+ * children's largest norms
+ * @param node - a VectorNode to update
+ */
+void updateMaxNorm(Node *node);
+
+/**
+ * @brief keeps the larger of a candidate and the best vector so far
+ * @param norm - the candidate's norm key
+ * @param vector - the candidate
+ * @param bestNorm - the best norm key so far
+ * @param best - the best vector so far (NULL if there is none yet)
+ */
+void keepLarger(double norm, const Vector *vector, double *bestNorm, const Vector **best);
+
+// ------------- vector store -------------
+/**
+ * @brief takes memory from the first block of a list, adding a new block if it is full
+ * @param blocks - the list of blocks
+ * @param size - the number of bytes
+ * @param alignment - a power of 2 the address must be a multiple of
+ * @return the memory, or NULL on failure
+ */
+void *storeAlloc(StoreBlock **blocks, size_t size, size_t alignment);
+
+/**
+ * @brief frees a list of blocks
+ */
+void freeStoreBlocks(StoreBlock *blocks);
+
+// ------------- kernels -------------
+/**
+ * @brief chooses the best kernels the CPU supports
+ */
+void selectVectorKernels(void);
+
+/**
+ * @brief the kernels before they are chosen: choose them and run the chosen one
+ */
+int firstDifferenceDispatch(const double *a, const double *b, int len);
+double sumOfSquaresDispatch(const double *vector, int len);
+
+/**
+ * @brief the kernels used on this CPU, chosen on their first call (loaded and stored atomically)
+ */
+static FirstDifferenceFunc firstDifference = firstDifferenceDispatch;
+static SumOfSquaresFunc sumOfSquares = sumOfSquaresDispatch;
+
+/**
+ * @brief the plain C kernels, for any CPU
+ */
+int firstDifferenceScalar(const double *a, const double *b, int len);
+double sumOfSquaresScalar(const double *vector, int len);
+
+#ifdef VECTOR_SIMD
+/**
+ * @brief the SSE2 (2 lanes) and AVX2 (4 lanes) kernels
+ */
+int firstDifferenceSSE2(const double *a, const double *b, int len);
+double sumOfSquaresSSE2(const double *vector, int len);
+int firstDifferenceAVX2(const double *a, const double *b, int len);
+double sumOfSquaresAVX2(const double *vector, int len);
+#endif
+
 // ------------------------------ functions -----------------------------
 int stringCompare(const void *a, const void *b)
 {
@@ -64,6 +255,102 @@ int concatenate(const void *word, void *pConcatenated)
     return SUCCESS;
 }
 
+char *RBTreeJoinStrings(const RBTree *tree, const char *sep, size_t *outLen)
+{
+    if (tree == NULL)
+    {
+        return NULL;
+    }
+    JoinState state = {NULL, 0, sep, sep != NULL ? strlen(sep) : 0, 1};
+    forEachRBTree(tree, joinString, &state);
+    state.out = (char *) malloc(state.len + 1);
+    if (state.out == NULL)
+    {
+        return NULL;
+    }
+    state.len = 0, state.first = 1;
+    forEachRBTree(tree, joinString, &state);
+    state.out[state.len] = '\0';
+    if (outLen != NULL)
+    {
+        *outLen = state.len;
+    }
+    return state.out;
+}
+
+int joinString(const void *word, void *pJoin)
+{
+    JoinState *state = (JoinState *) pJoin;
+    if (!state->first && state->sepLen > 0)
+    {
+        if (state->out != NULL)
+        {
+            memcpy(state->out + state->len, state->sep, state->sepLen);
+        }
+        state->len += state->sepLen;
+    }
+    state->first = 0;
+    size_t len = strlen((const char *) word);
+    if (state->out != NULL)
+    {
+        memcpy(state->out + state->len, word, len);
+    }
+    state->len += len;
+    return SUCCESS;
+}
+
+int RBTreeWriteStrings(const RBTree *tree, const char *sep, FILE *out)
+{
+    if (tree == NULL || out == NULL)
+    {
+        return FAIL;
+    }
+    WriteState *state = (WriteState *) malloc(sizeof(WriteState));
+    if (state == NULL)
+    {
+        return FAIL;
+    }
+    state->out = out, state->sep = sep, state->sepLen = sep != NULL ? strlen(sep) : 0;
+    state->used = 0, state->first = 1;
+    int result = forEachRBTree(tree, writeString, state);
+    if (result && state->used > 0)
+    {
+        result = fwrite(state->buffer, 1, state->used, out) == state->used;
+    }
+    free(state);
+    return result ? SUCCESS : FAIL;
+}
+
+int writeString(const void *word, void *pWrite)
+{
+    WriteState *state = (WriteState *) pWrite;
+    if (!state->first && state->sepLen > 0 && !writeBytes(state, state->sep, state->sepLen))
+    {
+        return FAIL;
+    }
+    state->first = 0;
+    return writeBytes(state, (const char *) word, strlen((const char *) word));
+}
+
+int writeBytes(WriteState *state, const char *bytes, size_t len)
+{
+    if (state->used + len > WRITE_BUFFER_SIZE)
+    {
+        if (fwrite(state->buffer, 1, state->used, state->out) != state->used)
+        {
+            return FAIL;
+        }
+        state->used = 0;
+        if (len > WRITE_BUFFER_SIZE)
+        {
+            return fwrite(bytes, 1, len, state->out) == len;
+        }
+    }
+    memcpy(state->buffer + state->used, bytes, len);
+    state->used += len;
+    return SUCCESS;
+}
+
 void freeString(void *s)
 {
     free(s);
@@ -73,19 +360,12 @@ int vectorCompare1By1(const void *a, const void *b)
 {
     Vector *first = (Vector *) a;
     Vector *second = (Vector *) b;
-    double diff;
     int minLen = min(first->len, second->len);
-    for (int i = 0; i < minLen; i++)
+    int i = __atomic_load_n(&firstDifference, __ATOMIC_RELAXED)(first->vector, second->vector,
+                                                                minLen);
+    if (i < minLen)
     {
-        diff = first->vector[i] - second->vector[i];
-        if (diff < 0)
-        {
-            return LESS;
-        }
-        else if (diff > 0)
-        {
-            return GREATER;
-        }
+        return first->vector[i] < second->vector[i] ? LESS : GREATER;
     }
     if (first->len < second->len)
     {
@@ -124,7 +404,7 @@ int copyIfNormIsLarger(const void *pVector, void *pMaxVector)
     {
         return FAIL;
     }
-    Vector *v = (Vector *) pVector;
+    const Vector *v = (const Vector *) pVector;
     Vector *max = (Vector *) pMaxVector;
     if (max->vector == NULL)
     {
@@ -135,11 +415,10 @@ int copyIfNormIsLarger(const void *pVector, void *pMaxVector)
         }
         memcpy(max->vector, v->vector, sizeof(double) * v->len);
         max->len = v->len;
+        max->norm = v->norm;
         return SUCCESS;
     }
-    double vNorm = vectorNorm(v->vector, v->len);
-    double maxNorm = vectorNorm(max->vector, max->len);
-    if (maxNorm < vNorm)
+    if (normKey(max) < normKey(v))
     {
         if (max->len != v->len)
         {
@@ -152,18 +431,32 @@ int copyIfNormIsLarger(const void *pVector, void *pMaxVector)
         }
         memcpy(max->vector, v->vector, sizeof(double) * v->len);
         max->len = v->len;
+        max->norm = v->norm;
     }
     return SUCCESS;
 }
 
 double vectorNorm(const double *vector, int len)
 {
-    double norm = 0.0;
-    for (int i = 0; i < len; i++)
+    return sqrt(__atomic_load_n(&sumOfSquares, __ATOMIC_RELAXED)(vector, len));
+}
+
+double normKey(const Vector *v)
+{
+#ifdef VECTOR_CACHED_NORM
+    // readers of a shared tree may fill it in at once: each stores the same whole double
+    double *cache = (double *) &v->norm, norm;
+    __atomic_load(cache, &norm, __ATOMIC_RELAXED);
+    if (norm > VECTOR_NORM_UNKNOWN)
     {
-        norm += pow(vector[i], 2);
+        return norm;
     }
-    return sqrt(norm);
+    norm = vectorNorm(v->vector, v->len);
+    __atomic_store(cache, &norm, __ATOMIC_RELAXED);
+    return norm;
+#else
+    return __atomic_load_n(&sumOfSquares, __ATOMIC_RELAXED)(v->vector, v->len);
+#endif
 }
 
 Vector *findMaxNormVectorInTree(RBTree *tree)
@@ -176,7 +469,18 @@ Vector *findMaxNormVectorInTree(RBTree *tree)
     }
     maxVector->len = 0;
     maxVector->vector = NULL;
-    int failOrNah = forEachRBTree(tree, func, (void *) maxVector);
+    maxVector->norm = VECTOR_NORM_UNKNOWN;
+    int failOrNah;
+    if (tree != NULL && tree->augment == updateMaxNorm)
+    {
+        // the tree already knows its largest vector, only copy it
+        const Vector *max = maxNormVector(tree);
+        failOrNah = max == NULL ? SUCCESS : func(max, (void *) maxVector);
+    }
+    else
+    {
+        failOrNah = forEachRBTree(tree, func, (void *) maxVector);
+    }
     if (failOrNah == FAIL)
     {
         free(maxVector->vector);
@@ -184,4 +488,349 @@ Vector *findMaxNormVectorInTree(RBTree *tree)
         return NULL;
     }
     return maxVector;
-}
\ No newline at end of file
+}
+
+// ----------- max norm tree -----------
+RBTree *newMaxNormVectorTree(FreeFunc freeFunc)
+{
+    return newRBAugmentedTree(vectorCompare1By1, freeFunc, sizeof(VectorNode), updateMaxNorm);
+}
+
+void updateMaxNorm(Node *node)
+{
+    VectorNode *vectorNode = (VectorNode *) node;
+    if (!vectorNode->hasNorm)
+    {
+        vectorNode->norm = normKey((const Vector *) node->data);
+        vectorNode->hasNorm = SUCCESS;
+    }
+    vectorNode->maxNorm = vectorNode->norm;
+    vectorNode->max = (const Vector *) node->data;
+    Node *kids[] = {node->left, node->right};
+    for (int i = 0; i < 2; i++)
+    {
+        VectorNode *kid = (VectorNode *) kids[i];
+        if (kid != NULL && kid->maxNorm > vectorNode->maxNorm)
+        {
+            vectorNode->maxNorm = kid->maxNorm;
+            vectorNode->max = kid->max;
+        }
+    }
+}
+
+const Vector *maxNormVector(const RBTree *tree)
+{
+    if (tree == NULL || tree->root == NULL)
+    {
+        return NULL;
+    }
+    return ((const VectorNode *) tree->root)->max;
+}
+
+void keepLarger(double norm, const Vector *vector, double *bestNorm, const Vector **best)
+{
+    if (*best == NULL || norm > *bestNorm)
+    {
+        *bestNorm = norm;
+        *best = vector;
+    }
+}
+
+const Vector *maxNormVectorInRange(const RBTree *tree, const Vector *from, const Vector *to)
+{
+    if (tree == NULL)
+    {
+        return NULL;
+    }
+    CompareFunc compare = tree->compFunc;
+
+    // the highest node in the range, the paths to both ends of the range split at it
+    const Node *split = tree->root;
+    while (split != NULL)
+    {
+        if (from != NULL && compare(split->data, from) < 0)
+        {
+            split = split->right;
+        }
+        else if (to != NULL && compare(split->data, to) > 0)
+        {
+            split = split->left;
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (split == NULL)
+    {
+        return NULL;
+    }
+    const VectorNode *splitNode = (const VectorNode *) split;
+    if (from == NULL && to == NULL)
+    {
+        return splitNode->max;
+    }
+
+    double bestNorm = 0;
+    const Vector *best = NULL;
+    keepLarger(splitNode->norm, split->data, &bestNorm, &best);
+    // going down to from, every node in the range brings its right subtree along, and vice versa
+    for (const Node *node = split->left; node != NULL;)
+    {
+        if (from != NULL && compare(node->data, from) < 0)
+        {
+            node = node->right;
+            continue;
+        }
+        keepLarger(((const VectorNode *) node)->norm, node->data, &bestNorm, &best);
+        if (node->right != NULL)
+        {
+            const VectorNode *right = (const VectorNode *) node->right;
+            keepLarger(right->maxNorm, right->max, &bestNorm, &best);
+        }
+        node = node->left;
+    }
+    for (const Node *node = split->right; node != NULL;)
+    {
+        if (to != NULL && compare(node->data, to) > 0)
+        {
+            node = node->left;
+            continue;
+        }
+        keepLarger(((const VectorNode *) node)->norm, node->data, &bestNorm, &best);
+        if (node->left != NULL)
+        {
+            const VectorNode *left = (const VectorNode *) node->left;
+            keepLarger(left->maxNorm, left->max, &bestNorm, &best);
+        }
+        node = node->right;
+    }
+    return best;
+}
+
+// ------------ vector store ------------
+VectorStore *newVectorStore(void)
+{
+    VectorStore *store = (VectorStore *) malloc(sizeof(VectorStore));
+    if (store == NULL)
+    {
+        return NULL;
+    }
+    store->headers = NULL, store->values = NULL;
+    return store;
+}
+
+Vector *vectorStoreAdd(VectorStore *store, const double *values, int len)
+{
+    if (store == NULL || len < 0 || (values == NULL && len > 0))
+    {
+        return NULL;
+    }
+    Vector *vector = (Vector *) storeAlloc(&store->headers, sizeof(Vector), sizeof(double));
+    if (vector == NULL)
+    {
+        return NULL;
+    }
+    vector->vector = (double *) storeAlloc(&store->values, sizeof(double) * len, STORE_ALIGNMENT);
+    if (vector->vector == NULL)
+    {
+        // the header stays unused in its block, it is freed with the store
+        return NULL;
+    }
+    if (len > 0)
+    {
+        memcpy(vector->vector, values, sizeof(double) * len);
+    }
+    vector->len = len;
+    vector->norm = VECTOR_NORM_UNKNOWN;
+    // worked out now, while the values are still in the cache
+    normKey(vector);
+    return vector;
+}
+
+void *storeAlloc(StoreBlock **blocks, size_t size, size_t alignment)
+{
+    StoreBlock *block = *blocks;
+    size_t offset = 0;
+    if (block != NULL)
+    {
+        offset = (block->used + alignment - 1) & ~(alignment - 1);
+    }
+    if (block == NULL || offset + size > block->capacity)
+    {
+        size_t capacity = size > STORE_BLOCK_SIZE ? size : STORE_BLOCK_SIZE;
+        StoreBlock *fresh = (StoreBlock *) malloc(sizeof(StoreBlock) + STORE_ALIGNMENT + capacity);
+        if (fresh == NULL)
+        {
+            return NULL;
+        }
+        uintptr_t first = (uintptr_t) (fresh + 1);
+        fresh->start = (char *) ((first + STORE_ALIGNMENT - 1) & ~(uintptr_t) (STORE_ALIGNMENT - 1));
+        fresh->used = 0, fresh->capacity = capacity;
+        // only the first block is allocated from, so the one with more room left stays first
+        if (block != NULL && block->capacity - block->used > capacity - size)
+        {
+            fresh->next = block->next;
+            block->next = fresh;
+        }
+        else
+        {
+            fresh->next = *blocks;
+            *blocks = fresh;
+        }
+        block = fresh;
+        offset = 0;
+    }
+    block->used = offset + size;
+    return block->start + offset;
+}
+
+void freeVectorStore(VectorStore **store)
+{
+    if (store == NULL || *store == NULL)
+    {
+        return;
+    }
+    freeStoreBlocks((*store)->headers);
+    freeStoreBlocks((*store)->values);
+    free(*store);
+    *store = NULL;
+}
+
+void freeStoreBlocks(StoreBlock *blocks)
+{
+    while (blocks != NULL)
+    {
+        StoreBlock *next = blocks->next;
+        free(blocks);
+        blocks = next;
+    }
+}
+
+// -------------- kernels --------------
+void selectVectorKernels(void)
+{
+    FirstDifferenceFunc difference = firstDifferenceScalar;
+    SumOfSquaresFunc squares = sumOfSquaresScalar;
+#ifdef VECTOR_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        difference = firstDifferenceAVX2, squares = sumOfSquaresAVX2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        difference = firstDifferenceSSE2, squares = sumOfSquaresSSE2;
+    }
+#endif
+    // threads that call them first at once all choose the same kernels, each pointer is stored whole
+    __atomic_store_n(&firstDifference, difference, __ATOMIC_RELAXED);
+    __atomic_store_n(&sumOfSquares, squares, __ATOMIC_RELAXED);
+}
+
+int firstDifferenceDispatch(const double *a, const double *b, int len)
+{
+    selectVectorKernels();
+    return __atomic_load_n(&firstDifference, __ATOMIC_RELAXED)(a, b, len);
+}
+
+double sumOfSquaresDispatch(const double *vector, int len)
+{
+    selectVectorKernels();
+    return __atomic_load_n(&sumOfSquares, __ATOMIC_RELAXED)(vector, len);
+}
+
+int firstDifferenceScalar(const double *a, const double *b, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        // NaNs are neither smaller nor larger, so they are skipped like equal elements
+        if (a[i] < b[i] || a[i] > b[i])
+        {
+            return i;
+        }
+    }
+    return len;
+}
+
+double sumOfSquaresScalar(const double *vector, int len)
+{
+    double sum = 0.0;
+    for (int i = 0; i < len; i++)
+    {
+        sum += vector[i] * vector[i];
+    }
+    return sum;
+}
+
+#ifdef VECTOR_SIMD
+__attribute__((target("sse2")))
+int firstDifferenceSSE2(const double *a, const double *b, int len)
+{
+    int i = 0;
+    for (; i + 2 <= len; i += 2)
+    {
+        __m128d x = _mm_loadu_pd(a + i), y = _mm_loadu_pd(b + i);
+        int mask = _mm_movemask_pd(_mm_or_pd(_mm_cmplt_pd(x, y), _mm_cmpgt_pd(x, y)));
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + firstDifferenceScalar(a + i, b + i, len - i);
+}
+
+__attribute__((target("sse2")))
+double sumOfSquaresSSE2(const double *vector, int len)
+{
+    __m128d sum = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 2 <= len; i += 2)
+    {
+        __m128d x = _mm_loadu_pd(vector + i);
+        sum = _mm_add_pd(sum, _mm_mul_pd(x, x));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, sum);
+    return lanes[0] + lanes[1] + sumOfSquaresScalar(vector + i, len - i);
+}
+
+__attribute__((target("avx2")))
+int firstDifferenceAVX2(const double *a, const double *b, int len)
+{
+    int i = 0;
+    for (; i + 4 <= len; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(a + i), y = _mm256_loadu_pd(b + i);
+        __m256d differ = _mm256_or_pd(_mm256_cmp_pd(x, y, _CMP_LT_OQ), _mm256_cmp_pd(x, y, _CMP_GT_OQ));
+        int mask = _mm256_movemask_pd(differ);
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + firstDifferenceScalar(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2")))
+double sumOfSquaresAVX2(const double *vector, int len)
+{
+    // two accumulators, so consecutive additions don't wait for each other
+    __m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        __m256d x0 = _mm256_loadu_pd(vector + i), x1 = _mm256_loadu_pd(vector + i + 4);
+        sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(x0, x0));
+        sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(x1, x1));
+    }
+    for (; i + 4 <= len; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(vector + i);
+        sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(x, x));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(sum0, sum1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + sumOfSquaresScalar(vector + i, len - i);
+}
+#endif
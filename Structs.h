@@ -2,6 +2,7 @@
 // Created by evyat on 10/13/2019.
 //
 
+#include <stdio.h>
 #include "RBTree.h"
 
 #ifndef TA_EX3_STRUCTS_H
@@ -9,13 +10,22 @@
 
 /**
  * Represents a vector. The double* should be dynamically allocated
+ * norm: a cache of the vector's L2 norm, used when the library is compiled with
+ * -DVECTOR_CACHED_NORM (make NORM_CACHE=1) and ignored otherwise. the field is there in both
+ * builds, so they agree on the layout. VECTOR_NORM_UNKNOWN is 0, so a vector from calloc or a
+ * zeroed initializer starts without a norm. a vector from malloc must set norm to
+ * VECTOR_NORM_UNKNOWN, and so must one whose values change (a stale norm is taken as the real
+ * one). the norm is worked out and kept on its first use.
  */
 typedef struct Vector
 {
 	int len;
 	double *vector;
+	double norm;
 } Vector;
 
+#define VECTOR_NORM_UNKNOWN 0.0
+
 
 /**
  * CompFunc for strings (assumes strings end with "\0")
@@ -35,6 +45,27 @@ int stringCompare(const void *a, const void *b); // implement it in Structs.c
  */
 int concatenate(const void *word, void *pConcatenated); // implement it in Structs.c
 
+/**
+ * joins all the strings of a tree, in order, into a single new buffer. the exact size is measured
+ * in one walk and the strings are copied in a second, so it takes linear time (concatenate rescans
+ * the whole buffer for every word).
+ * @param tree - a tree of strings
+ * @param sep - written between every two strings (NULL for none)
+ * @param outLen - set to the length of the result, without its terminating \0 (may be NULL)
+ * @return the joined strings (to be freed by the caller), or NULL on failure
+ */
+char *RBTreeJoinStrings(const RBTree *tree, const char *sep, size_t *outLen);
+
+/**
+ * writes all the strings of a tree, in order, to a stream, without building the result in memory.
+ * the strings are gathered in a large buffer, so the stream gets few big writes.
+ * @param tree - a tree of strings
+ * @param sep - written between every two strings (NULL for none)
+ * @param out - the stream (for a file descriptor - fdopen it)
+ * @return 0 on failure, other on success
+ */
+int RBTreeWriteStrings(const RBTree *tree, const char *sep, FILE *out);
+
 /**
  * FreeFunc for strings
  */
@@ -70,5 +101,56 @@ int copyIfNormIsLarger(const void *pVector, void *pMaxVector); // implement it i
  */
 Vector *findMaxNormVectorInTree(RBTree *tree); // implement it in Structs.c You must use copyIfNormIsLarger in the implementation!
 
+/**
+ * constructs a tree of Vectors (sorted by vectorCompare1By1) where every node also keeps the
+ * vector with the largest norm in its subtree. it is kept up to date on every insert and delete,
+ * so findMaxNormVectorInTree on it finds the vector in O(1) and only pays for copying it, instead
+ * of a walk over the whole tree.
+ * @param freeFunc - frees a vector (freeVector, or NULL if the tree doesn't own the vectors)
+ * @return the new tree, or NULL on failure
+ */
+RBTree *newMaxNormVectorTree(FreeFunc freeFunc);
+
+/**
+ * @param tree a tree made by newMaxNormVectorTree
+ * @return the vector in the tree (not a copy) with the largest norm in O(1), NULL if it is empty
+ */
+const Vector *maxNormVector(const RBTree *tree);
+
+/**
+ * @param tree a tree made by newMaxNormVectorTree
+ * @param from, to the smallest and largest vectors of the range, inclusive (NULL for no bound)
+ * @return the vector in the tree (not a copy) with the largest norm among from..to in O(log n),
+ * NULL if there are none
+ */
+const Vector *maxNormVectorInRange(const RBTree *tree, const Vector *from, const Vector *to);
+
+
+/**
+ * a store that packs many Vectors into a few large blocks: the Vector structs in some blocks and
+ * their coordinates, 32 byte aligned, in others. the vectors are never freed one by one: a tree
+ * of stored vectors is built with a NULL FreeFunc, and freeVectorStore releases all of them.
+ */
+typedef struct VectorStore VectorStore;
+
+/**
+ * @return a new empty store, or NULL on failure
+ */
+VectorStore *newVectorStore(void);
+
+/**
+ * copy a vector into the store.
+ * @param store - the store
+ * @param values - the coordinates
+ * @param len - the number of coordinates
+ * @return the stored Vector (valid until the store is freed), or NULL on failure
+ */
+Vector *vectorStoreAdd(VectorStore *store, const double *values, int len);
+
+/**
+ * free a store and all the vectors in it.
+ * @param store - pointer to the store to free
+ */
+void freeVectorStore(VectorStore **store);
 
 #endif //TA_EX3_STRUCTS_H
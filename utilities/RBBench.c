@@ -0,0 +1,1071 @@
+/**
+ * @file RBBench.c
+ * @author  Inbal Lavi <inbal.lavi1@mail.huji.ac.il>
+ * @version 1.0
+ * @date 3 June 2020
+ *
+ * @brief RBTree benchmark suite
+ *
+ * @section LICENSE
+ * is free and should be used only for good. we do not support the dark side.
+ *
+ * @section DESCRIPTION
+ * runs insert, delete, contains and forEach on int, string and Vector keys under sequential,
+ * random, nearly sorted, zipf-skewed and mixed read/write workloads, a work queue and an LRU cache.
+ * every measurement is printed as a single JSON line (ops/s, p50/p99/p999 latency and peak RSS)
+ * so runs can be compared with standard tools. built with make bench STATS=1, the operation
+ * counters of every phase are added to its line.
+ * --finger: finger search. --topdown: the top-down tree too. --balance=wavl: WAVL balancing.
+ * --augment: max norm Vector trees. --strset: string sets. --hash: a hash index.
+ * --bloom: a bloom filter. --buffer: a write buffer for the insert phase.
+ *
+ * usage: rbbench [--min=N] [--max=N] [--keys=int,string,vector]
+ *                [--workloads=seq,random,zipf,mixed,queue,near] [--seed=N] [--finger]
+ *                [--topdown] [--balance=rb|wavl] [--augment] [--strset] [--hash] [--bloom]
+ *                [--buffer]
+ */
+// ------------------------------ includes ------------------------------
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "../RBTree.h"
+#include "../RBTopDown.h"
+#include "../RBCache.h"
+#include "../Structs.h"
+#include "RBUtilities.h"
+
+// -------------------------- const definitions -------------------------
+/**
+ * @brief default smallest and largest tree sizes (sizes grow by x10)
+ */
+#define DEFAULT_MIN_ELEMENTS 1000
+#define DEFAULT_MAX_ELEMENTS 100000
+
+/**
+ * @brief zipf skew used by the zipf and mixed workloads
+ */
+#define ZIPF_THETA 0.99
+
+/**
+ * @brief a large prime used to scatter zipf ranks over the key space
+ */
+#define SCATTER_PRIME 2654435761ULL
+
+/**
+ * @brief the near workload comes in ascending order, shuffled within windows of this many keys
+ */
+#define NEAR_SORTED_WINDOW 16
+
+/**
+ * @brief Vector keys length
+ */
+#define VECTOR_LEN 4
+
+/**
+ * @brief the number of threads of the parallel validation
+ */
+#define VALIDATE_THREADS 4
+
+/**
+ * @brief the number of times forEach is timed per tree
+ */
+#define FOR_EACH_ROUNDS 5
+
+/**
+ * @brief the capacity of the zipf workload's cache, as a fraction of the keys
+ */
+#define CACHE_FRACTION 10
+
+/**
+ * @brief the capacity of the write buffer of the insert phase (with --buffer)
+ */
+#define WRITE_BUFFER_ITEMS 4096
+
+/**
+ * @brief the number of keys of a single RBTreeContainsBatch call
+ */
+#define LOOKUP_BATCH 1024
+
+/**
+ * @brief latency histogram layout: exact buckets below 2^SUB_BITS ns, then 2^SUB_BITS buckets per
+ * power of two.
+ */
+#define SUB_BITS 5
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - SUB_BITS) * SUB_BUCKETS)
+
+#define NANO 1000000000.0
+
+/**
+ * @brief the key types being benchmarked
+ */
+typedef enum KeyType
+{
+    INT_KEYS,
+    STRING_KEYS,
+    VECTOR_KEYS,
+    KEY_TYPES
+} KeyType;
+
+/**
+ * @brief the workloads being benchmarked
+ */
+typedef enum Workload
+{
+    SEQUENTIAL,
+    RANDOM,
+    ZIPF,
+    MIXED,
+    QUEUE,
+    NEAR_SORTED,
+    WORKLOADS
+} Workload;
+
+static const char *const balanceNames[] = {"rb", "wavl"};
+static const char *const keyTypeNames[KEY_TYPES] = {"int", "string", "vector"};
+static const char *const workloadNames[WORKLOADS] = {"seq", "random", "zipf", "mixed", "queue",
+                                                          "near"};
+
+/**
+ * @brief a log-linear latency histogram in nanoseconds
+ */
+typedef struct Histogram
+{
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    double totalSeconds;
+} Histogram;
+
+/**
+ * @brief the keys of a single run. keys[i] < keys[i + 1] for every i, and the tree never frees
+ * them (the run owns the key memory).
+ */
+typedef struct KeySet
+{
+    KeyType type;
+    size_t n;
+    void **keys;
+    void *storage;
+    char *strings;
+} KeySet;
+
+/**
+ * @brief zipf generator state (Gray et al., "Quickly generating billion-record synthetic
+ * databases")
+ */
+typedef struct Zipf
+{
+    uint64_t n;
+    double theta, alpha, zetan, eta;
+} Zipf;
+
+/**
+ * @brief command line configuration
+ */
+typedef struct Config
+{
+    size_t minElements, maxElements;
+    int keys[KEY_TYPES];
+    int workloads[WORKLOADS];
+    uint64_t seed;
+    int finger, topDown, augment, stringSet, hash, bloom, buffer;
+    RBBalance balance;
+} Config;
+
+// -------------------------- func declarations -------------------------
+// ------------- general -------------
+/**
+ * @brief xorshift64* random generator
+ * @param state - generator state, must not be 0
+ * @return the next random number
+ */
+static uint64_t nextRandom(uint64_t *state);
+
+/**
+ * @return a uniform double in [0, 1)
+ */
+static double nextUniform(uint64_t *state);
+
+/**
+ * @return monotonic time in seconds
+ */
+static double now(void);
+
+/**
+ * @return the peak resident set size of the process in KB
+ */
+static long peakRssKb(void);
+
+/**
+ * @brief a FreeFunc that leaves the data to its owner
+ */
+static void freeNothing(void *data);
+
+/**
+ * @brief CompareFunc for int keys
+ */
+static int intCompare(const void *a, const void *b);
+
+/**
+ * @brief HashFuncs for int and string keys
+ */
+static size_t intHash(const void *data);
+static size_t stringHash(const void *data);
+
+/**
+ * @brief shuffles an index array in place
+ */
+static void shuffle(size_t *order, size_t n, uint64_t *state);
+
+// ------------- histogram -------------
+/**
+ * @brief adds a single latency sample
+ */
+static void recordLatency(Histogram *histogram, double seconds);
+
+/**
+ * @return the latency (ns) below which @fraction of the samples fall
+ */
+static double percentile(const Histogram *histogram, double fraction);
+
+/**
+ * @brief prints a histogram (and the tree counters of the phase, if compiled in) as a single JSON
+ * line, then resets the histogram and the counters for the next phase.
+ */
+static void report(const Config *config, KeyType type, Workload workload, size_t n, const char *op,
+                   Histogram *histogram, uint64_t operations, RBTree *tree);
+
+// --------------- keys ----------------
+/**
+ * @brief builds n ordered keys of the given type
+ * @return 0 on failure, other on success
+ */
+static int makeKeys(KeySet *set, KeyType type, size_t n, uint64_t *state);
+
+/**
+ * @brief frees the memory of a key set
+ */
+static void freeKeys(KeySet *set);
+
+/**
+ * @return the comparator matching a key type
+ */
+static CompareFunc keyCompare(KeyType type);
+
+/**
+ * @return the hash function matching a key type, NULL for Vector keys
+ */
+static HashFunc keyHash(KeyType type);
+
+// --------------- zipf ----------------
+/**
+ * @brief prepares a zipf generator over [0, n)
+ */
+static void zipfInit(Zipf *zipf, uint64_t n, double theta);
+
+/**
+ * @return a zipf distributed index in [0, n), scattered over the key space so the hot keys are
+ * not all neighbours.
+ */
+static size_t zipfNext(const Zipf *zipf, uint64_t *state);
+
+// --------------- runs ----------------
+/**
+ * @brief runs a single (key type, workload, size) benchmark and reports it
+ * @return 0 on failure, other on success
+ */
+static int runBenchmark(const Config *config, KeyType type, Workload workload, size_t n);
+
+/**
+ * @brief runs the insert, contains and delete phases of a benchmark on a top-down tree, all in
+ * the given order, and reports them as insert_topdown, contains_topdown and delete_topdown
+ * @return 0 on failure, other on success
+ */
+static int runTopDown(const Config *config, const KeySet *set, Workload workload,
+                      const size_t *order, Histogram *histogram);
+
+/**
+ * @brief runs a read-through cache (RBCache.h) of a tenth of the keys under zipf lookups: every
+ * miss puts the key in. reports it as cache_get.
+ * @return 0 on failure, other on success
+ */
+static int runCache(const Config *config, const KeySet *set, const Zipf *zipf, uint64_t *state,
+                    Histogram *histogram);
+
+/**
+ * @brief a forEachFunc that counts the visited items
+ */
+static int countItem(const void *object, void *args);
+
+/**
+ * @brief parses the command line
+ * @return 0 on failure, other on success
+ */
+static int parseArgs(int argc, char *argv[], Config *config);
+
+// ------------------------------ functions -----------------------------
+// -------------- general --------------
+static uint64_t nextRandom(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ULL;
+}
+
+static double nextUniform(uint64_t *state)
+{
+    return (double) (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / NANO;
+}
+
+static long peakRssKb(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return -1;
+    }
+    return usage.ru_maxrss;
+}
+
+static void freeNothing(void *data)
+{
+    (void) data;
+}
+
+static int intCompare(const void *a, const void *b)
+{
+    int first = *(const int *) a;
+    int second = *(const int *) b;
+    return (first > second) - (first < second);
+}
+
+static size_t intHash(const void *data)
+{
+    return (size_t) *(const int *) data;
+}
+
+static size_t stringHash(const void *data)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *c = (const unsigned char *) data; *c != '\0'; c++)
+    {
+        hash = (hash ^ *c) * 1099511628211ULL;
+    }
+    return (size_t) hash;
+}
+
+static void shuffle(size_t *order, size_t n, uint64_t *state)
+{
+    for (size_t i = n; i > 1; i--)
+    {
+        size_t j = (size_t) (nextRandom(state) % i);
+        size_t temp = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = temp;
+    }
+}
+
+// -------------- histogram --------------
+static void recordLatency(Histogram *histogram, double seconds)
+{
+    uint64_t ns = (uint64_t) (seconds * NANO);
+    size_t index = (size_t) ns;
+    if (ns >= SUB_BUCKETS)
+    {
+        int exponent = 63 - __builtin_clzll(ns);
+        index = (size_t) (exponent - SUB_BITS) * SUB_BUCKETS + (size_t) (ns >> (exponent - SUB_BITS));
+    }
+    histogram->buckets[index]++;
+    histogram->count++;
+    histogram->totalSeconds += seconds;
+}
+
+static double percentile(const Histogram *histogram, double fraction)
+{
+    uint64_t target = (uint64_t) ceil(fraction * (double) histogram->count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= target && histogram->buckets[i] != 0)
+        {
+            if (i < 2 * SUB_BUCKETS)
+            {
+                return (double) i;
+            }
+            // upper bound of the bucket
+            size_t exponent = i / SUB_BUCKETS + SUB_BITS - 1;
+            uint64_t mantissa = i % SUB_BUCKETS + SUB_BUCKETS + 1;
+            return (double) (mantissa << (exponent - SUB_BITS));
+        }
+    }
+    return 0;
+}
+
+static void report(const Config *config, KeyType type, Workload workload, size_t n, const char *op,
+                   Histogram *histogram, uint64_t operations, RBTree *tree)
+{
+    double opsPerSec = histogram->totalSeconds > 0 ? (double) operations / histogram->totalSeconds : 0;
+    printf("{\"key\":\"%s\",\"workload\":\"%s\",\"n\":%zu,\"op\":\"%s\",\"ops\":%llu,"
+           "\"seconds\":%.6f,\"ops_per_sec\":%.0f,\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"p999_ns\":%.0f,"
+           "\"peak_rss_kb\":%ld,\"seed\":%llu,\"finger\":%d,\"balance\":\"%s\"",
+           keyTypeNames[type], workloadNames[workload], n, op, (unsigned long long) operations,
+           histogram->totalSeconds, opsPerSec, percentile(histogram, 0.5),
+           percentile(histogram, 0.99), percentile(histogram, 0.999), peakRssKb(),
+           (unsigned long long) config->seed, config->finger,
+           balanceNames[config->balance]);
+    RBTreeStats stats;
+    if (RBTreeGetStats(tree, &stats))
+    {
+        printf(",\"comparisons\":%lu,\"rotations\":%lu,\"recolors\":%lu,\"allocations\":%lu,"
+               "\"frees\":%lu,\"max_depth\":%lu,\"avg_depth\":%.2f",
+               stats.comparisons, stats.leftRotations + stats.rightRotations, stats.recolors,
+               stats.allocations, stats.frees, stats.maxDepth, stats.averageDepth);
+    }
+    printf("}\n");
+    fflush(stdout);
+    memset(histogram, 0, sizeof(Histogram));
+    RBTreeResetStats(tree);
+}
+
+// ---------------- keys -----------------
+static int makeKeys(KeySet *set, KeyType type, size_t n, uint64_t *state)
+{
+    set->type = type, set->n = n;
+    set->storage = NULL, set->strings = NULL;
+    set->keys = (void **) malloc(sizeof(void *) * n);
+    if (set->keys == NULL)
+    {
+        return 0;
+    }
+
+    switch (type)
+    {
+        case INT_KEYS:
+        {
+            int *ints = (int *) malloc(sizeof(int) * n);
+            if (ints == NULL)
+            {
+                break;
+            }
+            set->storage = ints;
+            for (size_t i = 0; i < n; i++)
+            {
+                // even values only, so odd values are guaranteed misses
+                ints[i] = (int) (2 * i);
+                set->keys[i] = &ints[i];
+            }
+            return 1;
+        }
+        case STRING_KEYS:
+        {
+            // "k%010zu" keeps the order, the random suffix gives 12-27 byte keys
+            const size_t maxLen = 28;
+            char *strings = (char *) malloc(maxLen * n);
+            if (strings == NULL)
+            {
+                break;
+            }
+            set->strings = strings;
+            for (size_t i = 0; i < n; i++)
+            {
+                char *key = strings + i * maxLen;
+                int len = sprintf(key, "k%010zu", i);
+                int suffix = (int) (nextRandom(state) % (maxLen - len - 1));
+                for (int j = 0; j < suffix; j++)
+                {
+                    key[len + j] = (char) ('a' + nextRandom(state) % 26);
+                }
+                key[len + suffix] = '\0';
+                set->keys[i] = key;
+            }
+            return 1;
+        }
+        case VECTOR_KEYS:
+        {
+            Vector *vectors = (Vector *) malloc(sizeof(Vector) * n);
+            double *values = (double *) malloc(sizeof(double) * VECTOR_LEN * n);
+            if (vectors == NULL || values == NULL)
+            {
+                free(vectors);
+                free(values);
+                break;
+            }
+            set->storage = vectors, set->strings = (char *) values;
+            for (size_t i = 0; i < n; i++)
+            {
+                double *v = values + i * VECTOR_LEN;
+                v[0] = (double) i;
+                for (int j = 1; j < VECTOR_LEN; j++)
+                {
+                    v[j] = nextUniform(state);
+                }
+                vectors[i].len = VECTOR_LEN;
+                vectors[i].vector = v;
+                vectors[i].norm = VECTOR_NORM_UNKNOWN;
+                set->keys[i] = &vectors[i];
+            }
+            return 1;
+        }
+        default:
+            break;
+    }
+    free(set->keys);
+    set->keys = NULL;
+    return 0;
+}
+
+static void freeKeys(KeySet *set)
+{
+    free(set->keys);
+    free(set->storage);
+    free(set->strings);
+    set->keys = NULL, set->storage = NULL, set->strings = NULL;
+}
+
+static CompareFunc keyCompare(KeyType type)
+{
+    switch (type)
+    {
+        case STRING_KEYS:
+            return stringCompare;
+        case VECTOR_KEYS:
+            return vectorCompare1By1;
+        default:
+            return intCompare;
+    }
+}
+
+static HashFunc keyHash(KeyType type)
+{
+    switch (type)
+    {
+        case STRING_KEYS:
+            return stringHash;
+        case VECTOR_KEYS:
+            return NULL;
+        default:
+            return intHash;
+    }
+}
+
+// ---------------- zipf -----------------
+static void zipfInit(Zipf *zipf, uint64_t n, double theta)
+{
+    double zeta2 = 1.0 + pow(0.5, theta);
+    zipf->n = n, zipf->theta = theta;
+    zipf->zetan = 0;
+    for (uint64_t i = 1; i <= n; i++)
+    {
+        zipf->zetan += 1.0 / pow((double) i, theta);
+    }
+    zipf->alpha = 1.0 / (1.0 - theta);
+    zipf->eta = (1.0 - pow(2.0 / (double) n, 1.0 - theta)) / (1.0 - zeta2 / zipf->zetan);
+}
+
+static size_t zipfNext(const Zipf *zipf, uint64_t *state)
+{
+    double u = nextUniform(state);
+    double uz = u * zipf->zetan;
+    uint64_t rank;
+    if (uz < 1.0)
+    {
+        rank = 0;
+    }
+    else if (uz < 1.0 + pow(0.5, zipf->theta))
+    {
+        rank = 1;
+    }
+    else
+    {
+        rank = (uint64_t) ((double) zipf->n * pow(zipf->eta * u - zipf->eta + 1.0, zipf->alpha));
+    }
+    if (rank >= zipf->n)
+    {
+        rank = zipf->n - 1;
+    }
+    return (size_t) ((rank * SCATTER_PRIME) % zipf->n);
+}
+
+// ---------------- runs -----------------
+static int countItem(const void *object, void *args)
+{
+    (void) object;
+    (*(uint64_t *) args)++;
+    return 1;
+}
+
+static int runBenchmark(const Config *config, KeyType type, Workload workload, size_t n)
+{
+    uint64_t state = config->seed ^ (n * 31 + (size_t) type * 7 + (size_t) workload);
+    if (state == 0)
+    {
+        state = 1;
+    }
+    KeySet set;
+    if (!makeKeys(&set, type, n, &state))
+    {
+        return 0;
+    }
+    size_t *order = (size_t *) malloc(sizeof(size_t) * n);
+    Histogram *histogram = (Histogram *) malloc(sizeof(Histogram));
+    RBTree *tree;
+    if (type == VECTOR_KEYS && config->augment)
+    {
+        tree = newMaxNormVectorTree(freeNothing);
+    }
+    else if (type == STRING_KEYS && config->stringSet && workload != QUEUE)
+    {
+        tree = newRBStringSet();
+    }
+    else
+    {
+        tree = newRBTree(keyCompare(type), freeNothing);
+    }
+    if (order == NULL || histogram == NULL || tree == NULL)
+    {
+        free(order);
+        free(histogram);
+        freeRBTree(&tree);
+        freeKeys(&set);
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        order[i] = i;
+    }
+    RBTreeSetFinger(tree, config->finger);
+    RBTreeSetBalance(tree, config->balance);
+    if (config->hash)
+    {
+        RBTreeSetHashIndex(tree, keyHash(type));
+    }
+    if (config->bloom)
+    {
+        RBTreeSetBloomFilter(tree, keyHash(type), 0);
+    }
+    if (workload == NEAR_SORTED)
+    {
+        for (size_t i = 0; i < n; i += NEAR_SORTED_WINDOW)
+        {
+            shuffle(order + i, n - i < NEAR_SORTED_WINDOW ? n - i : NEAR_SORTED_WINDOW, &state);
+        }
+    }
+    else if (workload != SEQUENTIAL)
+    {
+        // the queue only preloads the first half, the second half is pushed in order later
+        shuffle(order, workload == QUEUE ? n / 2 : n, &state);
+    }
+    Zipf zipf;
+    if (workload == ZIPF || workload == MIXED)
+    {
+        zipfInit(&zipf, n, ZIPF_THETA);
+    }
+
+    // mixed workload preloads half of the keys and runs 80% contains, 10% insert, 10% delete
+    size_t inserted = workload == MIXED || workload == QUEUE ? n / 2 : n;
+    memset(histogram, 0, sizeof(Histogram));
+    if (config->buffer)
+    {
+        RBTreeSetWriteBuffer(tree, WRITE_BUFFER_ITEMS, keyHash(type));
+    }
+    for (size_t i = 0; i < inserted; i++)
+    {
+        double start = now();
+        RBTreeBufferedInsert(tree, set.keys[order[i]]);
+        recordLatency(histogram, now() - start);
+    }
+    if (config->buffer)
+    {
+        // the last keys are only in the buffer, the flush is a part of inserting them
+        double start = now();
+        RBTreeSetWriteBuffer(tree, 0, NULL);
+        histogram->totalSeconds += now() - start;
+    }
+    report(config, type, workload, n, "insert", histogram, histogram->count, tree);
+
+    for (int threads = 1; threads <= VALIDATE_THREADS; threads += VALIDATE_THREADS - 1)
+    {
+        RBValidationReport validation;
+        double start = now();
+        int valid = validateRBTreeParallel(tree, threads, &validation);
+        recordLatency(histogram, now() - start);
+        if (!valid)
+        {
+            fprintf(stderr, "invalid tree: %s\n", validation.message);
+            free(order);
+            free(histogram);
+            freeRBTree(&tree);
+            freeKeys(&set);
+            return 0;
+        }
+        report(config, type, workload, n, threads == 1 ? "validate" : "validate_parallel", histogram,
+               validation.nodes, tree);
+    }
+    for (int threads = 1; threads <= VALIDATE_THREADS; threads += VALIDATE_THREADS - 1)
+    {
+        double start = now();
+        RBTree *clone = RBTreeCloneParallel(tree, NULL, threads);
+        recordLatency(histogram, now() - start);
+        report(config, type, workload, n, threads == 1 ? "clone" : "clone_parallel", histogram,
+               clone != NULL ? clone->size : 0, tree);
+        freeRBTree(&clone);
+    }
+
+    if (workload == MIXED)
+    {
+        Histogram *reads = histogram;
+        Histogram *writes = (Histogram *) calloc(1, sizeof(Histogram));
+        if (writes == NULL)
+        {
+            free(order);
+            free(histogram);
+            freeRBTree(&tree);
+            freeKeys(&set);
+            return 0;
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            uint64_t dice = nextRandom(&state) % 10;
+            void *key = set.keys[zipfNext(&zipf, &state)];
+            double start = now();
+            if (dice < 8)
+            {
+                RBTreeContains(tree, key);
+                recordLatency(reads, now() - start);
+                continue;
+            }
+            if (dice == 8)
+            {
+                insertToRBTree(tree, key);
+            }
+            else
+            {
+                deleteFromRBTree(tree, key);
+            }
+            recordLatency(writes, now() - start);
+        }
+        // the counters of the whole mixed phase are reported on the mixed_write line
+        report(config, type, workload, n, "mixed_read", reads, reads->count, NULL);
+        report(config, type, workload, n, "mixed_write", writes, writes->count, tree);
+        free(writes);
+    }
+    else if (workload == QUEUE)
+    {
+        // every step pops the smallest item and pushes a later one (only the pop is timed). the
+        // first quarter pops by walking down the left spine and deleting, the second with
+        // RBTreePopMin.
+        for (size_t i = n / 2; i < n; i++)
+        {
+            double start = now();
+            if (i < n / 2 + n / 4)
+            {
+                Node *min = tree->root;
+                while (min->left != NULL)
+                {
+                    min = min->left;
+                }
+                deleteFromRBTree(tree, min->data);
+            }
+            else
+            {
+                RBTreePopMin(tree);
+            }
+            recordLatency(histogram, now() - start);
+            insertToRBTree(tree, set.keys[i]);
+            if (i + 1 == n / 2 + n / 4)
+            {
+                report(config, type, workload, n, "pop_search", histogram, histogram->count, tree);
+            }
+        }
+        report(config, type, workload, n, "pop_min", histogram, histogram->count, tree);
+    }
+    else
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t index = workload == ZIPF ? zipfNext(&zipf, &state) : order[i];
+            double start = now();
+            RBTreeContains(tree, set.keys[index]);
+            recordLatency(histogram, now() - start);
+        }
+        report(config, type, workload, n, "contains", histogram, histogram->count, tree);
+
+        // the same kind of lookups, LOOKUP_BATCH at a time (the latencies are of whole batches)
+        const void **batch = (const void **) malloc(sizeof(void *) * LOOKUP_BATCH);
+        int *results = (int *) malloc(sizeof(int) * LOOKUP_BATCH);
+        for (size_t first = 0; batch != NULL && results != NULL && first < n; first += LOOKUP_BATCH)
+        {
+            size_t count = n - first < LOOKUP_BATCH ? n - first : LOOKUP_BATCH;
+            for (size_t i = 0; i < count; i++)
+            {
+                batch[i] = set.keys[workload == ZIPF ? zipfNext(&zipf, &state) : order[first + i]];
+            }
+            double start = now();
+            RBTreeContainsBatch(tree, batch, count, results);
+            recordLatency(histogram, now() - start);
+        }
+        report(config, type, workload, n, "contains_batch", histogram, n, tree);
+        free(batch);
+        free(results);
+
+        if (type == INT_KEYS)
+        {
+            // the odd values are never inserted, so every one of these lookups misses
+            for (size_t i = 0; i < n; i++)
+            {
+                int missing = 2 * (int) order[i] + 1;
+                double start = now();
+                RBTreeContains(tree, &missing);
+                recordLatency(histogram, now() - start);
+            }
+            report(config, type, workload, n, "contains_miss", histogram, histogram->count, tree);
+        }
+    }
+
+    uint64_t visited = 0;
+    for (int round = 0; round < FOR_EACH_ROUNDS; round++)
+    {
+        double start = now();
+        forEachRBTree(tree, countItem, &visited);
+        recordLatency(histogram, now() - start);
+    }
+    report(config, type, workload, n, "forEach", histogram, visited, tree);
+
+    if (type == VECTOR_KEYS)
+    {
+        for (int round = 0; round < FOR_EACH_ROUNDS; round++)
+        {
+            double start = now();
+            Vector *max = findMaxNormVectorInTree(tree);
+            recordLatency(histogram, now() - start);
+            if (max != NULL)
+            {
+                freeVector(max);
+            }
+        }
+        report(config, type, workload, n, "max_norm", histogram, (uint64_t) n * FOR_EACH_ROUNDS, tree);
+    }
+
+    if (workload != SEQUENTIAL && workload != NEAR_SORTED)
+    {
+        shuffle(order, n, &state);
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        double start = now();
+        deleteFromRBTree(tree, set.keys[order[i]]);
+        recordLatency(histogram, now() - start);
+    }
+    report(config, type, workload, n, "delete", histogram, histogram->count, tree);
+
+    int result = 1;
+    if (config->topDown && workload != MIXED && workload != QUEUE)
+    {
+        result = runTopDown(config, &set, workload, order, histogram);
+    }
+    if (result && workload == ZIPF && type == INT_KEYS)
+    {
+        result = runCache(config, &set, &zipf, &state, histogram);
+    }
+
+    free(order);
+    free(histogram);
+    freeRBTree(&tree);
+    freeKeys(&set);
+    return result;
+}
+
+static int runTopDown(const Config *config, const KeySet *set, Workload workload,
+                      const size_t *order, Histogram *histogram)
+{
+    TDTree *tree = newTDTree(keyCompare(set->type), NULL);
+    if (tree == NULL)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < set->n; i++)
+    {
+        double start = now();
+        insertToTDTree(tree, set->keys[order[i]]);
+        recordLatency(histogram, now() - start);
+    }
+    report(config, set->type, workload, set->n, "insert_topdown", histogram, histogram->count, NULL);
+    for (size_t i = 0; i < set->n; i++)
+    {
+        double start = now();
+        TDTreeContains(tree, set->keys[order[i]]);
+        recordLatency(histogram, now() - start);
+    }
+    report(config, set->type, workload, set->n, "contains_topdown", histogram, histogram->count,
+           NULL);
+    for (size_t i = 0; i < set->n; i++)
+    {
+        double start = now();
+        deleteFromTDTree(tree, set->keys[order[i]]);
+        recordLatency(histogram, now() - start);
+    }
+    report(config, set->type, workload, set->n, "delete_topdown", histogram, histogram->count, NULL);
+    freeTDTree(&tree);
+    return 1;
+}
+
+static int runCache(const Config *config, const KeySet *set, const Zipf *zipf, uint64_t *state,
+                    Histogram *histogram)
+{
+    RBCache *cache = newRBCache(keyCompare(set->type), NULL, NULL, set->n / CACHE_FRACTION + 1, 0);
+    if (cache == NULL)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < set->n; i++)
+    {
+        void *key = set->keys[zipfNext(zipf, state)];
+        double start = now();
+        if (RBCacheGet(cache, key) == NULL)
+        {
+            RBCachePut(cache, key, key, 1, RB_CACHE_NO_EXPIRY);
+        }
+        recordLatency(histogram, now() - start);
+    }
+    report(config, set->type, ZIPF, set->n, "cache_get", histogram, histogram->count, NULL);
+    freeRBCache(&cache);
+    return 1;
+}
+
+static int parseArgs(int argc, char *argv[], Config *config)
+{
+    config->minElements = DEFAULT_MIN_ELEMENTS;
+    config->maxElements = DEFAULT_MAX_ELEMENTS;
+    config->seed = 42;
+    config->finger = 0, config->topDown = 0, config->augment = 0, config->stringSet = 0;
+    config->hash = 0, config->bloom = 0, config->buffer = 0;
+    config->balance = RB_BALANCE_RED_BLACK;
+    for (int i = 0; i < KEY_TYPES; i++)
+    {
+        config->keys[i] = 1;
+    }
+    for (int i = 0; i < WORKLOADS; i++)
+    {
+        config->workloads[i] = 1;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--min=", 6) == 0)
+        {
+            config->minElements = (size_t) strtoull(arg + 6, NULL, 10);
+        }
+        else if (strncmp(arg, "--max=", 6) == 0)
+        {
+            config->maxElements = (size_t) strtoull(arg + 6, NULL, 10);
+        }
+        else if (strncmp(arg, "--seed=", 7) == 0)
+        {
+            config->seed = strtoull(arg + 7, NULL, 10);
+        }
+        else if (strcmp(arg, "--finger") == 0)
+        {
+            config->finger = 1;
+        }
+        else if (strcmp(arg, "--augment") == 0)
+        {
+            config->augment = 1;
+        }
+        else if (strcmp(arg, "--bloom") == 0)
+        {
+            config->bloom = 1;
+        }
+        else if (strcmp(arg, "--buffer") == 0)
+        {
+            config->buffer = 1;
+        }
+        else if (strcmp(arg, "--hash") == 0)
+        {
+            config->hash = 1;
+        }
+        else if (strcmp(arg, "--strset") == 0)
+        {
+            config->stringSet = 1;
+        }
+        else if (strcmp(arg, "--topdown") == 0)
+        {
+            config->topDown = 1;
+        }
+        else if (strcmp(arg, "--balance=rb") == 0 || strcmp(arg, "--balance=wavl") == 0)
+        {
+            config->balance = strcmp(arg + 10, "wavl") == 0 ? RB_BALANCE_WAVL : RB_BALANCE_RED_BLACK;
+        }
+        else if (strncmp(arg, "--keys=", 7) == 0)
+        {
+            for (int k = 0; k < KEY_TYPES; k++)
+            {
+                config->keys[k] = strstr(arg + 7, keyTypeNames[k]) != NULL;
+            }
+        }
+        else if (strncmp(arg, "--workloads=", 12) == 0)
+        {
+            for (int w = 0; w < WORKLOADS; w++)
+            {
+                config->workloads[w] = strstr(arg + 12, workloadNames[w]) != NULL;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--min=N] [--max=N] [--keys=int,string,vector] "
+                            "[--workloads=seq,random,zipf,mixed,queue,near] [--seed=N] [--finger] "
+                            "[--topdown] [--balance=rb|wavl] [--augment] [--strset] [--hash] "
+                            "[--bloom] [--buffer]\n",
+                    argv[0]);
+            return 0;
+        }
+    }
+    return config->minElements > 0 && config->minElements <= config->maxElements;
+}
+
+int main(int argc, char *argv[])
+{
+    Config config;
+    if (!parseArgs(argc, argv, &config))
+    {
+        return 1;
+    }
+    for (size_t n = config.minElements; n <= config.maxElements; n *= 10)
+    {
+        for (int type = 0; type < KEY_TYPES; type++)
+        {
+            for (int workload = 0; workload < WORKLOADS; workload++)
+            {
+                if (!config.keys[type] || !config.workloads[workload])
+                {
+                    continue;
+                }
+                if (!runBenchmark(&config, (KeyType) type, (Workload) workload, n))
+                {
+                    fprintf(stderr, "failed running %s/%s with %zu elements\n",
+                            keyTypeNames[type], workloadNames[workload], n);
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
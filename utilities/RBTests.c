@@ -0,0 +1,1814 @@
+/**
+ * @file RBTests.c
+ * @author  Inbal Lavi <inbal.lavi1@mail.huji.ac.il>
+ * @version 1.0
+ * @date 3 June 2020
+ *
+ * @brief behavioural tests of the RBTree library
+ *
+ * @section LICENSE
+ * is free and should be used only for good. we do not support the dark side.
+ *
+ * @section DESCRIPTION
+ * every test drives a part of the library and checks what it returns against what it should, and
+ * the tree invariants with validateRBTree. the random ones replay a fixed seed against a plain
+ * array of what should be in the tree. a failed check prints its line and fails its test, the
+ * other tests still run. build and run with make test (under ASan: make test CC="gcc
+ * -fsanitize=address,undefined").
+ */
+// ------------------------------ includes ------------------------------
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include "../RBTree.h"
+#include "../RBTopDown.h"
+#include "../RBCache.h"
+#include "../Structs.h"
+#include "RBUtilities.h"
+
+// -------------------------- const definitions -------------------------
+/**
+ * @brief return value for functions
+ */
+typedef enum FunctionReturn
+{
+    FAIL,
+    SUCCESS
+} FunctionReturn;
+
+/**
+ * @brief boolean values
+ */
+typedef enum bool
+{
+    FALSE,
+    TRUE
+} bool;
+
+/**
+ * @brief the number of different keys and of random steps of the random tests
+ */
+#define KEYS 4000
+#define STEPS 100000
+
+/**
+ * @brief fails the running test if a condition doesn't hold
+ */
+#define CHECK(condition) \
+if (!(condition)) \
+{ \
+    printf("    %s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+    return FAIL; \
+} \
+
+/**
+ * @brief the reader threads and the writer's rounds of the optimistic reads test
+ */
+#define READERS 4
+#define ROUNDS 20
+
+/**
+ * @brief what a diff reported for every key: nothing, added, removed or changed
+ */
+typedef enum Change
+{
+    UNCHANGED, ADDED, REMOVED, CHANGED
+} Change;
+
+/**
+ * @brief a test, returns 0 on failure
+ */
+typedef int (*TestFunc)(void);
+
+/**
+ * @brief the keys, keys[i] == i, so the tests can insert them without allocating
+ */
+static int keys[KEYS];
+
+/**
+ * @brief callocs of more bytes than this fail, so a test can run out of memory (rbtests is linked
+ * with --wrap=calloc)
+ */
+static size_t callocLimit = SIZE_MAX;
+
+// -------------------------- func declarations -------------------------
+/**
+ * @brief CompareFunc of ints
+ */
+int compareInts(const void *a, const void *b);
+
+/**
+ * @brief a new int on the heap, freed with free
+ */
+int *newInt(int value);
+
+/**
+ * @brief forEachFunc that appends an int to an IntList
+ */
+int collectInt(const void *data, void *list);
+
+/**
+ * @brief checks that a tree is valid and holds exactly the keys marked in expected
+ */
+int holdsExactly(const RBTree *tree, const char *expected);
+
+/**
+ * @brief inserts, deletes and looks up random keys in an empty tree of ints, mostly near the
+ * previous key, and checks every result against an array of the keys in the tree
+ */
+int checkRandomSet(RBTree *tree, unsigned seed);
+
+/**
+ * @brief SizeFunc of ints
+ */
+size_t sizeOfInt(const void *data);
+
+/**
+ * @brief checks a multiset of heap ints against counts of its occurrences, under random inserts
+ * and deletes of a few keys
+ */
+int checkMultiset(RBTreeKind kind);
+
+/**
+ * @brief the black height of a subtree of a top-down tree, or -1 if it breaks the red black
+ * rules: a red node with a red child, or two paths down with different numbers of black nodes
+ */
+int topDownBlackHeight(const TDNode *node);
+
+/**
+ * @brief a new Vector of random coordinates from calloc, so its norm is not known yet
+ */
+Vector *newRandomVector(int len);
+
+/**
+ * @brief vectorCompare1By1 and the L2 norm in plain C, to check the kernels against
+ */
+int compareVectorsPlainly(const Vector *a, const Vector *b);
+double normPlainly(const Vector *v);
+
+/**
+ * @brief the largest plain norm among the vectors marked in, between from and to (NULL: no bound)
+ */
+double maxNormPlainly(Vector *const *vectors, const int *in, int n, const Vector *from,
+                      const Vector *to);
+
+/**
+ * @brief a malloc'd copy of a string, NULL on failure
+ */
+char *copyOfString(const char *s);
+
+/**
+ * @brief checks that joining the strings of a tree and writing them to a file both give expected
+ * @return 0 if they don't
+ */
+int joinsTo(const RBTree *tree, const char *sep, const char *expected);
+
+/**
+ * @brief forEachFunc that records an interval in an OverlapVisit
+ */
+int visitOverlap(const void *item, void *args);
+
+/**
+ * @brief orders intervals by low and then by high endpoint, like the default of an interval tree
+ */
+int compareIntervalsPlainly(const RBInterval *a, const RBInterval *b);
+
+/**
+ * @brief checks that the augmented data of every node of a subtree is what augment computes for it
+ * from its item and its children, on a copy of the node so the tree is not touched
+ * @return 0 if some node is out of date
+ */
+int augmentedCorrectly(const RBTree *tree, const Node *node, Node *scratch);
+
+/**
+ * @brief calloc, except that requests of more than callocLimit bytes fail
+ */
+void *__wrap_calloc(size_t count, size_t size);
+void *__real_calloc(size_t count, size_t size);
+
+/**
+ * @brief HashFunc of ints, and one that gives runs of 16 keys the same hash, so the hash index
+ * gets long probe sequences
+ */
+size_t hashInt(const void *data);
+size_t hashIntInRuns(const void *data);
+
+/**
+ * @brief buffers, deletes and looks up random keys in an empty set with a write buffer, and checks
+ * every result against an array of the keys in the set, merged or not
+ */
+int checkBufferedSet(HashFunc hashFunc, unsigned seed);
+
+/**
+ * @brief the body of a reader thread: looks the keys up until the writer is done
+ */
+void *readKeys(void *args);
+
+/**
+ * @brief CopyFuncs of heap ints and of Vectors
+ */
+void *copyInt(const void *data);
+void *copyVector(const void *data);
+
+/**
+ * @brief EqualFunc of ints
+ */
+int equalInts(const void *a, const void *b);
+
+/**
+ * @brief forEachFuncs and ChangeFunc that mark a key of a diff in a Change array
+ */
+int markAdded(const void *data, void *changes);
+int markRemoved(const void *data, void *changes);
+int markChanged(RBHandle before, RBHandle after, void *changes);
+
+/**
+ * @brief ChangeFunc of a map of ints that appends the old and the new value to an IntList
+ */
+int collectValues(RBHandle before, RBHandle after, void *list);
+
+/**
+ * @brief diffs two trees of ints and checks that exactly the keys of expected changed, the way
+ * expected says
+ */
+int diffsExactly(const RBTree *before, const RBTree *after, EqualFunc equalFunc,
+                 const Change *expected);
+
+int testRandomSet(void);
+int testMemoryStats(void);
+int testMap(void);
+int testMultiset(void);
+int testExtractOwnership(void);
+int testFingerSearch(void);
+int testTopDown(void);
+int testWavl(void);
+int testBatchLookups(void);
+int testVectorKernels(void);
+int testMaxNormRange(void);
+int testVectorStore(void);
+int testStringSet(void);
+int testJoinStrings(void);
+int testIntervals(void);
+int testHashIndex(void);
+int testBloomFilter(void);
+int testCache(void);
+int testBufferedInsert(void);
+int testOptimisticReads(void);
+int testClone(void);
+int testDiff(void);
+
+/**
+ * @brief the list of ints collectInt appends to
+ */
+typedef struct IntList
+{
+    int values[KEYS];
+    int count;
+} IntList;
+
+/**
+ * @brief the intervals an overlap query visited: how many, the last one, and if all of them
+ * overlapped [low, high] in order
+ */
+typedef struct OverlapVisit
+{
+    double low, high;
+    const RBInterval *last;
+    int count, ok;
+} OverlapVisit;
+
+/**
+ * @brief what the reader threads of the optimistic reads test share with the writer.
+ * the even keys stay in the tree, the odd ones come and go. done is set once the writer finished
+ * its round, and failed by a reader that missed an even key or found one that was never inserted
+ */
+typedef struct ReadersArgs
+{
+    const RBTree *tree;
+    int done;
+    int failed;
+} ReadersArgs;
+
+// ------------------------------ functions -----------------------------
+int compareInts(const void *a, const void *b)
+{
+    int first = *(const int *) a, second = *(const int *) b;
+    return (first > second) - (first < second);
+}
+
+int *newInt(int value)
+{
+    int *p = (int *) malloc(sizeof(int));
+    if (p != NULL)
+    {
+        *p = value;
+    }
+    return p;
+}
+
+int collectInt(const void *data, void *list)
+{
+    IntList *ints = (IntList *) list;
+    ints->values[ints->count++] = *(const int *) data;
+    return SUCCESS;
+}
+
+int holdsExactly(const RBTree *tree, const char *expected)
+{
+    static IntList found;
+    found.count = 0;
+    CHECK(validateRBTree(tree, NULL))
+    CHECK(forEachRBTree(tree, collectInt, &found))
+    int next = 0;
+    for (int key = 0; key < KEYS; key++)
+    {
+        if (expected[key])
+        {
+            CHECK(next < found.count && found.values[next] == key)
+            next++;
+        }
+    }
+    CHECK(next == found.count && (long unsigned) next == tree->size)
+    return SUCCESS;
+}
+
+int checkRandomSet(RBTree *tree, unsigned seed)
+{
+    static char in[KEYS];
+    memset(in, 0, sizeof(in));
+    srand(seed);
+    int key = 0;
+    for (int step = 0; step < STEPS; step++)
+    {
+        key = rand() % 3 ? (key + rand() % 21 + KEYS - 10) % KEYS : rand() % KEYS;
+        switch (rand() % 4)
+        {
+            case 0:
+                CHECK(insertToRBTree(tree, &keys[key]) == !in[key])
+                in[key] = 1;
+                break;
+            case 1:
+                CHECK(deleteFromRBTree(tree, &keys[key]) == in[key])
+                in[key] = 0;
+                break;
+            case 2:
+                CHECK(RBTreeContains(tree, &keys[key]) == in[key])
+                break;
+            default:
+                CHECK((RBTreeFind(tree, &keys[key]) != NULL) == in[key])
+                break;
+        }
+        if (step % 10000 == 0)
+        {
+            CHECK(holdsExactly(tree, in))
+        }
+    }
+    CHECK(holdsExactly(tree, in))
+    CHECK(tree->min == NULL || *(int *) RBTreePeekMin(tree) == *(int *) tree->min->data)
+    return SUCCESS;
+}
+
+size_t sizeOfInt(const void *data)
+{
+    (void) data;
+    return sizeof(int);
+}
+
+int checkMultiset(RBTreeKind kind)
+{
+    enum
+    {
+        DISTINCT = 100
+    };
+    static long unsigned counts[DISTINCT];
+    static IntList found;
+    memset(counts, 0, sizeof(counts));
+    RBTree *tree = newRBMultiset(compareInts, free, kind);
+    CHECK(tree != NULL)
+    srand(kind);
+    long unsigned total = 0, distinct = 0;
+    for (int step = 0; step < STEPS / 10; step++)
+    {
+        int key = rand() % DISTINCT;
+        if (rand() % 2 && total < KEYS)
+        {
+            // the tree frees an equal item it doesn't chain, so every insert gives it a new one
+            CHECK(insertToRBTree(tree, newInt(key)))
+            distinct += counts[key]++ == 0, total++;
+        }
+        else
+        {
+            CHECK(deleteFromRBTree(tree, &keys[key]) == (counts[key] != 0))
+            if (counts[key] != 0)
+            {
+                distinct -= --counts[key] == 0, total--;
+            }
+        }
+        CHECK(RBTreeCount(tree, &keys[key]) == counts[key])
+    }
+    CHECK(validateRBTree(tree, NULL) && tree->size == distinct)
+
+    // every occurrence in order, and every item once
+    found.count = 0;
+    CHECK(forEachOccurrenceRBTree(tree, collectInt, &found) && (long unsigned) found.count == total)
+    int next = 0;
+    for (int key = 0; key < DISTINCT; key++)
+    {
+        CHECK(RBTreeCount(tree, &keys[key]) == counts[key])
+        for (long unsigned i = 0; i < counts[key]; i++)
+        {
+            CHECK(found.values[next++] == key)
+        }
+    }
+    found.count = 0;
+    CHECK(forEachRBTree(tree, collectInt, &found) && (long unsigned) found.count == distinct)
+    freeRBTree(&tree);
+    return SUCCESS;
+}
+
+int topDownBlackHeight(const TDNode *node)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+    for (int side = 0; side < 2; side++)
+    {
+        if (node->color == RED && node->link[side] != NULL && node->link[side]->color == RED)
+        {
+            return -1;
+        }
+    }
+    int left = topDownBlackHeight(node->link[0]), right = topDownBlackHeight(node->link[1]);
+    if (left < 0 || left != right)
+    {
+        return -1;
+    }
+    return left + (node->color == BLACK);
+}
+
+Vector *newRandomVector(int len)
+{
+    Vector *vector = (Vector *) calloc(1, sizeof(Vector));
+    if (vector == NULL)
+    {
+        return NULL;
+    }
+    vector->vector = (double *) malloc(sizeof(double) * (len + 1));
+    if (vector->vector == NULL)
+    {
+        free(vector);
+        return NULL;
+    }
+    vector->len = len;
+    for (int i = 0; i < len; i++)
+    {
+        // few different values, so vectors often share a prefix
+        vector->vector[i] = (double) (rand() % 5) - 2;
+    }
+    return vector;
+}
+
+int compareVectorsPlainly(const Vector *a, const Vector *b)
+{
+    for (int i = 0; i < a->len && i < b->len; i++)
+    {
+        if (a->vector[i] != b->vector[i])
+        {
+            return a->vector[i] < b->vector[i] ? -1 : 1;
+        }
+    }
+    return (a->len > b->len) - (a->len < b->len);
+}
+
+double normPlainly(const Vector *v)
+{
+    double sum = 0;
+    for (int i = 0; i < v->len; i++)
+    {
+        sum += v->vector[i] * v->vector[i];
+    }
+    return sqrt(sum);
+}
+
+double maxNormPlainly(Vector *const *vectors, const int *in, int n, const Vector *from,
+                      const Vector *to)
+{
+    double best = -1;
+    for (int i = 0; i < n; i++)
+    {
+        if (in[i] && (from == NULL || compareVectorsPlainly(vectors[i], from) >= 0) &&
+            (to == NULL || compareVectorsPlainly(vectors[i], to) <= 0) &&
+            normPlainly(vectors[i]) > best)
+        {
+            best = normPlainly(vectors[i]);
+        }
+    }
+    return best;
+}
+
+char *copyOfString(const char *s)
+{
+    char *copy = (char *) malloc(strlen(s) + 1);
+    return copy == NULL ? NULL : strcpy(copy, s);
+}
+
+int joinsTo(const RBTree *tree, const char *sep, const char *expected)
+{
+    size_t len = strlen(expected) + 1;
+    char *joined = RBTreeJoinStrings(tree, sep, &len);
+    int passed = joined != NULL && len == strlen(expected) && strcmp(joined, expected) == 0;
+    free(joined);
+
+    FILE *out = tmpfile();
+    CHECK(out != NULL)
+    passed = passed && RBTreeWriteStrings(tree, sep, out);
+    passed = passed && (size_t) ftell(out) == strlen(expected);
+    rewind(out);
+    for (size_t i = 0; passed && expected[i] != '\0'; i++)
+    {
+        passed = fgetc(out) == (unsigned char) expected[i];
+    }
+    fclose(out);
+    return passed;
+}
+
+int visitOverlap(const void *item, void *args)
+{
+    OverlapVisit *visit = (OverlapVisit *) args;
+    const RBInterval *interval = (const RBInterval *) item;
+    visit->ok = visit->ok && interval->low <= visit->high && visit->low <= interval->high &&
+                (visit->last == NULL || compareIntervalsPlainly(visit->last, interval) < 0);
+    visit->last = interval;
+    visit->count++;
+    return SUCCESS;
+}
+
+int compareIntervalsPlainly(const RBInterval *a, const RBInterval *b)
+{
+    if (a->low != b->low)
+    {
+        return a->low < b->low ? -1 : 1;
+    }
+    return (a->high > b->high) - (a->high < b->high);
+}
+
+int augmentedCorrectly(const RBTree *tree, const Node *node, Node *scratch)
+{
+    if (node == NULL)
+    {
+        return 1;
+    }
+    memcpy(scratch, node, tree->nodeSize);
+    tree->augment(scratch);
+    if (memcmp((const char *) scratch + sizeof(Node), (const char *) node + sizeof(Node),
+               tree->nodeSize - sizeof(Node)) != 0)
+    {
+        return 0;
+    }
+    return augmentedCorrectly(tree, node->left, scratch) &&
+           augmentedCorrectly(tree, node->right, scratch);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    if (size != 0 && count > callocLimit / size)
+    {
+        return NULL;
+    }
+    return __real_calloc(count, size);
+}
+
+size_t hashInt(const void *data)
+{
+    return (size_t) *(const int *) data;
+}
+
+size_t hashIntInRuns(const void *data)
+{
+    return (size_t) (*(const int *) data / 16);
+}
+
+int checkBufferedSet(HashFunc hashFunc, unsigned seed)
+{
+    static char in[KEYS];
+    memset(in, 0, sizeof(in));
+    RBTree *tree = newRBTree(compareInts, NULL);
+    CHECK(tree != NULL && RBTreeSetWriteBuffer(tree, 64, hashFunc))
+    srand(seed);
+    for (int step = 0; step < STEPS / 4; step++)
+    {
+        int key = rand() % KEYS;
+        switch (rand() % 5)
+        {
+            case 0:
+            case 1:
+                CHECK(RBTreeBufferedInsert(tree, &keys[key]) == !in[key])
+                in[key] = 1;
+                break;
+            case 2:
+                CHECK(deleteFromRBTree(tree, &keys[key]) == in[key])
+                in[key] = 0;
+                break;
+            case 3:
+                CHECK(RBTreeContains(tree, &keys[key]) == in[key])
+                break;
+            default:
+                CHECK(RBHandleData(RBTreeFind(tree, &keys[key])) == (in[key] ? &keys[key] : NULL))
+                break;
+        }
+    }
+    CHECK(RBTreeFlush(tree) && holdsExactly(tree, in))
+    freeRBTree(&tree);
+    return SUCCESS;
+}
+
+void *readKeys(void *args)
+{
+    ReadersArgs *readers = (ReadersArgs *) args;
+    int outside = KEYS + 1;
+    for (int key = 0; !__atomic_load_n(&readers->done, __ATOMIC_ACQUIRE); key = (key + 2) % KEYS)
+    {
+        if (!RBTreeContains(readers->tree, &keys[key]) || RBTreeContains(readers->tree, &outside) ||
+            RBHandleData(RBTreeFind(readers->tree, &keys[key])) != &keys[key])
+        {
+            __atomic_store_n(&readers->failed, TRUE, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+void *copyInt(const void *data)
+{
+    return newInt(*(const int *) data);
+}
+
+void *copyVector(const void *data)
+{
+    const Vector *source = (const Vector *) data;
+    Vector *copy = (Vector *) malloc(sizeof(Vector));
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+    *copy = *source;
+    copy->vector = (double *) malloc(sizeof(double) * (source->len + 1));
+    if (copy->vector == NULL)
+    {
+        free(copy);
+        return NULL;
+    }
+    memcpy(copy->vector, source->vector, sizeof(double) * source->len);
+    return copy;
+}
+
+int equalInts(const void *a, const void *b)
+{
+    return compareInts(a, b) == 0;
+}
+
+int markAdded(const void *data, void *changes)
+{
+    ((Change *) changes)[*(const int *) data] = ADDED;
+    return SUCCESS;
+}
+
+int markRemoved(const void *data, void *changes)
+{
+    ((Change *) changes)[*(const int *) data] = REMOVED;
+    return SUCCESS;
+}
+
+int markChanged(RBHandle before, RBHandle after, void *changes)
+{
+    if (compareInts(RBHandleData(before), RBHandleData(after)) != 0)
+    {
+        return FAIL;
+    }
+    ((Change *) changes)[*(const int *) RBHandleData(before)] = CHANGED;
+    return SUCCESS;
+}
+
+int collectValues(RBHandle before, RBHandle after, void *list)
+{
+    return collectInt(*RBMapValue(before), list) && collectInt(*RBMapValue(after), list);
+}
+
+int diffsExactly(const RBTree *before, const RBTree *after, EqualFunc equalFunc,
+                 const Change *expected)
+{
+    static Change changes[KEYS];
+    memset(changes, 0, sizeof(changes));
+    CHECK(RBTreeDiff(before, after, markAdded, markRemoved, equalFunc, markChanged, changes))
+    CHECK(memcmp(changes, expected, sizeof(changes)) == 0)
+    return SUCCESS;
+}
+
+// ---------------- set ----------------
+int testRandomSet(void)
+{
+    RBTree *tree = newRBTree(compareInts, NULL);
+    CHECK(tree != NULL)
+    int passed = checkRandomSet(tree, 1);
+    freeRBTree(&tree);
+    return passed;
+}
+
+// ------------ memory stats ------------
+int testMemoryStats(void)
+{
+    RBTree *map = newRBMap(compareInts, NULL, NULL);
+    CHECK(map != NULL)
+    for (int i = 0; i < 100; i++)
+    {
+        CHECK(RBMapPut(map, &keys[i], i % 4 == 0 ? NULL : &keys[i]))
+    }
+    // the keys and the 75 values that are not NULL
+    RBMemoryStats stats = RBTreeMemoryStats(map, sizeOfInt);
+    CHECK(stats.nodes == 100 && stats.payloadBytes == 175 * sizeof(int))
+    CHECK(stats.nodeBytes == 100 * map->nodeSize)
+    CHECK(stats.allocatorOverhead == 100 * sizeof(size_t))
+    CHECK(stats.allocatorBytes == stats.nodeBytes + stats.allocatorOverhead + stats.slackBytes)
+    CHECK(stats.height >= stats.optimalHeight && stats.optimalHeight == 7)
+    CHECK(RBTreeMemoryStats(map, NULL).payloadBytes == 0)
+
+    // a clone is one block, where the deleted nodes leave slack and the new ones are not
+    RBTree *clone = RBTreeClone(map, NULL);
+    CHECK(clone != NULL)
+    stats = RBTreeMemoryStats(clone, NULL);
+    CHECK(stats.allocatorOverhead == sizeof(size_t) && stats.slackBytes == 0)
+    for (int i = 0; i < 10; i++)
+    {
+        CHECK(deleteFromRBTree(clone, &keys[i]))
+    }
+    stats = RBTreeMemoryStats(clone, NULL);
+    CHECK(stats.nodes == 90 && stats.slackBytes == 10 * clone->nodeSize)
+    CHECK(RBMapPut(clone, &keys[500], NULL))
+    stats = RBTreeMemoryStats(clone, NULL);
+    CHECK(stats.nodes == 91 && stats.allocatorOverhead == 2 * sizeof(size_t))
+    CHECK(stats.slackBytes >= 10 * clone->nodeSize)
+    CHECK(stats.allocatorBytes == stats.nodeBytes + stats.allocatorOverhead + stats.slackBytes)
+    freeRBTree(&clone);
+    freeRBTree(&map);
+    CHECK(RBTreeMemoryStats(NULL, NULL).nodes == 0)
+    return SUCCESS;
+}
+
+// ---------------- map ----------------
+int testMap(void)
+{
+    RBTree *map = newRBMap(compareInts, NULL, free);
+    CHECK(map != NULL)
+    for (int i = 0; i < 100; i++)
+    {
+        CHECK(RBMapPut(map, &keys[i], i % 10 == 0 ? NULL : newInt(i)))
+    }
+    // a NULL value is still found, and told apart from a missing key
+    void *value = &keys[0];
+    CHECK(RBMapGet(map, &keys[10], &value) && value == NULL)
+    CHECK(!RBMapGet(map, &keys[100], &value))
+    CHECK(RBMapGet(map, &keys[11], NULL))
+    CHECK(RBMapGet(map, &keys[11], &value) && *(int *) value == 11)
+
+    // an update or a put of an existing key frees the old value in place
+    CHECK(RBMapUpdate(map, &keys[11], newInt(-11)))
+    CHECK(RBMapGet(map, &keys[11], &value) && *(int *) value == -11)
+    CHECK(RBMapPut(map, &keys[12], newInt(-12)) && map->size == 100)
+    CHECK(RBMapGet(map, &keys[12], &value) && *(int *) value == -12)
+    CHECK(!RBMapUpdate(map, &keys[200], NULL))
+    CHECK(deleteFromRBTree(map, &keys[13]) && !RBMapGet(map, &keys[13], NULL))
+    CHECK(validateRBTree(map, NULL) && map->size == 99)
+    freeRBTree(&map);
+    return SUCCESS;
+}
+
+// -------------- multiset --------------
+int testMultiset(void)
+{
+    CHECK(checkMultiset(RB_MULTISET_COUNTED))
+    CHECK(checkMultiset(RB_MULTISET_CHAINED))
+    CHECK(newRBMultiset(compareInts, NULL, RB_MAP) == NULL)
+
+    // a counted multiset keeps the first of the equal items, and counts the others
+    RBTree *counted = newRBMultiset(compareInts, NULL, RB_MULTISET_COUNTED);
+    CHECK(counted != NULL)
+    int first = 5, second = 5;
+    CHECK(insertToRBTree(counted, &first) && insertToRBTree(counted, &second))
+    CHECK(RBHandleData(RBTreeFind(counted, &keys[5])) == &first)
+    CHECK(RBTreeCount(counted, &keys[5]) == 2 && RBTreeCount(counted, &keys[6]) == 0)
+    freeRBTree(&counted);
+    return SUCCESS;
+}
+
+// ------------- ownership -------------
+int testExtractOwnership(void)
+{
+    RBTree *set = newRBTree(compareInts, free);
+    CHECK(set != NULL)
+    for (int i = 0; i < 10; i++)
+    {
+        CHECK(insertToRBTree(set, newInt(i)))
+    }
+    // the items come back to the caller, who frees them
+    int *item = (int *) RBTreePopMin(set);
+    CHECK(item != NULL && *item == 0)
+    free(item);
+    item = (int *) RBTreePopMax(set);
+    CHECK(item != NULL && *item == 9)
+    free(item);
+    item = (int *) RBTreeExtract(set, &keys[5]);
+    CHECK(item != NULL && *item == 5 && set->size == 7)
+    free(item);
+    CHECK(RBTreeExtract(set, &keys[5]) == NULL)
+
+    // a handle stays valid while other items come and go
+    RBHandle handle = RBTreeFind(set, &keys[3]);
+    CHECK(handle != NULL && *(int *) RBHandleData(handle) == 3)
+    CHECK(deleteFromRBTree(set, &keys[4]) && insertToRBTree(set, newInt(4)))
+    item = (int *) RBTreeExtractHandle(set, handle);
+    CHECK(item != NULL && *item == 3 && !RBTreeContains(set, &keys[3]))
+    free(item);
+    handle = RBTreeFind(set, &keys[6]);
+    CHECK(RBTreeEraseHandle(set, handle) && set->size == 5 && validateRBTree(set, NULL))
+    freeRBTree(&set);
+
+    // a node that owns more than its item can't be handed out whole
+    RBTree *map = newRBMap(compareInts, NULL, free);
+    RBTree *chained = newRBMultiset(compareInts, free, RB_MULTISET_CHAINED);
+    CHECK(map != NULL && chained != NULL)
+    CHECK(RBMapPut(map, &keys[1], newInt(1)))
+    CHECK(insertToRBTree(chained, newInt(1)) && insertToRBTree(chained, newInt(1)))
+    CHECK(RBTreeExtract(map, &keys[1]) == NULL && RBTreePopMin(map) == NULL && map->size == 1)
+    CHECK(RBTreeExtract(chained, &keys[1]) == NULL && RBTreePopMax(chained) == NULL)
+    CHECK(RBTreeCount(chained, &keys[1]) == 2)
+    freeRBTree(&map);
+    freeRBTree(&chained);
+    return SUCCESS;
+}
+
+// ------------ finger search ------------
+int testFingerSearch(void)
+{
+    RBTree *tree = newRBTree(compareInts, NULL);
+    CHECK(tree != NULL)
+    RBTreeSetFinger(tree, TRUE);
+    int passed = checkRandomSet(tree, 2);
+    freeRBTree(&tree);
+    return passed;
+}
+
+// -------------- top down --------------
+int testTopDown(void)
+{
+    static char in[KEYS];
+    static IntList found;
+    memset(in, 0, sizeof(in));
+    TDTree *tree = newTDTree(compareInts, NULL);
+    CHECK(tree != NULL)
+    srand(3);
+    long unsigned size = 0;
+    for (int step = 0; step < STEPS; step++)
+    {
+        int key = rand() % KEYS;
+        switch (rand() % 3)
+        {
+            case 0:
+                CHECK(insertToTDTree(tree, &keys[key]) == !in[key])
+                size += !in[key], in[key] = 1;
+                break;
+            case 1:
+                CHECK(deleteFromTDTree(tree, &keys[key]) == in[key])
+                size -= in[key], in[key] = 0;
+                break;
+            default:
+                CHECK(TDTreeContains(tree, &keys[key]) == in[key])
+                break;
+        }
+        if (step % 1000 == 0 || step == STEPS - 1)
+        {
+            CHECK(tree->root == NULL || tree->root->color == BLACK)
+            CHECK(topDownBlackHeight(tree->root) >= 0 && tree->size == size)
+            found.count = 0;
+            CHECK(forEachTDTree(tree, collectInt, &found) && (long unsigned) found.count == size)
+            for (int i = 0; i < found.count; i++)
+            {
+                CHECK(in[found.values[i]] && (i == 0 || found.values[i - 1] < found.values[i]))
+            }
+        }
+    }
+    freeTDTree(&tree);
+    CHECK(tree == NULL)
+    return SUCCESS;
+}
+
+// ---------------- wavl ----------------
+int testWavl(void)
+{
+    RBTree *tree = newRBTree(compareInts, NULL);
+    CHECK(tree != NULL && RBTreeSetBalance(tree, RB_BALANCE_WAVL))
+    int passed = checkRandomSet(tree, 4);
+    CHECK(passed && tree->root != NULL)
+
+    // the validator checks the ranks of a WAVL tree, and only them
+    RBValidationReport report;
+    CHECK(validateRBTree(tree, &report) && report.blackHeight == 0)
+    CHECK(validateRBTreeParallel(tree, 4, &report) && report.nodes == tree->size)
+    int rank = tree->root->rank;
+    CHECK((long unsigned) 1 << (rank / 2) <= tree->size + 1)
+    tree->root->rank += 2;
+    CHECK(!validateRBTree(tree, &report) && report.error == RB_RANK_RULE)
+    CHECK(!validateRBTreeParallel(tree, 4, &report) && report.error == RB_RANK_RULE)
+    tree->root->rank = rank;
+    Node *leaf = tree->root;
+    while (leaf->left != NULL || leaf->right != NULL)
+    {
+        leaf = leaf->left != NULL ? leaf->left : leaf->right;
+    }
+    leaf->rank = 1;
+    CHECK(!validateRBTree(tree, &report) && report.error == RB_RANK_RULE && report.node == leaf)
+    leaf->rank = 0;
+    CHECK(validateRBTree(tree, NULL))
+    freeRBTree(&tree);
+
+    // a red black tree is still checked for its colors
+    tree = newRBTree(compareInts, NULL);
+    CHECK(tree != NULL && RBTreeSetBalance(tree, RB_BALANCE_RED_BLACK))
+    for (int i = 0; i < 100; i++)
+    {
+        CHECK(insertToRBTree(tree, &keys[i]))
+    }
+    CHECK(validateRBTree(tree, &report) && report.blackHeight > 1)
+    tree->root->color = RED;
+    CHECK(!validateRBTree(tree, &report) && report.error == RB_RED_ROOT)
+    tree->root->color = BLACK;
+    CHECK(!RBTreeSetBalance(tree, RB_BALANCE_WAVL))
+    freeRBTree(&tree);
+    return SUCCESS;
+}
+
+// ------------ batch lookups ------------
+int testBatchLookups(void)
+{
+    enum
+    {
+        BATCH = 1000
+    };
+    static const void *batch[BATCH];
+    static int results[BATCH];
+    static RBHandle handles[BATCH];
+    int outside = KEYS;
+    RBTree *tree = newRBTree(compareInts, NULL);
+    CHECK(tree != NULL)
+    srand(5);
+    for (int i = 0; i < KEYS / 2; i++)
+    {
+        insertToRBTree(tree, &keys[rand() % KEYS]);
+    }
+    // sizes around the group size, with hits, misses, NULLs and repeated keys
+    for (size_t n = 0; n <= BATCH; n = n < 40 ? n + 1 : n * 2 + 7)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            int kind = rand() % 10;
+            batch[i] = kind == 0 ? NULL : kind == 1 ? (const void *) &outside
+                                        : kind == 2 && i > 0 ? batch[i - 1] : &keys[rand() % KEYS];
+        }
+        CHECK(RBTreeContainsBatch(tree, batch, n, results))
+        CHECK(RBTreeFindBatch(tree, batch, n, handles))
+        for (size_t i = 0; i < n; i++)
+        {
+            RBHandle single = batch[i] == NULL ? NULL : RBTreeFind(tree, batch[i]);
+            CHECK(!results[i] == !(batch[i] != NULL && RBTreeContains(tree, batch[i])))
+            CHECK(handles[i] == single && !results[i] == (single == NULL))
+        }
+    }
+    CHECK(!RBTreeContainsBatch(NULL, batch, 1, results) && !RBTreeFindBatch(tree, NULL, 1, handles))
+    freeRBTree(&tree);
+    return SUCCESS;
+}
+
+// ----------- vector kernels -----------
+int testVectorKernels(void)
+{
+    enum
+    {
+        VECTORS = 200
+    };
+    static Vector *vectors[VECTORS];
+    srand(6);
+    RBTree *tree = newRBTree(vectorCompare1By1, freeVector);
+    CHECK(tree != NULL)
+    for (int i = 0; i < VECTORS; i++)
+    {
+        // lengths around the widths of the SSE2 and AVX2 kernels
+        vectors[i] = newRandomVector(rand() % 19);
+        CHECK(vectors[i] != NULL && vectors[i]->norm == VECTOR_NORM_UNKNOWN)
+    }
+    for (int i = 0; i < VECTORS; i++)
+    {
+        for (int j = 0; j < VECTORS; j++)
+        {
+            int result = vectorCompare1By1(vectors[i], vectors[j]);
+            CHECK((result > 0) - (result < 0) == compareVectorsPlainly(vectors[i], vectors[j]))
+        }
+    }
+
+    // the largest norm of a plain tree, then again once the vectors know their norms
+    const Vector *largest = NULL;
+    for (int i = 0; i < VECTORS; i++)
+    {
+        if (insertToRBTree(tree, vectors[i]))
+        {
+            largest = largest == NULL || normPlainly(vectors[i]) > normPlainly(largest) ? vectors[i]
+                                                                                      : largest;
+        }
+        else
+        {
+            freeVector(vectors[i]);
+        }
+    }
+    for (int round = 0; round < 2; round++)
+    {
+        Vector *max = findMaxNormVectorInTree(tree);
+        CHECK(max != NULL && compareVectorsPlainly(max, largest) == 0)
+        freeVector(max);
+    }
+#ifdef VECTOR_CACHED_NORM
+    // even a search that only reads the vectors keeps their norms
+    CHECK(fabs(largest->norm - normPlainly(largest)) < 1e-9)
+#endif
+
+    // a vector whose values change forgets its norm, and the next search finds it
+    Vector *changed = (Vector *) RBHandleData(RBTreeFind(tree, largest));
+    CHECK(changed != NULL && changed->len > 0)
+    RBTreeExtract(tree, changed);
+    changed->vector[0] = 1000;
+    changed->norm = VECTOR_NORM_UNKNOWN;
+    CHECK(insertToRBTree(tree, changed))
+    Vector *max = findMaxNormVectorInTree(tree);
+    CHECK(max != NULL && max->vector[0] == 1000 && max->len == changed->len)
+    freeVector(max);
+    freeRBTree(&tree);
+    return SUCCESS;
+}
+
+// ----------- max norm range -----------
+int testMaxNormRange(void)
+{
+    enum
+    {
+        VECTORS = 300,
+        BOUNDS = 40,
+        QUERIES = 300
+    };
+    static Vector *vectors[VECTORS], *bounds[BOUNDS];
+    static int in[VECTORS];
+    srand(7);
+    RBTree *tree = newMaxNormVectorTree(NULL);
+    CHECK(tree != NULL && maxNormVector(tree) == NULL)
+    CHECK(maxNormVectorInRange(tree, NULL, NULL) == NULL)
+    for (int i = 0; i < VECTORS; i++)
+    {
+        vectors[i] = newRandomVector(1 + rand() % 4);
+        CHECK(vectors[i] != NULL)
+        in[i] = insertToRBTree(tree, vectors[i]);
+    }
+    for (int i = 0; i < BOUNDS; i++)
+    {
+        // bounds that are mostly not in the tree
+        bounds[i] = newRandomVector(1 + rand() % 4);
+        CHECK(bounds[i] != NULL)
+    }
+
+    // the same queries on the full tree, then as it empties
+    for (int round = 0; round < 4; round++)
+    {
+        const Vector *max = maxNormVector(tree);
+        double expected = maxNormPlainly(vectors, in, VECTORS, NULL, NULL);
+        CHECK(max == NULL ? expected < 0 : fabs(normPlainly(max) - expected) < 1e-9)
+        for (int query = 0; query < QUERIES; query++)
+        {
+            const Vector *from = rand() % 8 == 0 ? NULL : bounds[rand() % BOUNDS];
+            const Vector *to = rand() % 8 == 0 ? NULL : bounds[rand() % BOUNDS];
+            max = maxNormVectorInRange(tree, from, to);
+            expected = maxNormPlainly(vectors, in, VECTORS, from, to);
+            CHECK(max == NULL ? expected < 0 : fabs(normPlainly(max) - expected) < 1e-9)
+            CHECK(max == NULL || ((from == NULL || compareVectorsPlainly(max, from) >= 0) &&
+                                  (to == NULL || compareVectorsPlainly(max, to) <= 0)))
+        }
+        for (int i = 0; i < VECTORS; i++)
+        {
+            if (in[i] && rand() % 3 == 0)
+            {
+                CHECK(deleteFromRBTree(tree, vectors[i]))
+                in[i] = 0;
+            }
+        }
+        CHECK(validateRBTree(tree, NULL))
+    }
+    freeRBTree(&tree);
+    for (int i = 0; i < VECTORS; i++)
+    {
+        freeVector(vectors[i]);
+    }
+    for (int i = 0; i < BOUNDS; i++)
+    {
+        freeVector(bounds[i]);
+    }
+    return SUCCESS;
+}
+
+// ------------ vector store ------------
+int testVectorStore(void)
+{
+    enum
+    {
+        VECTORS = 5000,
+        LONGEST = 40,
+        HUGE_LEN = 20000
+    };
+    static Vector *stored[VECTORS];
+    static double values[HUGE_LEN + 100];
+    srand(8);
+    VectorStore *store = newVectorStore();
+    CHECK(store != NULL)
+    CHECK(vectorStoreAdd(NULL, values, 1) == NULL && vectorStoreAdd(store, values, -1) == NULL)
+    CHECK(vectorStoreAdd(store, NULL, 1) == NULL)
+    for (int i = 0; i < HUGE_LEN + 100; i++)
+    {
+        values[i] = (double) (rand() % 7) - 3;
+    }
+
+    // enough vectors for many blocks, and some larger than a whole block in between
+    for (int i = 0; i < VECTORS; i++)
+    {
+        int len = i % 1000 == 999 ? HUGE_LEN : rand() % LONGEST;
+        stored[i] = vectorStoreAdd(store, values + i % 100, len);
+        CHECK(stored[i] != NULL && stored[i]->len == len)
+        CHECK(memcmp(stored[i]->vector, values + i % 100, sizeof(double) * len) == 0)
+        CHECK(((uintptr_t) stored[i]->vector & 31) == 0)
+    }
+    // no vector shares memory with another, each still holds what was copied in
+    for (int i = 0; i < VECTORS; i++)
+    {
+        for (int j = 0; j < stored[i]->len; j++)
+        {
+            stored[i]->vector[j] = i;
+        }
+    }
+    for (int i = 0; i < VECTORS; i++)
+    {
+        for (int j = 0; j < stored[i]->len; j++)
+        {
+            CHECK(stored[i]->vector[j] == i)
+        }
+    }
+
+    // the store owns the vectors, a tree of them frees none
+    RBTree *tree = newMaxNormVectorTree(NULL);
+    CHECK(tree != NULL)
+    const Vector *largest = NULL;
+    for (int i = 0; i < VECTORS; i++)
+    {
+        stored[i]->norm = VECTOR_NORM_UNKNOWN;
+        if (insertToRBTree(tree, stored[i]) &&
+            (largest == NULL || normPlainly(stored[i]) > normPlainly(largest)))
+        {
+            largest = stored[i];
+        }
+    }
+    CHECK(maxNormVector(tree) != NULL)
+    CHECK(fabs(normPlainly(maxNormVector(tree)) - normPlainly(largest)) < 1e-9)
+    freeRBTree(&tree);
+    freeVectorStore(&store);
+    CHECK(store == NULL)
+    freeVectorStore(&store);
+    freeVectorStore(NULL);
+    return SUCCESS;
+}
+
+// ------------- string set -------------
+int testStringSet(void)
+{
+    RBTree *set = newRBStringSet();
+    CHECK(set != NULL)
+    char key[128];
+    for (int i = 0; i < KEYS; i++)
+    {
+        // every other key is too long to be kept in its node
+        snprintf(key, sizeof(key), i % 2 ? "%d" : "a long key that goes to the blocks %d", i);
+        CHECK(insertToRBTree(set, key) && !insertToRBTree(set, key))
+    }
+    // the set keeps copies, the buffer they came from is reused
+    snprintf(key, sizeof(key), "%d", 1);
+    CHECK(RBTreeContains(set, "a long key that goes to the blocks 0") && RBTreeContains(set, key))
+    const char *interned = RBStringSetIntern(set, "a long key that goes to the blocks 0");
+    CHECK(interned != NULL && interned == RBStringSetIntern(set, interned))
+    CHECK(set->size == KEYS && RBTreePopMin(set) == NULL)
+    size_t full = RBTreeMemoryStats(set, NULL).payloadBytes;
+    for (int i = 0; i < KEYS; i += 2)
+    {
+        snprintf(key, sizeof(key), "a long key that goes to the blocks %d", i);
+        CHECK(deleteFromRBTree(set, key))
+    }
+    // the blocks of the deleted long keys are given back, only the first one is kept
+    CHECK(RBTreeMemoryStats(set, NULL).payloadBytes * 4 < full)
+    CHECK(validateRBTree(set, NULL) && set->size == KEYS / 2)
+    for (int i = 0; i < KEYS; i++)
+    {
+        snprintf(key, sizeof(key), i % 2 ? "%d" : "a long key that goes to the blocks %d", i);
+        CHECK(!RBTreeContains(set, key) == !(i % 2))
+    }
+
+    // long keys stored again, in the kept block and new ones
+    for (int i = 0; i < KEYS; i += 2)
+    {
+        snprintf(key, sizeof(key), "a long key that goes to the blocks %d", i);
+        const char *copy = RBStringSetIntern(set, key);
+        CHECK(copy != NULL && copy != key && strcmp(copy, key) == 0)
+    }
+    CHECK(validateRBTree(set, NULL) && set->size == KEYS)
+    for (int i = 0; i < KEYS; i++)
+    {
+        snprintf(key, sizeof(key), i % 2 ? "%d" : "a long key that goes to the blocks %d", i);
+        CHECK(RBTreeContains(set, key))
+    }
+    freeRBTree(&set);
+    return SUCCESS;
+}
+
+// ------------- join strings -------------
+int testJoinStrings(void)
+{
+    RBTree *tree = newRBTree(stringCompare, freeString);
+    CHECK(tree != NULL)
+    CHECK(joinsTo(tree, ", ", "") && joinsTo(tree, NULL, ""))
+    CHECK(RBTreeJoinStrings(NULL, ", ", NULL) == NULL && !RBTreeWriteStrings(tree, ", ", NULL))
+    CHECK(insertToRBTree(tree, copyOfString("b")))
+    CHECK(joinsTo(tree, ", ", "b"))
+    CHECK(insertToRBTree(tree, copyOfString("a")) && insertToRBTree(tree, copyOfString("c")))
+    // the separator only goes between two strings, an empty string still gets its separators
+    CHECK(joinsTo(tree, ", ", "a, b, c") && joinsTo(tree, NULL, "abc") && joinsTo(tree, "", "abc"))
+    CHECK(insertToRBTree(tree, copyOfString("")))
+    CHECK(joinsTo(tree, "-", "-a-b-c"))
+    freeRBTree(&tree);
+
+    // more than the write buffer holds, with a string larger than it in the middle
+    enum
+    {
+        STRINGS = 20000,
+        HUGE_LEN = 100000
+    };
+    tree = newRBTree(stringCompare, freeString);
+    CHECK(tree != NULL)
+    char *huge = (char *) malloc(HUGE_LEN + 1);
+    CHECK(huge != NULL)
+    memset(huge, 'x', HUGE_LEN);
+    huge[HUGE_LEN] = '\0';
+    CHECK(insertToRBTree(tree, huge))
+    char key[32];
+    for (int i = 0; i < STRINGS; i++)
+    {
+        snprintf(key, sizeof(key), "%c%05d", i % 2 ? 'w' : 'y', i);
+        CHECK(insertToRBTree(tree, copyOfString(key)))
+    }
+    char *expected = (char *) malloc((size_t) STRINGS * 7 + HUGE_LEN + 1), *end = expected;
+    CHECK(expected != NULL)
+    for (int i = 1; i < STRINGS; i += 2)
+    {
+        end += sprintf(end, "w%05d;", i);
+    }
+    end += sprintf(end, "%s", huge);
+    for (int i = 0; i < STRINGS; i += 2)
+    {
+        end += sprintf(end, ";y%05d", i);
+    }
+    int passed = joinsTo(tree, ";", expected);
+    free(expected);
+    freeRBTree(&tree);
+    return passed;
+}
+
+// -------------- intervals --------------
+int testIntervals(void)
+{
+    enum
+    {
+        INTERVALS = 2000,
+        QUERIES = 200
+    };
+    static RBInterval intervals[INTERVALS];
+    static int in[INTERVALS];
+    static double scratch[16];
+    srand(9);
+    RBTree *tree = newRBIntervalTree(NULL, NULL);
+    CHECK(tree != NULL && tree->nodeSize <= sizeof(scratch))
+    for (int i = 0; i < INTERVALS; i++)
+    {
+        intervals[i].low = rand() % 1000;
+        intervals[i].high = intervals[i].low + rand() % (i % 10 == 0 ? 300 : 30);
+    }
+
+    // inserts and deletes mixed in, the queries after each round
+    for (int round = 0; round < 10; round++)
+    {
+        for (int i = 0; i < INTERVALS; i++)
+        {
+            if (rand() % 3 != 0)
+            {
+                continue;
+            }
+            if (in[i])
+            {
+                CHECK(deleteFromRBTree(tree, &intervals[i]))
+                in[i] = 0;
+            }
+            else
+            {
+                // an interval equal to one in the tree is rejected
+                in[i] = insertToRBTree(tree, &intervals[i]);
+            }
+        }
+        CHECK(validateRBTree(tree, NULL) && augmentedCorrectly(tree, tree->root, (Node *) scratch))
+        for (int query = 0; query < QUERIES; query++)
+        {
+            double low = rand() % 1040 - 20, high = low + (query % 4 == 0 ? 0 : rand() % 80);
+            const RBInterval *first = NULL;
+            int overlapping = 0;
+            for (int i = 0; i < INTERVALS; i++)
+            {
+                if (in[i] && intervals[i].low <= high && low <= intervals[i].high)
+                {
+                    overlapping++;
+                    first = first == NULL || compareIntervalsPlainly(&intervals[i], first) < 0
+                            ? &intervals[i] : first;
+                }
+            }
+            CHECK(RBIntervalOverlaps(tree, low, high) == first)
+            OverlapVisit visit = {low, high, NULL, 0, 1};
+            CHECK(forEachOverlapping(tree, low, high, visitOverlap, &visit))
+            CHECK(visit.ok && visit.count == overlapping)
+        }
+    }
+    CHECK(RBIntervalOverlaps(NULL, 0, 1) == NULL)
+    CHECK(!forEachOverlapping(NULL, 0, 1, visitOverlap, NULL))
+    freeRBTree(&tree);
+    return SUCCESS;
+}
+
+// ------------- hash index -------------
+int testHashIndex(void)
+{
+    static const HashFunc hashes[] = {hashInt, hashIntInRuns};
+    for (int i = 0; i < 2; i++)
+    {
+        // the lookups go through the index, after deletes have shifted its slots back
+        RBTree *tree = newRBTree(compareInts, NULL);
+        CHECK(tree != NULL && RBTreeSetHashIndex(tree, hashes[i]))
+        CHECK(checkRandomSet(tree, 10 + i) && tree->hashIndex != NULL)
+        freeRBTree(&tree);
+    }
+
+    RBTree *tree = newRBTree(compareInts, NULL);
+    CHECK(tree != NULL)
+    for (int key = 0; key < KEYS / 2; key++)
+    {
+        CHECK(insertToRBTree(tree, &keys[key]))
+    }
+    CHECK(RBTreeSetHashIndex(tree, hashInt) && tree->hashIndex != NULL)
+    // an index that can't grow is dropped, the insert still goes in and lookups use the tree
+    callocLimit = 1024;
+    int key = KEYS / 2;
+    while (tree->hashIndex != NULL && key < KEYS)
+    {
+        CHECK(insertToRBTree(tree, &keys[key]))
+        key++;
+    }
+    callocLimit = SIZE_MAX;
+    CHECK(tree->hashIndex == NULL && validateRBTree(tree, NULL) && tree->size == (size_t) key)
+    for (int i = 0; i < KEYS; i++)
+    {
+        CHECK(RBTreeContains(tree, &keys[i]) == (i < key))
+    }
+    // and a new one can be set
+    CHECK(RBTreeSetHashIndex(tree, hashInt) && tree->hashIndex != NULL)
+    for (int i = 0; i < KEYS; i += 2)
+    {
+        CHECK(deleteFromRBTree(tree, &keys[i]) == (i < key))
+    }
+    for (int i = 0; i < KEYS; i++)
+    {
+        CHECK((RBTreeFind(tree, &keys[i]) != NULL) == (i < key && i % 2 == 1))
+    }
+    CHECK(RBTreeSetHashIndex(tree, NULL) && tree->hashIndex == NULL)
+    freeRBTree(&tree);
+    return SUCCESS;
+}
+
+// ------------ bloom filter ------------
+int testBloomFilter(void)
+{
+    static int outside[KEYS];
+    for (int i = 0; i < KEYS; i++)
+    {
+        outside[i] = KEYS + i;
+    }
+    // the filter keeps up with inserts and deletes, with a rebuild every so many deletes
+    RBTree *tree = newRBTree(compareInts, NULL);
+    CHECK(tree != NULL && RBTreeSetBloomFilter(tree, hashInt, 0))
+    CHECK(checkRandomSet(tree, 12) && tree->bloom != NULL)
+    freeRBTree(&tree);
+
+    tree = newRBTree(compareInts, NULL);
+    CHECK(tree != NULL && RBTreeSetBloomFilter(tree, hashInt, 4))
+    for (int i = 0; i < KEYS; i++)
+    {
+        CHECK(insertToRBTree(tree, &keys[i]))
+    }
+    size_t full = RBTreeBloomStats(tree).bytes;
+    CHECK(full > 0)
+    // keys that were never inserted are rejected, by the filter or by the tree behind it
+    for (int i = 0; i < KEYS; i++)
+    {
+        CHECK(!RBTreeContains(tree, &outside[i]) && RBTreeFind(tree, &outside[i]) == NULL)
+        CHECK(!deleteFromRBTree(tree, &outside[i]) && RBTreeContains(tree, &keys[i]))
+    }
+
+    // deleting all but an eighth rebuilds the filter a few times, smaller in the end
+    for (int i = 0; i < KEYS; i++)
+    {
+        if (i % 8 != 0)
+        {
+            CHECK(deleteFromRBTree(tree, &keys[i]))
+        }
+    }
+    CHECK(tree->bloom != NULL && RBTreeBloomStats(tree).bytes < full)
+    for (int i = 0; i < KEYS; i++)
+    {
+        CHECK(RBTreeContains(tree, &keys[i]) == (i % 8 == 0))
+        CHECK(!RBTreeContains(tree, &outside[i]))
+    }
+    CHECK(validateRBTree(tree, NULL) && tree->size == KEYS / 8)
+    CHECK(RBTreeSetBloomFilter(tree, NULL, 0) && tree->bloom == NULL)
+    CHECK(RBTreeBloomStats(tree).bytes == 0)
+    freeRBTree(&tree);
+    return SUCCESS;
+}
+
+// --------------- cache ---------------
+int testCache(void)
+{
+    RBCache *cache = newRBCache(compareInts, free, free, 3, 100);
+    CHECK(cache != NULL)
+    for (int i = 0; i < 3; i++)
+    {
+        CHECK(RBCachePut(cache, newInt(i), newInt(10 * i), 10, RB_CACHE_NO_EXPIRY))
+    }
+    // 0 becomes the most recently used, so 1 is the one evicted
+    CHECK(*(int *) RBCacheGet(cache, &keys[0]) == 0)
+    CHECK(RBCachePut(cache, newInt(3), newInt(30), 10, RB_CACHE_NO_EXPIRY))
+    CHECK(RBCacheGet(cache, &keys[1]) == NULL && RBCacheGet(cache, &keys[0]) != NULL)
+    CHECK(cache->entries == 3 && cache->bytes == 30)
+
+    // replacing a value frees the new copy of the key and the old value
+    CHECK(RBCachePut(cache, newInt(2), newInt(22), 20, 5.0))
+    CHECK(*(int *) RBCacheGet(cache, &keys[2]) == 22 && cache->bytes == 40)
+
+    // an entry larger than the whole cache, or with a negative expiry time, is rejected: nothing
+    // is evicted for it and the key and value are still the caller's
+    int *key = newInt(4), *value = newInt(40);
+    CHECK(!RBCachePut(cache, key, value, 101, RB_CACHE_NO_EXPIRY) && cache->entries == 3)
+    CHECK(!RBCachePut(cache, key, value, 10, -2.0) && !RBCachePut(cache, key, value, 10, NAN))
+    *key = 2;
+    CHECK(!RBCachePut(cache, key, value, 10, -0.5) && *(int *) RBCacheGet(cache, key) == 22)
+
+    // an existing entry that can't be moved to its new expiry time is left as it was
+    callocLimit = 0;
+    CHECK(!RBCachePut(cache, key, value, 30, 1.0))
+    callocLimit = SIZE_MAX;
+    CHECK(*(int *) RBCacheGet(cache, key) == 22 && cache->entries == 3 && cache->bytes == 40)
+    CHECK(RBCacheExpireBefore(cache, 2.0) == 0)
+    free(key);
+    free(value);
+
+    // the byte bound evicts from the least recently used end
+    CHECK(RBCachePut(cache, newInt(5), newInt(50), 70, 2.0))
+    CHECK(cache->bytes == 100 && RBCacheGet(cache, &keys[3]) == NULL)
+    CHECK(RBCacheExpireBefore(cache, 3.0) == 1 && RBCacheGet(cache, &keys[5]) == NULL)
+
+    // a new expiry time moves the entry, and keeps its place in the recency order
+    CHECK(RBCachePut(cache, newInt(6), newInt(60), 10, 8.0) && cache->entries == 3)
+    CHECK(RBCachePut(cache, newInt(2), newInt(23), 20, RB_CACHE_NO_EXPIRY))
+    CHECK(RBCachePut(cache, newInt(6), newInt(61), 10, 7.0))
+    CHECK(RBCacheExpireBefore(cache, 6.0) == 0 && *(int *) RBCacheGet(cache, &keys[2]) == 23)
+    CHECK(RBCachePut(cache, newInt(7), newInt(70), 10, RB_CACHE_NO_EXPIRY))
+    CHECK(RBCacheGet(cache, &keys[0]) == NULL && *(int *) RBCacheGet(cache, &keys[6]) == 61)
+    CHECK(RBCacheExpireBefore(cache, 7.5) == 1 && RBCacheGet(cache, &keys[6]) == NULL)
+    CHECK(RBCacheRemove(cache, &keys[2]) && !RBCacheRemove(cache, &keys[2]))
+
+    RBCacheStats stats = RBCacheGetStats(cache);
+    CHECK(stats.expirations == 2 && stats.evictions >= 3)
+    freeRBCache(&cache);
+    return SUCCESS;
+}
+
+// ----------- buffered insert -----------
+int testBufferedInsert(void)
+{
+    RBTree *set = newRBTree(compareInts, free);
+    CHECK(set != NULL)
+    CHECK(RBTreeSetWriteBuffer(set, 4, NULL))
+    CHECK(RBTreeBufferedInsert(set, newInt(1)))
+    // lookups see the buffered items without merging them, the other reads don't
+    RBHandle handle = RBTreeFind(set, &keys[1]);
+    CHECK(RBTreeContains(set, &keys[1]) && handle != NULL && set->size == 0)
+    CHECK(RBTreeFlush(set) && set->size == 1 && RBTreeFind(set, &keys[1]) == handle)
+
+    // a duplicate of a merged or of a buffered item is left to the caller
+    int *duplicate = newInt(1);
+    CHECK(!RBTreeBufferedInsert(set, duplicate))
+    CHECK(RBTreeBufferedInsert(set, newInt(2)) && !RBTreeBufferedInsert(set, duplicate))
+    *duplicate = 2;
+    CHECK(!RBTreeBufferedInsert(set, duplicate))
+    // insertToRBTree merges first, and still fails on a duplicate
+    CHECK(!insertToRBTree(set, duplicate) && set->size == 2)
+    free(duplicate);
+
+    // a full buffer is merged before taking the next item
+    for (int i = 10; i < 20; i++)
+    {
+        CHECK(RBTreeBufferedInsert(set, newInt(i)) && RBTreeContains(set, &keys[i]))
+    }
+    const void *batch[] = {&keys[1], &keys[3], &keys[19]};
+    int results[3];
+    CHECK(RBTreeContainsBatch(set, batch, 3, results) && results[0] && !results[1] && results[2])
+    CHECK(RBTreeFlush(set) && set->size == 12 && validateRBTree(set, NULL))
+
+    // the handle of a buffered item can be erased
+    CHECK(RBTreeBufferedInsert(set, newInt(30)))
+    CHECK(RBTreeEraseHandle(set, RBTreeFind(set, &keys[30])) && !RBTreeContains(set, &keys[30]))
+    CHECK(set->size == 12 && validateRBTree(set, NULL))
+
+    // the random sets, with the buffer scanned or hashed
+    CHECK(checkBufferedSet(NULL, 13) && checkBufferedSet(hashInt, 14))
+
+    CHECK(RBTreeBufferedInsert(set, newInt(40)))
+    CHECK(RBTreeSetWriteBuffer(set, 0, NULL) && set->writeBuffer == NULL && set->size == 13)
+    RBTree *map = newRBMap(compareInts, NULL, NULL);
+    CHECK(!RBTreeSetWriteBuffer(map, 8, NULL))
+    freeRBTree(&map);
+    // the items still in the buffer are freed with the set, not merged
+    CHECK(RBTreeSetWriteBuffer(set, 8, hashInt) && RBTreeBufferedInsert(set, newInt(50)))
+    freeRBTree(&set);
+    return SUCCESS;
+}
+
+// ---------- optimistic reads ----------
+int testOptimisticReads(void)
+{
+    RBTree *tree = newRBTree(compareInts, NULL);
+    CHECK(tree != NULL)
+    for (int key = 0; key < KEYS; key += 2)
+    {
+        CHECK(insertToRBTree(tree, &keys[key]))
+    }
+    CHECK(RBTreeSetOptimisticReads(tree, TRUE) && !RBTreeSetWriteBuffer(tree, 8, NULL))
+    ReadersArgs readers = {tree, FALSE, FALSE};
+    srand(15);
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        pthread_t ids[READERS];
+        readers.done = FALSE;
+        for (int i = 0; i < READERS; i++)
+        {
+            CHECK(pthread_create(&ids[i], NULL, readKeys, &readers) == 0)
+        }
+        // the odd keys come and go, rotating the even ones around while the readers walk past
+        for (int step = 0; step < STEPS / ROUNDS; step++)
+        {
+            int key = 2 * (rand() % (KEYS / 2)) + 1;
+            if (!insertToRBTree(tree, &keys[key]))
+            {
+                deleteFromRBTree(tree, &keys[key]);
+            }
+        }
+        __atomic_store_n(&readers.done, TRUE, __ATOMIC_RELEASE);
+        for (int i = 0; i < READERS; i++)
+        {
+            pthread_join(ids[i], NULL);
+        }
+        // no reader is left in the tree, so its removed nodes may go
+        RBTreeReclaim(tree);
+        CHECK(!readers.failed && validateRBTree(tree, NULL))
+    }
+    CHECK(RBTreeSetOptimisticReads(tree, FALSE))
+    freeRBTree(&tree);
+    return SUCCESS;
+}
+
+// --------------- clone ---------------
+int testClone(void)
+{
+    static IntList before, after;
+    static double scratch[16];
+    for (int threads = 1; threads <= 4; threads += 3)
+    {
+        RBTree *tree = newRBTree(compareInts, free);
+        CHECK(tree != NULL)
+        srand(threads);
+        for (int i = 0; i < KEYS; i++)
+        {
+            int *item = newInt(rand() % (2 * KEYS));
+            if (!insertToRBTree(tree, item))
+            {
+                free(item);
+            }
+        }
+        RBTree *clone = RBTreeCloneParallel(tree, copyInt, threads);
+        CHECK(clone != NULL && validateRBTree(clone, NULL) && clone->size == tree->size)
+        before.count = 0, after.count = 0;
+        CHECK(forEachRBTree(tree, collectInt, &before) && forEachRBTree(clone, collectInt, &after))
+        CHECK(before.count == after.count)
+        CHECK(memcmp(before.values, after.values, sizeof(int) * before.count) == 0)
+        CHECK(*(int *) clone->min->data == *(int *) tree->min->data)
+        CHECK(*(int *) clone->max->data == *(int *) tree->max->data)
+
+        // the clone is a tree of its own: changing it leaves the source as it was
+        for (int i = 0; i < KEYS; i += 2)
+        {
+            deleteFromRBTree(clone, &i);
+        }
+        CHECK(validateRBTree(clone, NULL) && validateRBTree(tree, NULL))
+        CHECK((int) tree->size == before.count)
+        freeRBTree(&clone);
+        freeRBTree(&tree);
+
+        // an augmented clone of copied items points only into its own items, it outlives the tree
+        tree = newMaxNormVectorTree(freeVector);
+        CHECK(tree != NULL && tree->nodeSize <= sizeof(scratch))
+        for (int i = 0; i < 300; i++)
+        {
+            Vector *vector = newRandomVector(1 + rand() % 6);
+            CHECK(vector != NULL)
+            if (!insertToRBTree(tree, vector))
+            {
+                freeVector(vector);
+            }
+        }
+        double largest = normPlainly(maxNormVector(tree));
+        clone = RBTreeCloneParallel(tree, copyVector, threads);
+        freeRBTree(&tree);
+        CHECK(clone != NULL && augmentedCorrectly(clone, clone->root, (Node *) scratch))
+        CHECK(fabs(normPlainly(maxNormVector(clone)) - largest) < 1e-9)
+        const Vector *max = maxNormVectorInRange(clone, clone->min->data, clone->max->data);
+        CHECK(max != NULL && fabs(normPlainly(max) - largest) < 1e-9)
+        CHECK(RBTreeExtract(clone, max) == max)
+        freeVector((Vector *) max);
+        CHECK(augmentedCorrectly(clone, clone->root, (Node *) scratch))
+        freeRBTree(&clone);
+    }
+
+    RBTree *map = newRBMap(compareInts, NULL, NULL);
+    CHECK(map != NULL)
+    for (int i = 0; i < 100; i++)
+    {
+        CHECK(RBMapPut(map, &keys[i], &keys[KEYS - 1 - i]))
+    }
+    RBTree *mapClone = RBTreeClone(map, NULL);
+    CHECK(mapClone != NULL && mapClone->size == 100)
+    void *value;
+    CHECK(RBMapGet(mapClone, &keys[7], &value) && value == &keys[KEYS - 8])
+    freeRBTree(&mapClone);
+    freeRBTree(&map);
+    return SUCCESS;
+}
+
+// --------------- diff ---------------
+int testDiff(void)
+{
+    static Change expected[KEYS];
+    RBTree *before = newRBMap(compareInts, NULL, NULL);
+    CHECK(before != NULL)
+    for (int i = 0; i < 100; i++)
+    {
+        CHECK(RBMapPut(before, &keys[i], &keys[i]))
+    }
+    RBTree *after = RBTreeClone(before, NULL);
+    CHECK(after != NULL)
+    memset(expected, 0, sizeof(expected));
+    CHECK(diffsExactly(before, after, equalInts, expected))
+    CHECK(diffsExactly(before, after, RBTreeSameObject, expected))
+
+    CHECK(deleteFromRBTree(after, &keys[3]))
+    CHECK(RBMapPut(after, &keys[200], NULL))
+    CHECK(RBMapUpdate(after, &keys[50], &keys[0]))
+    // an equal value that is another object only changed by identity
+    int sixty = 60;
+    CHECK(RBMapUpdate(after, &keys[60], &sixty))
+    expected[3] = REMOVED, expected[200] = ADDED, expected[50] = CHANGED;
+    CHECK(diffsExactly(before, after, equalInts, expected))
+    expected[60] = CHANGED;
+    CHECK(diffsExactly(before, after, RBTreeSameObject, expected))
+    // without an equalFunc, only the keys count
+    expected[50] = UNCHANGED, expected[60] = UNCHANGED;
+    CHECK(diffsExactly(before, after, NULL, expected))
+
+    // a map's ChangeFunc gets both values through the handles
+    static IntList values;
+    values.count = 0;
+    CHECK(RBTreeDiff(before, after, NULL, NULL, equalInts, collectValues, &values))
+    CHECK(values.count == 2 && values.values[0] == 50 && values.values[1] == 0)
+
+    memset(expected, 0, sizeof(expected));
+    CHECK(diffsExactly(before, before, NULL, expected))
+    RBTree *set = newRBTree(compareInts, NULL);
+    CHECK(set != NULL)
+    CHECK(!RBTreeDiff(before, set, markAdded, markRemoved, NULL, markChanged, expected))
+    freeRBTree(&set);
+    freeRBTree(&after);
+    freeRBTree(&before);
+
+    // a multiset item held a different number of times changed
+    before = newRBMultiset(compareInts, NULL, RB_MULTISET_COUNTED);
+    after = newRBMultiset(compareInts, NULL, RB_MULTISET_COUNTED);
+    CHECK(before != NULL && after != NULL)
+    for (int i = 0; i < 10; i++)
+    {
+        CHECK(insertToRBTree(before, &keys[i]) && insertToRBTree(after, &keys[i]))
+    }
+    CHECK(insertToRBTree(after, &keys[4]))
+    expected[4] = CHANGED;
+    CHECK(diffsExactly(before, after, NULL, expected))
+    freeRBTree(&after);
+    freeRBTree(&before);
+
+    // random sets against what was put in each
+    before = newRBTree(compareInts, NULL), after = newRBTree(compareInts, NULL);
+    CHECK(before != NULL && after != NULL)
+    srand(16);
+    memset(expected, 0, sizeof(expected));
+    for (int i = 0; i < KEYS; i++)
+    {
+        int inBefore = rand() % 3 == 0, inAfter = rand() % 3 == 0;
+        CHECK((!inBefore || insertToRBTree(before, &keys[i])) &&
+              (!inAfter || insertToRBTree(after, &keys[i])))
+        expected[i] = inBefore == inAfter ? UNCHANGED : inAfter ? ADDED : REMOVED;
+    }
+    CHECK(diffsExactly(before, after, equalInts, expected))
+    freeRBTree(&after);
+    freeRBTree(&before);
+    return SUCCESS;
+}
+
+int main(void)
+{
+    for (int i = 0; i < KEYS; i++)
+    {
+        keys[i] = i;
+    }
+    const struct
+    {
+        const char *name;
+        TestFunc test;
+    } tests[] = {
+            {"random set", testRandomSet},
+            {"memory stats", testMemoryStats},
+            {"map", testMap},
+            {"multiset", testMultiset},
+            {"extract ownership", testExtractOwnership},
+            {"finger search", testFingerSearch},
+            {"top down", testTopDown},
+            {"wavl", testWavl},
+            {"batch lookups", testBatchLookups},
+            {"vector kernels", testVectorKernels},
+            {"max norm range", testMaxNormRange},
+            {"vector store", testVectorStore},
+            {"string set", testStringSet},
+            {"join strings", testJoinStrings},
+            {"intervals", testIntervals},
+            {"hash index", testHashIndex},
+            {"bloom filter", testBloomFilter},
+            {"cache", testCache},
+            {"buffered insert", testBufferedInsert},
+            {"optimistic reads", testOptimisticReads},
+            {"clone", testClone},
+            {"diff", testDiff},
+    };
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        int passed = tests[i].test();
+        printf("%s: %s\n", tests[i].name, passed ? "passed" : "FAILED");
+        failed += !passed;
+    }
+    if (failed != 0)
+    {
+        printf("%d tests failed\n", failed);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
@@ -12,6 +12,47 @@
 #define JSON_FILE "tree.json"
 
 // tree correctness validation
+typedef enum RBValidationError
+{
+	RB_VALID,
+	RB_RED_ROOT,
+	RB_RED_RED,
+	RB_BLACK_HEIGHT,
+	RB_BST_ORDER,
+	RB_BAD_PARENT,
+	RB_SIZE_MISMATCH,
+	RB_VALIDATION_ABORTED,
+	RB_RANK_RULE
+} RBValidationError;
+
+/**
+ * the result of a validation: the first broken invariant (in ascending order of the tree) and the
+ * node it was found at, or RB_VALID with the number of nodes and the black height of the tree (0
+ * for a WAVL tree, whose colors are not kept).
+ */
+typedef struct RBValidationReport
+{
+	RBValidationError error;
+	const Node *node;
+	const char *message;
+	long unsigned nodes;
+	int blackHeight;
+} RBValidationReport;
+
+/**
+ * validate all the RB tree invariants (black root, no red-red, equal black heights, BST order,
+ * matching parent pointers and size) in a single pass that uses no recursion and no allocation.
+ * a WAVL tree is checked for its rank rule instead of the colors and the black height.
+ * @param report: may be NULL, filled with the details of the result.
+ * @return 1 if the tree is valid, 0 if not.
+ */
+int validateRBTree(const RBTree *tree, RBValidationReport *report);
+
+/**
+ * same as validateRBTree, but disjoint subtrees are validated by @threads threads in parallel.
+ */
+int validateRBTreeParallel(const RBTree *tree, int threads, RBValidationReport *report);
+
 int isValidRBTree(RBTree *tree);
 
 // tree visualizations
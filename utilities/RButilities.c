@@ -2,164 +2,390 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "RBUtilities.h"
 
 /**
- * return a single (always left) path number of blacks.
+ * the split depth of the parallel validation is the smallest depth with at least
+ * SEGMENTS_PER_THREAD subtrees per thread, but never more than MAX_SPLIT_DEPTH.
  */
-int getPathBlacksNum(Node *node, int blacks)
-{
-	if (node == NULL)
-	{
-		return blacks + 1;
-	}
+#define SEGMENTS_PER_THREAD 4
+#define MAX_SPLIT_DEPTH 12
+
+static const char *const validationMessages[] = {
+	"valid",
+	"Root must be black",
+	"No consecutive RED nodes allowed",
+	"Not all paths between the root and leafs have the same number of blacks",
+	"BST invariant isn't preserved",
+	"Double pointers aren't matching",
+	"Calculated tree size and tree.size property are different",
+	"Validation could not run (out of memory or thread failure)",
+	"WAVL children must be 1 or 2 ranks below their parent, and leaves of rank 0"
+};
 
-	if (node->color == BLACK)
-	{
-		return getPathBlacksNum(node->left, blacks+1);
-	}
-	return getPathBlacksNum(node->left, blacks);
-}
+/**
+ * a subtree to validate: all its keys must be strictly between the data of @lower and @upper
+ * (NULL for no bound), and @blacksAbove black nodes lie between it and the root of the tree.
+ */
+typedef struct Segment
+{
+	const RBTree *tree;
+	const Node *root;
+	const Node *lower, *upper;
+	int blacksAbove;
+	long unsigned limit;
+	RBValidationReport report;
+} Segment;
 
 /**
- * return true if all paths from node to a leaf have (shouldBe - blacks) blacks
+ * the local invariant of a node: in a red black tree no red node has a red parent, in a WAVL tree
+ * both children are 1 or 2 ranks below the node (a missing child has rank -1) and a leaf has rank 0.
+ * @return RB_VALID or the broken invariant.
  */
-int validatePaths(Node *node, int blacks, int shouldBe)
+static RBValidationError checkNode(const RBTree *tree, const Node *node)
 {
-	if (node == NULL)
+	if (tree->balance == RB_BALANCE_WAVL)
 	{
-		return blacks + 1 == shouldBe;
+		int left = node->rank - (node->left == NULL ? -1 : node->left->rank);
+		int right = node->rank - (node->right == NULL ? -1 : node->right->rank);
+		if (left < 1 || left > 2 || right < 1 || right > 2 ||
+			(node->left == NULL && node->right == NULL && node->rank != 0))
+		{
+			return RB_RANK_RULE;
+		}
+		return RB_VALID;
+	}
+	if (node->color == RED && node->parent != NULL && node->parent->color == RED)
+	{
+		return RB_RED_RED;
 	}
+	return RB_VALID;
+}
 
-	blacks += (node->color == BLACK) ? 1 : 0;
-	return validatePaths(node->left, blacks, shouldBe) &&
-		   validatePaths(node->right, blacks, shouldBe);
+static int fail(RBValidationReport *report, RBValidationError error, const Node *node)
+{
+	report->error = error;
+	report->node = node;
+	report->message = validationMessages[error];
+	return 0;
 }
 
 /**
- * return true if all nodes follow the color code requirements for RB tree
+ * validate a single subtree in one in-order walk over the parent pointers. the walk never leaves
+ * the subtree, checks each child's parent pointer before stepping into it (so a broken pointer
+ * can't lead it astray), and gives up after @limit nodes (so a cycle can't hang it).
+ * on success report->blackHeight is the black height of the subtree (a NULL leaf counts as 1).
  */
-int validateColors(Node *node)
+static int validateSegment(Segment *segment)
 {
+	RBValidationReport *report = &segment->report;
+	const RBTree *tree = segment->tree;
+	const Node *stop = segment->root == NULL ? NULL : segment->root->parent;
+	const Node *node = segment->root, *from = stop, *prev = segment->lower;
+	int blacks = 0;
+
+	report->nodes = 0, report->blackHeight = -1;
+	report->error = RB_VALID, report->node = NULL, report->message = validationMessages[RB_VALID];
 	if (node == NULL)
 	{
+		report->blackHeight = 1;
 		return 1;
 	}
-	if (node->color == RED && node->parent && node->parent->color == RED)
+
+	while (node != stop)
 	{
-		return 0;
+		const Node *next;
+		if (from == node->parent)
+		{
+			// first visit: colors, then go left
+			if (++report->nodes > segment->limit)
+			{
+				return fail(report, RB_SIZE_MISMATCH, node);
+			}
+			RBValidationError error = checkNode(tree, node);
+			if (error != RB_VALID)
+			{
+				return fail(report, error, node);
+			}
+			blacks += node->color == BLACK;
+			if (node->left != NULL)
+			{
+				if (node->left->parent != node)
+				{
+					return fail(report, RB_BAD_PARENT, node->left);
+				}
+				from = node, node = node->left;
+				continue;
+			}
+			from = NULL;
+		}
+		if (from == node->left)
+		{
+			// in-order visit: order against the previous node, then go right
+			if (tree->balance == RB_BALANCE_RED_BLACK && (node->left == NULL || node->right == NULL))
+			{
+				if (report->blackHeight == -1)
+				{
+					report->blackHeight = blacks + 1;
+				}
+				else if (report->blackHeight != blacks + 1)
+				{
+					return fail(report, RB_BLACK_HEIGHT, node);
+				}
+			}
+			if (prev != NULL && tree->compFunc(prev->data, node->data) >= 0)
+			{
+				return fail(report, RB_BST_ORDER, node);
+			}
+			prev = node;
+			if (node->right != NULL)
+			{
+				if (node->right->parent != node)
+				{
+					return fail(report, RB_BAD_PARENT, node->right);
+				}
+				from = node, node = node->right;
+				continue;
+			}
+		}
+		// last visit: go up
+		blacks -= node->color == BLACK;
+		next = node->parent;
+		from = node, node = next;
+	}
+
+	if (segment->upper != NULL && prev != NULL && tree->compFunc(prev->data, segment->upper->data) >= 0)
+	{
+		return fail(report, RB_BST_ORDER, prev);
+	}
+	// the colors of a WAVL tree mean nothing, its rank rule keeps it balanced instead
+	if (tree->balance == RB_BALANCE_WAVL)
+	{
+		report->blackHeight = 0;
 	}
-	return validateColors(node->left) && validateColors(node->right);
+	return 1;
 }
 
-int validateBST(RBTree *tree, Node *node)
+/**
+ * the root and size invariants, shared by both validation modes
+ */
+static int validateRoot(const RBTree *tree, RBValidationReport *report)
 {
-	if (node == NULL)
+	report->nodes = 0, report->blackHeight = tree->balance == RB_BALANCE_WAVL ? 0 : 1;
+	report->error = RB_VALID, report->node = NULL, report->message = validationMessages[RB_VALID];
+	if (tree->root == NULL)
 	{
-		return 1;
+		return tree->size == 0 ? 1 : fail(report, RB_SIZE_MISMATCH, NULL);
 	}
-	if (node->left != NULL && 0 < tree->compFunc(node->left->data, node->data))
+	if (tree->root->parent != NULL)
 	{
-		return 0;
+		return fail(report, RB_BAD_PARENT, tree->root);
 	}
-	if (node->right != NULL && 0 < tree->compFunc(node->data, node->right->data))
+	if (tree->balance == RB_BALANCE_RED_BLACK && tree->root->color != BLACK)
 	{
-		return 0;
+		return fail(report, RB_RED_ROOT, tree->root);
 	}
-	return validateBST(tree, node->left) && validateBST(tree, node->right);
+	return 1;
 }
 
-int validatePointers(Node *node)
+int validateRBTree(const RBTree *tree, RBValidationReport *report)
 {
-	if (node == NULL)
+	RBValidationReport ignored;
+	if (report == NULL)
 	{
-		return 1;
+		report = &ignored;
 	}
-    int dat_from_node = *(int*) node->data;
-	if (node->left != NULL)
+	if (!validateRoot(tree, report) || tree->root == NULL)
 	{
-		if (node->left->parent != node)
-		{
-		    // +++++++++++++++++++++++++++++++++++++++++++++++++
-//            int dat_from_node = *(int*) node->data;
-            int dat_from_parent = *(int*) node->left->parent->data;
-            printf("LEFT: THIS FUCKING DATA %d |%d|\n", dat_from_node, dat_from_parent);
-            // +++++++++++++++++++++++++++++++++++++++++++++++++
-			return 0;
-		}
+		return report->error == RB_VALID;
 	}
-	if (node->right != NULL)
+
+	Segment segment = {tree, tree->root, NULL, NULL, 0, tree->size, {RB_VALID, NULL, NULL, 0, 0}};
+	int valid = validateSegment(&segment);
+	*report = segment.report;
+	if (valid && report->nodes != tree->size)
 	{
-		if (node->right->parent != node)
-		{
-            // +++++++++++++++++++++++++++++++++++++++++++++++++
-//            int dat_from_node = *(int*) node->data;
-            int dat_from_parent = *(int*) node->right->parent->data;
-            printf("RIGHT: THIS FUCKING DATA %d |%d|\n", dat_from_node, dat_from_parent);
-            // +++++++++++++++++++++++++++++++++++++++++++++++++
-			return 0;
-		}
+		return fail(report, RB_SIZE_MISMATCH, NULL);
 	}
-	return validatePointers(node->left) && validatePointers(node->right);
+	return valid;
 }
 
-int treeSize(Node *node, int sum)
+/**
+ * the range of segments a single validation thread handles
+ */
+typedef struct SegmentRange
 {
-	if (node == NULL)
+	Segment *segments;
+	size_t first, count, step;
+} SegmentRange;
+
+static void *validateSegments(void *args)
+{
+	SegmentRange *range = (SegmentRange *) args;
+	for (size_t i = range->first; i < range->count; i += range->step)
 	{
-		return sum;
+		validateSegment(&range->segments[i]);
 	}
-	return treeSize(node->left, sum) + treeSize(node->right, sum) + 1;
+	return NULL;
 }
 
 /**
- * validate a tree structure according to the 4 RB tree invariants
+ * split the top @depth levels of the tree into the segments below them, validating the top nodes
+ * on the way. @segments must have room for 2^depth segments.
+ * @return the number of segments, or 0 if the top of the tree is invalid.
  */
-int isValidRBTree(RBTree *tree)
+static size_t splitTree(const RBTree *tree, int depth, Segment *segments, RBValidationReport *report)
 {
-	Node *root = tree->root;
+	size_t count = 1;
+	Segment root = {tree, tree->root, NULL, NULL, 0, tree->size, {RB_VALID, NULL, NULL, 0, 0}};
+	segments[0] = root;
 
-	if (root != NULL)
+	for (int level = 0; level < depth; level++)
 	{
-		if (root->color != BLACK)
+		// expand in place from the end, so segments stay in ascending (in-order) order
+		for (size_t i = count; i-- > 0;)
 		{
-			printf("Root must be black\n");
-			return 0;
+			Segment top = segments[i];
+			const Node *node = top.root;
+			if (node == NULL)
+			{
+				segments[2 * i] = top;
+				segments[2 * i + 1] = top;
+				continue;
+			}
+			report->nodes++;
+			RBValidationError error = checkNode(tree, node);
+			if (error != RB_VALID)
+			{
+				return fail(report, error, node);
+			}
+			if ((top.lower != NULL && tree->compFunc(top.lower->data, node->data) >= 0) ||
+				(top.upper != NULL && tree->compFunc(node->data, top.upper->data) >= 0))
+			{
+				return fail(report, RB_BST_ORDER, node);
+			}
+			if ((node->left != NULL && node->left->parent != node) ||
+				(node->right != NULL && node->right->parent != node))
+			{
+				return fail(report, RB_BAD_PARENT, node);
+			}
+			Segment left = top, right = top;
+			left.root = node->left, left.upper = node;
+			right.root = node->right, right.lower = node;
+			left.blacksAbove = right.blacksAbove = top.blacksAbove + (node->color == BLACK);
+			segments[2 * i] = left;
+			segments[2 * i + 1] = right;
 		}
+		count *= 2;
+	}
+	return count;
+}
+
+int validateRBTreeParallel(const RBTree *tree, int threads, RBValidationReport *report)
+{
+	RBValidationReport ignored;
+	if (report == NULL)
+	{
+		report = &ignored;
+	}
+	if (threads <= 1)
+	{
+		return validateRBTree(tree, report);
+	}
+	if (!validateRoot(tree, report) || tree->root == NULL)
+	{
+		return report->error == RB_VALID;
+	}
+
+	int depth = 0;
+	while (depth < MAX_SPLIT_DEPTH && ((size_t) 1 << depth) < (size_t) threads * SEGMENTS_PER_THREAD)
+	{
+		depth++;
+	}
+	Segment *segments = (Segment *) malloc(sizeof(Segment) << depth);
+	SegmentRange *ranges = (SegmentRange *) malloc(sizeof(SegmentRange) * threads);
+	pthread_t *ids = (pthread_t *) malloc(sizeof(pthread_t) * threads);
+	if (segments == NULL || ranges == NULL || ids == NULL)
+	{
+		free(segments);
+		free(ranges);
+		free(ids);
+		return fail(report, RB_VALIDATION_ABORTED, NULL);
+	}
 
-		int pathBlacks = getPathBlacksNum(root, 0);
-		if (!validatePaths(root, 0, pathBlacks))
+	size_t count = splitTree(tree, depth, segments, report);
+	int started = 0;
+	for (int t = 0; count != 0 && t < threads; t++)
+	{
+		SegmentRange range = {segments, (size_t) t, count, (size_t) threads};
+		ranges[t] = range;
+		if (pthread_create(&ids[t], NULL, validateSegments, &ranges[t]) != 0)
 		{
-			fprintf(stderr, "Not all paths between the root and leafs have the same number of blacks (should be %d)\n", pathBlacks);
-			return 0;
+			fail(report, RB_VALIDATION_ABORTED, NULL);
+			break;
 		}
-		if (!validateColors(root))
+		started++;
+	}
+	for (int t = 0; t < started; t++)
+	{
+		pthread_join(ids[t], NULL);
+	}
+
+	// a segment below a NULL child is that same NULL leaf repeated, count its nodes once
+	int blackHeight = -1;
+	for (size_t i = 0; started == threads && i < count; i++)
+	{
+		Segment *segment = &segments[i];
+		if (segment->report.error != RB_VALID)
 		{
-			fprintf(stderr, "All nodes must be BLACK or RED, and no consecutive RED nodes allowed.\n");
-			return 0;
+			*report = segment->report;
+			break;
 		}
-		if (!validateBST(tree, root))
+		if (segment->root != NULL)
 		{
-			fprintf(stderr, "BST invariant isn't preserved.\n");
-			return 0;
+			report->nodes += segment->report.nodes;
 		}
-        // #############################################
-		if (!validatePointers(tree->root))
+		int height = segment->blacksAbove + segment->report.blackHeight;
+		if (tree->balance == RB_BALANCE_WAVL)
 		{
-			fprintf(stderr, "Double pointers aren't matching\n");
-			return 0;
+			blackHeight = 0;
 		}
-		if (treeSize(tree->root, 0) != (int)tree->size)
+		else if (blackHeight == -1)
 		{
-			fprintf(stderr, "%d - %d \n", treeSize(tree->root, 0), (int)tree->size);
-			fprintf(stderr, "Calculated tree size and tree.size property are different.\n");
-			return 0;
+			blackHeight = height;
+		}
+		else if (blackHeight != height)
+		{
+			fail(report, RB_BLACK_HEIGHT, segment->root);
+			break;
 		}
 	}
+	free(segments);
+	free(ranges);
+	free(ids);
+
+	if (report->error != RB_VALID)
+	{
+		return 0;
+	}
+	report->blackHeight = blackHeight;
+	if (report->nodes != tree->size)
+	{
+		return fail(report, RB_SIZE_MISMATCH, NULL);
+	}
 	return 1;
 }
 
+/**
+ * validate a tree structure according to the 4 RB tree invariants
+ */
+int isValidRBTree(RBTree *tree)
+{
+	return validateRBTree(tree, NULL);
+}
+
 // ------------------------------------
 
 